@@ -9,30 +9,20 @@ uniform int       iSamples;
 out vec4          fragColor;
 
 #define EPSILON 0.0001
-#define STEPS 512
-#define DENOISE 1
 #define MAX_DISTANCE 100.0
 #define MAX_AO_DISTANCE 1.0
 #define M_PI 3.1415926535897932384626433832795
 
 float model(vec3 p); // forward-declaration
-
-#if DENOISE
-vec2 seed = vec2(-1,1)*(iSamples*(1.0/12.0) + 1.0);
-#else
-vec2 seed = (vec2(-1.0) + 2.0*gl_FragCoord.xy/iResolution.xy)*(iSamples*(1.0/12.0) + 1.0);
-#endif
-vec2 noise2f()
-{
-    // lumina.sourceforge.net/Tutorials/Noise.html
-    seed += vec2(-1, 1);
-    return vec2(fract(sin(dot(seed.xy, vec2(12.9898, 78.233))) * 43758.5453),
-                fract(cos(dot(seed.xy, vec2(4.898, 7.23))) * 23421.631));
-}
+float tracePixelAngle(); // see libf/trace.f
+float sphereTrace(vec3 ro, vec3 rd, float t, float tmax, float epsilon, float pixelAngle);
+bool pixelConverged(); // see libf/sampling.f
+vec2 sample2f();
+void sampleBounce(int bounce);
 
 vec3 cosineWeightedSample(vec3 normal)
 {
-    vec2 u = noise2f();
+    vec2 u = sample2f();
     float a = 0.99*(1.0 - 2.0*u[0]);
     float b = 0.99*(sqrt(1.0 - a*a));
     float phi = 6.2831853072*u[1];
@@ -62,38 +52,26 @@ vec3 normal(vec3 p)
 
 float trace(vec3 ro, vec3 rd)
 {
-    float t = 0.0;
-    for (int i = ZERO; i < STEPS; i++)
-    {
-        vec3 p = ro + t*rd;
-        float d = model(p);
-        if (d <= EPSILON) return t;
-        t += d;
-        if (t > MAX_DISTANCE) break;
-    }
-    return -1.0;
+    return sphereTrace(ro, rd, 0.0, MAX_DISTANCE, EPSILON, tracePixelAngle());
 }
 
 float ambientOcclusion(vec3 p)
 {
     vec3 n = normal(p);
     vec3 ro = p + 2.0*EPSILON*n;
+    sampleBounce(0);
     vec3 rd = cosineWeightedSample(n);
-    float t = 0.0;
-    for (int i = ZERO; i < STEPS && t < MAX_AO_DISTANCE; i++)
-    {
-        vec3 p = ro + t*rd;
-        float d = model(p);
-        t += d;
-        if (d <= EPSILON)
-            return 0.0;
-    }
+    if (sphereTrace(ro, rd, 0.0, MAX_AO_DISTANCE, EPSILON, 0.0) >= 0.0)
+        return 0.0;
     return 1.0;
 }
 
 void main()
 {
-    vec3 rd = rayPinhole(noise2f());
+    if (pixelConverged())
+        discard;
+
+    vec3 rd = rayPinhole(sample2f());
     vec3 ro = (iView * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
     rd = normalize((iView * vec4(rd, 0.0)).xyz);
 
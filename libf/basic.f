@@ -20,15 +20,12 @@ out vec4          fragColor;
 #define M_PI 3.1415926535897932384626433832795
 
 float model(vec3 p); // forward-declaration
-
-// lumina.sourceforge.net/Tutorials/Noise.html
-vec2 seed = vec2(-1,1)*(iSamples*(1.0/12.0) + 1.0);
-vec2 noise2f()
-{
-    seed += vec2(-1, 1);
-    return vec2(fract(sin(dot(seed.xy, vec2(12.9898, 78.233))) * 43758.5453),
-                fract(cos(dot(seed.xy, vec2(4.898, 7.23))) * 23421.631));
-}
+float modelCached(vec3 p); // see libf/brickmap.f
+float traceLipschitz(); // see libf/trace.f
+float tracePixelAngle();
+float sphereTrace(vec3 ro, vec3 rd, float t, float tmax, float epsilon, float pixelAngle);
+bool pixelConverged(); // see libf/sampling.f
+vec2 sample2f();
 
 // http://iquilezles.org/www/articles/normalsSDF/normalsSDF.htm
 vec3 normalModel(vec3 p)
@@ -41,17 +38,10 @@ vec3 normalModel(vec3 p)
                       e.xxx*model( p + e.xxx ) );
 }
 
-float traceModel(vec3 ro, vec3 rd, float t)
+float traceModel(vec3 ro, vec3 rd, float t, float pixelAngle)
 {
-    for (int i = ZERO; i < STEPS; i++)
-    {
-        vec3 p = ro + t*rd;
-        float d = model(p);
-        if (d <= EPSILON) return t;
-        t += d;
-        if (t > MAX_DISTANCE) return INFINITY;
-    }
-    return INFINITY;
+    t = sphereTrace(ro, rd, t, MAX_DISTANCE, EPSILON, pixelAngle);
+    return t < 0.0 ? INFINITY : t;
 }
 
 float traceGround(vec3 ro, vec3 rd)
@@ -85,7 +75,7 @@ float visibility(in vec3 ro, in vec3 n, in vec3 rd)
 {
     if (traceGround(ro + 2.0*EPSILON*n, rd) < INFINITY)
         return 0.0;
-    if (traceModel(ro + 2.0*EPSILON*n, rd, 0.0) < INFINITY)
+    if (traceModel(ro + 2.0*EPSILON*n, rd, 0.0, 0.0) < INFINITY)
         return 0.0;
     return 1.0;
 }
@@ -110,7 +100,7 @@ vec3 materialModel(vec3 p)
 vec3 render(vec3 ro, vec3 rd, float t)
 {
     float tg = traceGround(ro, rd);
-    float tm = traceModel(ro, rd, t);
+    float tm = traceModel(ro, rd, t, tracePixelAngle());
     vec3 n,m,p;
     if (tg < tm)
     {
@@ -137,67 +127,99 @@ vec3 render(vec3 ro, vec3 rd, float t)
     return col;
 }
 
+// The color pass can be preceded by a cone-tracing pre-pass, which traces
+// one cone per texel of a low-resolution buffer (iLowResolution). A cone
+// encloses the rays of all the pixels in the texel's block, and stops at a
+// distance that is free of the model along each of those rays, so that the
+// rays can start from there. The pre-pass is run as a cascade of levels,
+// from coarse to fine, where each level starts its cones where the cones
+// of the previous level (iChannel0) stopped.
+#define MODE_RENDER             0 // trace rays from the camera
+#define MODE_RENDER_FROM_CONES  1 // trace rays from the finest level in iChannel0
+#define MODE_CONES              2 // trace the coarsest level
+#define MODE_REFINE_CONES       3 // trace a level starting from iChannel0
+
+// Direction in view-space of the ray through a point on the image, in
+// pixels with the origin at the bottom-left.
+vec3 cameraRay(vec2 fragCoord)
+{
+    vec2 uv = vec2(fragCoord.x, iResolution.y - fragCoord.y) - iCameraCenter;
+    return normalize(vec3(uv, -iCameraF));
+}
+
+float traceCone(vec3 ro, vec3 rd, float sin_alpha_half, float cos_alpha_half, float t)
+{
+    for (int i = ZERO; i < STEPS; i++)
+    {
+        float d = modelCached(ro + t*rd)/traceLipschitz();
+
+        // Note: EPSILON is needed as the iteration converges towards
+        // d = sin_alpha_half*t, which is numerically unstable.
+        if (d <= sin_alpha_half*t + EPSILON) break;
+
+        // Step to where the cone's boundary leaves the sphere of radius d.
+        // The sphere contains the segment of every ray in the cone between
+        // the current and the next t, so the rays stay free of the model.
+        t = t*cos_alpha_half + sqrt(d*d - sin_alpha_half*sin_alpha_half*t*t);
+        if (t > MAX_DISTANCE) break;
+    }
+    return t;
+}
+
 void main()
 {
-    if (iMode == 1)
+    vec3 ro = (iView * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
+    if (iMode == MODE_CONES || iMode == MODE_REFINE_CONES)
     {
+        // Block of full-resolution pixels covered by this texel
         vec2 scale = iResolution.xy/iLowResolution.xy;
-        vec2 fragCoord = gl_FragCoord.xy*scale;
-        vec2 uv = vec2(fragCoord.x, iResolution.y - fragCoord.y) - iCameraCenter;
-        vec3 rd = normalize(vec3(uv, -iCameraF));
-        vec3 ro = (iView * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
-
-        #if 0
-        // Conservative cone angle calculation
-        float a_all = 2.0*atan(0.5*iResolution.y/iCameraF);
-        float fudge_factor = 1.3;
-        float a_this = fudge_factor*a_all/(iResolution.y*iScaling);
-        float sin_alpha_half = sin(a_this/2.0);
-        float cos_alpha_half = sqrt(1.0 - sin_alpha_half*sin_alpha_half);
-        #else
-        // Exact bound cone angle calculation
-        float cos_alpha_half = dot(rd, normalize(vec3(uv + vec2(0.5, 0.5)*scale, -iCameraF)));
-        float sin_alpha_half = sqrt(1.0 - cos_alpha_half*cos_alpha_half);
-        #endif
-
+        vec2 lo = floor(gl_FragCoord.xy)*scale;
+        vec2 hi = lo + scale;
+
+        // The cone around the ray through the center must contain the rays
+        // through the corners, and thereby the rays through the block.
+        vec3 rd = cameraRay(0.5*(lo + hi));
+        float cos_alpha_half = min(min(dot(rd, cameraRay(lo)), dot(rd, cameraRay(hi))),
+                                   min(dot(rd, cameraRay(vec2(lo.x, hi.y))), dot(rd, cameraRay(vec2(hi.x, lo.y)))));
+        float sin_alpha_half = sqrt(max(1.0 - cos_alpha_half*cos_alpha_half, 0.0));
         rd = normalize((iView * vec4(rd, 0.0)).xyz);
 
-        // Initial step is shared for *all* rays
-        float t = model(ro);
-
-        int i;
-        for (i = ZERO; i < STEPS; i++)
+        // Start from the nearest of the coarser cones that overlap the block
+        float t = 0.0;
+        if (iMode == MODE_REFINE_CONES)
         {
-            vec3 p = ro + t*rd;
-            float d = min(p.y - iGroundHeight, model(p));
-            if (d <= sin_alpha_half*t + EPSILON) break;
-
-            #if 0
-            // Conservative step, results in more iterations but is cheaper to compute
-            // Note: EPSILON in the termination condition is necessary as this iteration scheme
-            // converges towards d = sin_alpha_half*t, which causes numerical instability in an
-            // exact comparison.
-            t = (t + d)/(1.0 + sin_alpha_half);
-            #else
-            // Tight step, results in fewer iterations
-            // Note: if this is used the EPSILON in the termination condition above is unecessary.
-            t = t*cos_alpha_half + sqrt(d*d - sin_alpha_half*sin_alpha_half*t*t);
-            #endif
-
-            if (t > MAX_DISTANCE) break;
+            vec2 size = vec2(textureSize(iChannel0, 0));
+            ivec2 a = ivec2(lo*size/iResolution.xy);
+            ivec2 b = min(ivec2(ceil(hi*size/iResolution.xy)) - 1, ivec2(size) - 1);
+            t = INFINITY;
+            for (int y = a.y; y <= b.y; y++)
+            for (int x = a.x; x <= b.x; x++)
+                t = min(t, texelFetch(iChannel0, ivec2(x, y), 0).r);
         }
 
-        fragColor = vec4(t);
+        fragColor = vec4(traceCone(ro, rd, sin_alpha_half, cos_alpha_half, t));
     }
     else
     {
-        vec2 uv = vec2(gl_FragCoord.x, iResolution.y - gl_FragCoord.y) + (noise2f() - vec2(0.5)) - iCameraCenter;
-        vec3 rd = normalize((iView * vec4(uv, -iCameraF, 0.0)).xyz);
-        vec3 ro = (iView * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
+        if (pixelConverged())
+            discard;
+
+        vec2 fragCoord = gl_FragCoord.xy + (sample2f() - vec2(0.5));
 
-        float t0 = texelFetch(iChannel0, ivec2(gl_FragCoord.xy*iLowResolution.xy/iResolution.xy), 0).r;
+        float t0 = 0.0;
+        if (iMode == MODE_RENDER_FROM_CONES)
+        {
+            // The ray must stay inside the cone of the pixel's block, which
+            // only encloses the rays through the block, so the jittered
+            // point is clamped to the block (and thereby to the image).
+            ivec2 size = textureSize(iChannel0, 0);
+            vec2 scale = iResolution.xy/vec2(size);
+            ivec2 texel = min(ivec2(gl_FragCoord.xy/scale), size - 1);
+            fragCoord = clamp(fragCoord, vec2(texel)*scale, vec2(texel + 1)*scale);
+            t0 = texelFetch(iChannel0, texel, 0).r;
+        }
+        vec3 rd = normalize((iView * vec4(cameraRay(fragCoord), 0.0)).xyz);
         fragColor.rgb = render(ro, rd, t0);
-        // fragColor.rgb = vec3(t0)/4.0;
         fragColor.a = 1.0;
     }
 }
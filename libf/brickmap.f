@@ -0,0 +1,50 @@
+// Developed by Simen Haugo.
+// See LICENSE.txt for copyright and licensing details (standard MIT License).
+
+// Cached distance lookup for the raymarchers, backed by a brick map baked
+// with fraktal_bake_brick_map. The bounds are divided into cells; cells far
+// from the surface store a lower bound on the distance in iBrickIndex, and
+// cells near the surface point to a brick of 9^3 distance samples in
+// iBrickAtlas. Bricks are interpolated trilinearly and the model itself is
+// evaluated close to the surface, outside the bounds, or when the map is
+// disabled (e.g. because the model parameters changed since it was baked).
+
+uniform int       iBrickMapEnabled;
+uniform sampler3D iBrickAtlas;
+uniform sampler3D iBrickIndex;
+uniform vec3      iBrickBoundsMin;
+uniform vec3      iBrickBoundsMax;
+uniform float     iBrickCellSize;
+uniform float     iBrickErrorBound;
+uniform float     iBrickExactDistance;
+
+#define BRICK_SIZE 8.0
+#define BRICK_SAMPLES 9.0
+
+float model(vec3 p); // forward-declaration
+
+float modelCached(vec3 p)
+{
+    if (iBrickMapEnabled == 0)
+        return model(p);
+    if (any(lessThan(p, iBrickBoundsMin)) || any(greaterThan(p, iBrickBoundsMax)))
+        return model(p);
+
+    vec3 u = (p - iBrickBoundsMin)/iBrickCellSize;
+    ivec3 cell = min(ivec3(u), textureSize(iBrickIndex, 0) - 1);
+    vec4 entry = texelFetch(iBrickIndex, cell, 0);
+
+    // Empty cell: the stored value is a lower bound on the distance
+    float d = entry.w;
+    if (entry.x >= 0.0)
+    {
+        // Sample between the centers of the brick's corner texels. The error
+        // bound makes the interpolated distance a lower bound as well.
+        vec3 local = clamp(u - vec3(cell), 0.0, 1.0);
+        vec3 texel = entry.xyz*BRICK_SAMPLES + 0.5 + local*BRICK_SIZE;
+        d = texture(iBrickAtlas, texel/vec3(textureSize(iBrickAtlas, 0))).x - iBrickErrorBound;
+    }
+    if (d < iBrickExactDistance)
+        return model(p);
+    return d;
+}
@@ -2,17 +2,24 @@
 // See LICENSE.txt for copyright and licensing details (standard MIT License).
 
 // This shader calculates the mean of accumulated sample images and applies
-// gamma correction to the output.
+// gamma correction to the output. With adaptive sampling, or when samples
+// were reprojected after the camera moved, pixels have different numbers of
+// samples, which are counted in the alpha channel (iAdaptive is then 1).
 
 uniform vec2      iResolution;
 uniform sampler2D iChannel0;
 uniform int       iSamples;
+uniform int       iAdaptive;
 out vec4          fragColor;
 
 void main()
 {
     vec2 uv = gl_FragCoord.xy / iResolution.xy;
-    fragColor = texture(iChannel0, uv) / float(iSamples);
+    fragColor = texture(iChannel0, uv);
+    if (iAdaptive == 1)
+        fragColor /= max(fragColor.a, 1.0);
+    else
+        fragColor /= float(iSamples);
     fragColor.rgb = sqrt(fragColor.rgb);
     fragColor.a = 1.0;
 }
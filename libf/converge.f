@@ -0,0 +1,61 @@
+// Developed by Simen Haugo.
+// See LICENSE.txt for copyright and licensing details (standard MIT License).
+
+// Passes of per-pixel adaptive sampling (see libf/sampling.f), which are
+// run by the GUI after each batch of samples is rendered to iBatch:
+//   PASS_ACCUMULATE adds the batch to the accumulated samples.
+//   PASS_MOMENTS adds the squared mean luminance of the batch, weighted by
+//     its number of samples, and counts the batch.
+//   PASS_CONVERGED marks pixels with at least iMinSamples samples whose
+//     standard error, relative to their mean luminance, is at most
+//     iTolerance. The relative error is written to the second channel.
+
+uniform sampler2D iBatch;
+uniform sampler2D iAccumulated;
+uniform sampler2D iMoments;
+uniform int       iPass;
+uniform int       iMinSamples;
+uniform float     iTolerance;
+out vec4          fragColor;
+
+#define PASS_ACCUMULATE 0
+#define PASS_MOMENTS    1
+#define PASS_CONVERGED  2
+
+float luminance(vec3 c)
+{
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+void main()
+{
+    ivec2 q = ivec2(gl_FragCoord.xy);
+    if (iPass == PASS_ACCUMULATE)
+    {
+        fragColor = texelFetch(iBatch, q, 0);
+    }
+    else if (iPass == PASS_MOMENTS)
+    {
+        vec4 batch = texelFetch(iBatch, q, 0);
+        float n = batch.a;
+        float m = n > 0.0 ? luminance(batch.rgb)/n : 0.0;
+        fragColor = vec4(n*m*m, n > 0.0 ? 1.0 : 0.0, 0.0, 0.0);
+    }
+    else
+    {
+        vec4 sum = texelFetch(iAccumulated, q, 0);
+        vec2 moments = texelFetch(iMoments, q, 0).rg;
+        float n = sum.a;
+        float batches = moments.g;
+        float mean = n > 0.0 ? luminance(sum.rgb)/n : 0.0;
+
+        // Variance of a single sample, estimated from the batch means
+        float variance = 0.0;
+        if (batches > 1.0)
+            variance = max(moments.r - n*mean*mean, 0.0)/(batches - 1.0);
+        float error = sqrt(variance/max(n, 1.0))/max(mean, 0.1);
+
+        bool converged = n >= float(iMinSamples) && batches > 1.0 && error <= iTolerance;
+        fragColor = vec4(converged ? 1.0 : 0.0, error, 0.0, 0.0);
+    }
+}
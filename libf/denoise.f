@@ -0,0 +1,72 @@
+// Developed by Simen Haugo.
+// See LICENSE.txt for copyright and licensing details (standard MIT License).
+
+// Edge-avoiding A-Trous wavelet filter (Dammertz et al., 2010), run by the
+// GUI on the accumulated samples before the compose pass:
+//   PASS_NORMALIZE divides the accumulated samples by their number.
+//   PASS_FILTER is run with fraktal_iterate, where iteration i applies a
+//     5x5 B-spline kernel with holes of 2^i pixels. Neighbours are weighted
+//     by how similar their normal, distance and color are to the pixel's,
+//     which keeps edges sharp. The color tolerance halves each iteration.
+// The guide holds the normal and the distance along the ray of the first
+// hit (see DRAW_MODE_GUIDE in libf/geometry.f); pixels without a hit are
+// left as is.
+
+uniform sampler2D iChannel0;
+uniform sampler2D iGuide;
+uniform int       iPass;
+uniform int       iSamples;
+uniform int       iAdaptive;
+uniform int       iIteration;
+uniform float     iColorPhi;
+uniform float     iNormalPhi;
+uniform float     iDepthPhi;
+out vec4          fragColor;
+
+#define PASS_NORMALIZE 0
+#define PASS_FILTER    1
+
+void main()
+{
+    ivec2 q = ivec2(gl_FragCoord.xy);
+    vec4 c = texelFetch(iChannel0, q, 0);
+    if (iPass == PASS_NORMALIZE)
+    {
+        if (iAdaptive == 1)
+            fragColor = vec4(c.rgb/max(c.a, 1.0), 1.0);
+        else
+            fragColor = vec4(c.rgb/float(iSamples), 1.0);
+        return;
+    }
+
+    vec4 g = texelFetch(iGuide, q, 0);
+    if (g.w <= 0.0)
+    {
+        fragColor = c;
+        return;
+    }
+
+    const float h[3] = float[](3.0/8.0, 1.0/4.0, 1.0/16.0);
+    int step = 1 << iIteration;
+    float colorPhi = iColorPhi/float(step);
+    ivec2 size = textureSize(iChannel0, 0);
+    vec3 sum = vec3(0.0);
+    float weights = 0.0;
+    for (int dy = -2; dy <= 2; dy++)
+    for (int dx = -2; dx <= 2; dx++)
+    {
+        ivec2 p = clamp(q + step*ivec2(dx, dy), ivec2(0), size - 1);
+        vec4 gp = texelFetch(iGuide, p, 0);
+        if (gp.w <= 0.0)
+            continue;
+        vec3 cp = texelFetch(iChannel0, p, 0).rgb;
+        vec3 dc = cp - c.rgb;
+        float wn = pow(max(dot(g.xyz, gp.xyz), 0.0), iNormalPhi);
+        float wz = exp(-abs(gp.w - g.w)/(iDepthPhi*g.w*float(step)));
+        float wc = exp(-dot(dc, dc)/(colorPhi*colorPhi + 1e-8));
+        float w = h[abs(dx)]*h[abs(dy)]*wn*wz*wc;
+        sum += w*cp;
+        weights += w;
+    }
+    fragColor = vec4(sum/max(weights, 1e-8), 1.0);
+}
@@ -12,6 +12,7 @@ uniform float     iMinThickness;
 uniform float     iMaxThickness;
 uniform sampler1D iColormap;
 uniform int       iApplyColormap;
+uniform float     iGroundHeight;
 out vec4 fragColor;
 
 #define EPSILON 0.0001
@@ -22,6 +23,7 @@ out vec4 fragColor;
 #define DRAW_MODE_DEPTH     1
 #define DRAW_MODE_THICKNESS 2
 #define DRAW_MODE_GBUFFER   3
+#define DRAW_MODE_GUIDE     4 // normal and distance (0 if no hit) of the model or ground, for the denoiser and reprojection
 
 vec3 rayPinhole(vec2 fragOffset)
 {
@@ -31,6 +33,8 @@ vec3 rayPinhole(vec2 fragOffset)
 }
 
 float model(vec3 p); // forward-declaration
+float tracePixelAngle(); // see libf/trace.f
+float sphereTrace(vec3 ro, vec3 rd, float t, float tmax, float epsilon, float pixelAngle);
 
 // Adapted from Inigo Quilez
 // Source: http://iquilezles.org/www/articles/normalsSDF/normalsSDF.htm
@@ -69,16 +73,7 @@ float calcThickness(vec3 ro, vec3 rd)
 
 float traceModel(vec3 ro, vec3 rd)
 {
-    float t = 0.0;
-    for (int i = ZERO; i < STEPS; i++)
-    {
-        vec3 p = ro + t*rd;
-        float d = model(p);
-        if (d <= EPSILON) return t;
-        t += d;
-        if (t > MAX_DISTANCE) break;
-    }
-    return -1.0;
+    return sphereTrace(ro, rd, 0.0, MAX_DISTANCE, EPSILON, tracePixelAngle());
 }
 
 void main()
@@ -90,11 +85,22 @@ void main()
     fragColor = vec4(0.0);
 
     float t = traceModel(ro, rd);
+    if (iDrawMode == DRAW_MODE_GUIDE)
+    {
+        float tGround = rd.y < 0.0 ? (iGroundHeight - ro.y)/rd.y : -1.0;
+        if (tGround > 0.0 && (t < 0.0 || tGround < t))
+            fragColor = vec4(0.0, 1.0, 0.0, tGround);
+        else if (t > 0.0)
+            fragColor = vec4(normal(ro + t*rd), t);
+        return;
+    }
     if (t > 0.0)
     {
         vec3 p = ro + t*rd;
         vec3 n = normal(p);
-        float thickness = calcThickness(p, rd);
+        float thickness = 0.0;
+        if (iDrawMode == DRAW_MODE_THICKNESS || iDrawMode == DRAW_MODE_GBUFFER)
+            thickness = calcThickness(p, rd);
 
         float t_normalized = (t - iMinDistance) / (iMaxDistance - iMinDistance);
         float thickness_normalized = (thickness - iMinThickness) / (iMaxThickness - iMinThickness);
@@ -0,0 +1,24 @@
+// Developed by Simen Haugo.
+// See LICENSE.txt for copyright and licensing details (standard MIT License).
+
+// Samples the model on a regular grid of iGridSize^3 points, starting at
+// iGridOrigin with spacing iGridSpacing. The z-slices of the grid are laid
+// out as tiles in the output array, iTilesX tiles per row, and each texel
+// holds the signed distance at its grid point. Used by fraktal_extract_mesh.
+
+uniform vec3  iGridOrigin;
+uniform float iGridSpacing;
+uniform int   iGridSize;
+uniform int   iTilesX;
+out vec4      fragColor;
+
+float model(vec3 p); // forward-declaration
+
+void main()
+{
+    ivec2 q = ivec2(gl_FragCoord.xy);
+    ivec2 tile = q / iGridSize;
+    ivec3 i = ivec3(q - tile*iGridSize, tile.y*iTilesX + tile.x);
+    vec3 p = iGridOrigin + iGridSpacing*vec3(i);
+    fragColor = vec4(model(p), 0.0, 0.0, 0.0);
+}
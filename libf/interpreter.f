@@ -0,0 +1,141 @@
+// Developed by Simen Haugo.
+// See LICENSE.txt for copyright and licensing details (standard MIT License).
+
+// This model evaluates a distance field encoded as a stream of instructions
+// in the array iProgram (see §10 Interpreter in fraktal.h). Like other models,
+// it expects hg_sdf.f to be prepended to its source. Swapping models is done
+// by uploading a new program with fraktal_upload_program; no recompilation
+// is needed.
+//
+// Each instruction is three texels:
+//     (op, dst, a, b) (arg0, arg1, arg2, arg3) (arg4, arg5, arg6, arg7)
+// Point operations read and write point registers P[], primitives read a
+// point register and write a distance register R[], and distance operations
+// read and write distance registers. P[0] holds the input point and R[0]
+// holds the result.
+
+uniform sampler1D iProgram;
+
+// Must match fOpcode in fraktal.h
+#define OP_END                   0
+#define OP_TRANSLATE             1
+#define OP_ROTATE                2
+#define OP_SCALE                 3
+#define OP_MIRROR                4
+#define OP_MOD_INTERVAL          5
+#define OP_MOD_POLAR             6
+#define OP_SPHERE                16
+#define OP_BOX                   17
+#define OP_CYLINDER              18
+#define OP_CAPSULE               19
+#define OP_TORUS                 20
+#define OP_PLANE                 21
+#define OP_CONE                  22
+#define OP_HEXAGON               23
+#define OP_UNION                 32
+#define OP_INTERSECTION          33
+#define OP_DIFFERENCE            34
+#define OP_UNION_ROUND           35
+#define OP_INTERSECTION_ROUND    36
+#define OP_DIFFERENCE_ROUND      37
+#define OP_UNION_CHAMFER         38
+#define OP_INTERSECTION_CHAMFER  39
+#define OP_DIFFERENCE_CHAMFER    40
+#define OP_UNION_SOFT            41
+#define OP_OFFSET                42
+#define OP_DIST_SCALE            43
+
+#define NUM_POINT_REGISTERS    8
+#define NUM_DISTANCE_REGISTERS 16
+
+// Rotates p by the inverse of the unit quaternion q
+vec3 interpreterRotate(vec3 p, vec4 q)
+{
+    vec3 t = 2.0*cross(-q.xyz, p);
+    return p + q.w*t + cross(-q.xyz, t);
+}
+
+float interpreterMod(inout float p, float size, float start, float stop)
+{
+    if (size <= 0.0) return 0.0;
+    if (start > stop) return pMod1(p, size);
+    return pModInterval1(p, size, start, stop);
+}
+
+float model(vec3 p)
+{
+    vec3 P[NUM_POINT_REGISTERS];
+    float R[NUM_DISTANCE_REGISTERS];
+    P[0] = p;
+    R[0] = 1e10;
+
+    int n = textureSize(iProgram, 0)/3;
+    for (int i = ZERO; i < n; i++)
+    {
+        vec4 h = texelFetch(iProgram, 3*i, 0);
+        int op = int(h.x);
+        if (op == OP_END)
+            break;
+        vec4 u = texelFetch(iProgram, 3*i + 1, 0);
+        vec4 v = texelFetch(iProgram, 3*i + 2, 0);
+        int dst = int(h.y);
+        int a = int(h.z);
+        int b = int(h.w);
+
+        if (op < OP_SPHERE)
+        {
+            vec3 q = P[a];
+            if      (op == OP_TRANSLATE) q -= u.xyz;
+            else if (op == OP_ROTATE)    q = interpreterRotate(q, u);
+            else if (op == OP_SCALE)     q /= u.x;
+            else if (op == OP_MIRROR)    q = mix(q, abs(q), u.xyz);
+            else if (op == OP_MOD_INTERVAL)
+            {
+                interpreterMod(q.x, u.x, u.w, v.x);
+                interpreterMod(q.y, u.y, u.w, v.x);
+                interpreterMod(q.z, u.z, u.w, v.x);
+            }
+            else if (op == OP_MOD_POLAR)
+            {
+                vec2 xz = q.xz;
+                pModPolar(xz, u.x);
+                q.xz = xz;
+            }
+            P[dst] = q;
+        }
+        else if (op < OP_UNION)
+        {
+            vec3 q = P[a];
+            float d = 1e10;
+            if      (op == OP_SPHERE)   d = fSphere(q, u.x);
+            else if (op == OP_BOX)      d = fBox(q, u.xyz);
+            else if (op == OP_CYLINDER) d = fCylinder(q, u.x, u.y);
+            else if (op == OP_CAPSULE)  d = fCapsule(q, u.x, u.y);
+            else if (op == OP_TORUS)    d = fTorus(q, u.x, u.y);
+            else if (op == OP_PLANE)    d = fPlane(q, u.xyz, u.w);
+            else if (op == OP_CONE)     d = fCone(q, u.x, u.y);
+            else if (op == OP_HEXAGON)  d = fHexagonCircumcircle(q, u.xy);
+            R[dst] = d;
+        }
+        else
+        {
+            float da = R[a];
+            float db = R[b];
+            float d = da;
+            if      (op == OP_UNION)                d = min(da, db);
+            else if (op == OP_INTERSECTION)         d = max(da, db);
+            else if (op == OP_DIFFERENCE)           d = max(da, -db);
+            else if (op == OP_UNION_ROUND)          d = fOpUnionRound(da, db, u.x);
+            else if (op == OP_INTERSECTION_ROUND)   d = fOpIntersectionRound(da, db, u.x);
+            else if (op == OP_DIFFERENCE_ROUND)     d = fOpDifferenceRound(da, db, u.x);
+            else if (op == OP_UNION_CHAMFER)        d = fOpUnionChamfer(da, db, u.x);
+            else if (op == OP_INTERSECTION_CHAMFER) d = fOpIntersectionChamfer(da, db, u.x);
+            else if (op == OP_DIFFERENCE_CHAMFER)   d = fOpDifferenceChamfer(da, db, u.x);
+            else if (op == OP_UNION_SOFT)           d = fOpUnionSoft(da, db, u.x);
+            else if (op == OP_OFFSET)               d = da - u.x;
+            else if (op == OP_DIST_SCALE)           d = da*u.x;
+            R[dst] = d;
+        }
+    }
+    return R[0];
+}
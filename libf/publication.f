@@ -23,28 +23,46 @@ uniform int       iGroundReflective;
 uniform float     iGroundHeight;
 uniform float     iGroundSpecularExponent;
 uniform float     iGroundReflectivity;
+uniform int       iHitPass;
+uniform sampler2D iPrimaryHits;
+uniform int       iPrimaryStrata;
+uniform int       iPrimaryReuse;
 out vec4          fragColor;
 
 #define EPSILON 0.0007
-#define STEPS 512
 #define M_PI 3.1415926535897932384626433832795
 #define MAX_DISTANCE 100.0
 #define MAX_DISTANCE_VISIBILITY_TEST 10.0
 
-float model(vec3 p); // forward declaration
+// The first hits of primary rays only depend on the camera and the model, so
+// they can be traced once, for a grid of iPrimaryStrata^2 sub-pixel strata
+// per pixel, and shared by several samples. With HIT_PASS_CACHE, the kernel
+// is run on an array with one texel per stratum, and writes the first hits
+// (see tracePrimary). With HIT_PASS_SHADE, each sample takes the next
+// stratum's hit from iPrimaryHits, and only traces the secondary rays.
+//
+// Each stratum is used by iPrimaryReuse samples, after which the cache is
+// filled again. Every fill jitters the rays randomly within their strata,
+// so the samples are stratified over the pixel filter like the random
+// offsets, and the image converges to the same result.
+#define HIT_PASS_NONE  0
+#define HIT_PASS_CACHE 1
+#define HIT_PASS_SHADE 2
 
-// Adapted from: lumina.sourceforge.net/Tutorials/Noise.html
-vec2 seed = vec2(-1,1)*(iSamples*(1.0/12.0) + 1.0);
-vec2 noise2f()
-{
-    seed += vec2(-1, 1);
-    return vec2(fract(sin(dot(seed.xy, vec2(12.9898, 78.233))) * 43758.5453),
-                fract(cos(dot(seed.xy, vec2(4.898, 7.23))) * 23421.631));
-}
+float model(vec3 p); // forward declaration
+float modelCached(vec3 p); // see libf/brickmap.f
+float tracePixelAngle(); // see libf/trace.f
+float sphereTrace(vec3 ro, vec3 rd, float t, float tmax, float epsilon, float pixelAngle);
+bool pixelConverged(); // see libf/sampling.f
+vec2 sample2f();
+uint hashUint(uint x);
+uint hashCombine(uint seed, uint x);
+float uintToUnit(uint x);
+void sampleBounce(int bounce);
 
-vec3 rayPinhole(vec2 fragOffset)
+vec3 rayPinhole(vec2 fragCoord, vec2 fragOffset)
 {
-    vec2 uv = vec2(gl_FragCoord.x, iResolution.y - gl_FragCoord.y) + fragOffset - iCameraCenter;
+    vec2 uv = vec2(fragCoord.x, iResolution.y - fragCoord.y) + fragOffset - iCameraCenter;
     float d = 1.0/length(vec3(uv, iCameraF));
     return vec3(uv*d, -iCameraF*d);
 }
@@ -68,18 +86,9 @@ float traceGround(vec3 ro, vec3 rd)
     else return (iGroundHeight - ro.y)/rd.y;
 }
 
-float traceModel(vec3 ro, vec3 rd)
+float traceModel(vec3 ro, vec3 rd, float pixelAngle)
 {
-    float t = 0.0;
-    for (int i = ZERO; i < STEPS; i++)
-    {
-        vec3 p = ro + t*rd;
-        float d = model(p);
-        if (d <= EPSILON) return t;
-        t += d;
-        if (t > MAX_DISTANCE) break;
-    }
-    return -1.0;
+    return sphereTrace(ro, rd, 0.0, MAX_DISTANCE, EPSILON, pixelAngle);
 }
 
 bool isVisible(vec3 ro, vec3 rd)
@@ -87,22 +96,12 @@ bool isVisible(vec3 ro, vec3 rd)
     float tGround = traceGround(ro, rd);
     if (tGround > EPSILON)
         return false;
-    float t = 0.0;
-    for (int i = ZERO; i < STEPS; i++)
-    {
-        float d = model(ro + t*rd);
-        t += d;
-        if (d <= EPSILON)
-            return false;
-        if (t > MAX_DISTANCE_VISIBILITY_TEST)
-            break;
-    }
-    return true;
+    return sphereTrace(ro, rd, 0.0, MAX_DISTANCE_VISIBILITY_TEST, EPSILON, 0.0) < 0.0;
 }
 
 vec3 cosineWeightedSample(vec3 normal)
 {
-    vec2 u = noise2f();
+    vec2 u = sample2f();
     float a = 0.99*(1.0 - 2.0*u[0]);
     float b = 0.99*(sqrt(1.0 - a*a));
     float phi = 6.2831853072*u[1];
@@ -120,7 +119,7 @@ vec3 phongWeightedSample(vec3 dir, float exponent)
         tangent = vec3(0.0, 1.0, 0.0);
     vec3 bitangent = cross(tangent, dir);
     tangent = cross(dir, bitangent);
-    vec2 u = noise2f();
+    vec2 u = sample2f();
     float cosAlpha = pow(u[0], 1.0/(exponent + 1.0));
     float sinAlpha = sqrt(1.0 - cosAlpha*cosAlpha);
     float phi = 2.0*M_PI*u[1];
@@ -130,9 +129,9 @@ vec3 phongWeightedSample(vec3 dir, float exponent)
     return x*tangent + y*dir + z*bitangent;
 }
 
-vec3 colorModel(vec3 p, vec3 ro)
+vec3 colorModel(vec3 p, vec3 n, vec3 ro, int bounce)
 {
-    vec3 n = normal(p);
+    sampleBounce(bounce);
     vec3 v = normalize(p - ro); // from eye to point
     ro = p + n*2.0*EPSILON;
 
@@ -168,8 +167,9 @@ vec3 colorIsolines(vec3 p)
     return mix(vec3(1.0), iIsolineColor, t);
 }
 
-vec3 colorGround(vec3 p, vec3 ro)
+vec3 colorGround(vec3 p, vec3 ro, int bounce)
 {
+    sampleBounce(bounce);
     vec3 albedo = vec3(1.0);
     if (iDrawIsolines==1)
         albedo = colorIsolines(p);
@@ -192,26 +192,83 @@ vec3 colorGround(vec3 p, vec3 ro)
     {
         vec3 w_s = v - 2.0*dot(n, v)*n;
         rd = phongWeightedSample(w_s, iGroundSpecularExponent);
-        float tModel = traceModel(ro, rd);
+        float tModel = traceModel(ro, rd, 0.0);
         if (tModel > 0.0)
-            result = mix(result, colorModel(ro + tModel*rd, ro), iGroundReflectivity);
+        {
+            vec3 pModel = ro + tModel*rd;
+            result = mix(result, colorModel(pModel, normal(pModel), ro, bounce + 1), iGroundReflectivity);
+        }
     }
 
     return result*albedo;
 }
 
-void main()
+// Returns the normal and distance of the first hit on the model, zero and
+// the distance of the first hit on the ground, or zero if there is no hit.
+vec4 tracePrimary(vec3 ro, vec3 rd)
 {
-    vec3 rd = rayPinhole(2.0*(noise2f() - vec2(0.5)));
-    vec3 ro = (iView * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
-    rd = normalize((iView * vec4(rd, 0.0)).xyz);
-
-    fragColor.rgb = vec3(1.0);
-    float tModel = traceModel(ro, rd);
+    float tModel = traceModel(ro, rd, tracePixelAngle());
     float tGround = traceGround(ro, rd);
     if (tGround > 0.0 && ((tModel > 0.0 && tGround < tModel) || tModel < 0.0))
-        fragColor.rgb = colorGround(ro + rd*tGround, ro);
+        return vec4(0.0, 0.0, 0.0, tGround);
     else if (tModel > 0.0 && ((tGround > 0.0 && tModel < tGround) || tGround < 0.0))
-        fragColor.rgb = colorModel(ro + rd*tModel, ro);
+        return vec4(normal(ro + rd*tModel), tModel);
+    return vec4(0.0);
+}
+
+vec3 colorPrimary(vec3 ro, vec3 rd, vec4 hit)
+{
+    if (hit.w <= 0.0)
+        return vec3(1.0);
+    if (hit.xyz == vec3(0.0))
+        return colorGround(ro + rd*hit.w, ro, 0);
+    return colorModel(ro + rd*hit.w, hit.xyz, ro, 0);
+}
+
+// Offset from the center of a pixel of the ray through a stratum in the
+// given fill of the cache. Like the random offsets, the strata cover two
+// pixels along each side.
+vec2 stratumOffset(ivec2 pixel, ivec2 stratum, int fill)
+{
+    uint seed = hashCombine(hashUint(uint(pixel.x)), uint(pixel.y));
+    seed = hashCombine(seed, uint(stratum.x + stratum.y*iPrimaryStrata));
+    seed = hashCombine(seed, uint(fill));
+    vec2 jitter = vec2(uintToUnit(hashUint(seed)), uintToUnit(hashUint(seed + 1u)));
+    return 2.0*((vec2(stratum) + jitter)/float(iPrimaryStrata) - vec2(0.5));
+}
+
+void main()
+{
+    vec3 ro = (iView * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
+    int strata = iPrimaryStrata*iPrimaryStrata;
+    if (iHitPass == HIT_PASS_CACHE)
+    {
+        ivec2 q = ivec2(gl_FragCoord.xy);
+        ivec2 pixel = q/iPrimaryStrata;
+        int fill = iSamples/(strata*iPrimaryReuse);
+        vec3 rd = rayPinhole(vec2(pixel) + vec2(0.5), stratumOffset(pixel, q % iPrimaryStrata, fill));
+        rd = normalize((iView * vec4(rd, 0.0)).xyz);
+        fragColor = tracePrimary(ro, rd);
+        return;
+    }
+
+    if (pixelConverged())
+        discard;
+
     fragColor.a = 1.0;
+    if (iHitPass == HIT_PASS_SHADE)
+    {
+        int index = iSamples + iSampleIndex;
+        int fill = index/(strata*iPrimaryReuse);
+        ivec2 stratum = ivec2(index % iPrimaryStrata, (index % strata) / iPrimaryStrata);
+        vec3 rd = rayPinhole(gl_FragCoord.xy, stratumOffset(ivec2(gl_FragCoord.xy), stratum, fill));
+        rd = normalize((iView * vec4(rd, 0.0)).xyz);
+        vec4 hit = texelFetch(iPrimaryHits, ivec2(gl_FragCoord.xy)*iPrimaryStrata + stratum, 0);
+        fragColor.rgb = colorPrimary(ro, rd, hit);
+        return;
+    }
+
+    vec3 rd = rayPinhole(gl_FragCoord.xy, 2.0*(sample2f() - vec2(0.5)));
+    rd = normalize((iView * vec4(rd, 0.0)).xyz);
+    fragColor.rgb = colorPrimary(ro, rd, tracePrimary(ro, rd));
 }
@@ -0,0 +1,75 @@
+// Developed by Simen Haugo.
+// See LICENSE.txt for copyright and licensing details (standard MIT License).
+
+// Reprojects accumulated samples into the view of a camera that moved, run
+// by the GUI instead of starting over when only the camera changed. Each
+// pixel's first hit in the new view (see DRAW_MODE_GUIDE in libf/geometry.f)
+// is projected into the previous view, and the samples of the pixel it
+// lands on are kept if the previous guide saw the same surface there, i.e.
+// at about the same distance and with about the same normal. Disoccluded
+// pixels, and pixels that were outside the previous view, start over.
+// Pixels without a hit see the background, which is reprojected by
+// direction, and are kept if they also saw the background before.
+//
+// The samples are taken from the nearest pixel, which is slightly off, so
+// kept pixels are limited to iMaxHistory samples for the error to fade out
+// as new samples are added.
+
+uniform sampler2D iChannel0;    // Array to reproject
+uniform sampler2D iAccumulated; // Accumulated samples, counted in alpha
+uniform sampler2D iGuide;
+uniform sampler2D iPreviousGuide;
+uniform vec2      iResolution;
+uniform vec2      iCameraCenter;
+uniform float     iCameraF;
+uniform mat4      iView;
+uniform vec2      iPreviousCameraCenter;
+uniform float     iPreviousCameraF;
+uniform mat4      iPreviousInverseView;
+uniform float     iMaxHistory;
+uniform float     iDepthTolerance; // relative to the distance
+out vec4          fragColor;
+
+#define NORMAL_TOLERANCE 0.9 // minimum cosine between normals
+
+void main()
+{
+    fragColor = vec4(0.0);
+
+    vec2 uv = vec2(gl_FragCoord.x, iResolution.y - gl_FragCoord.y) - iCameraCenter;
+    vec3 ro = (iView * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
+    vec3 rd = normalize((iView * vec4(uv, -iCameraF, 0.0)).xyz);
+    vec4 g = texelFetch(iGuide, ivec2(gl_FragCoord.xy), 0);
+
+    // First hit (or direction of the background) in the previous view
+    vec3 q;
+    if (g.w > 0.0)
+        q = (iPreviousInverseView * vec4(ro + g.w*rd, 1.0)).xyz;
+    else
+        q = (iPreviousInverseView * vec4(rd, 0.0)).xyz;
+    if (q.z >= 0.0)
+        return;
+    vec2 uvPrevious = -iPreviousCameraF*q.xy/q.z + iPreviousCameraCenter;
+    ivec2 p = ivec2(floor(vec2(uvPrevious.x, iResolution.y - uvPrevious.y)));
+    if (any(lessThan(p, ivec2(0))) || any(greaterThanEqual(p, ivec2(iResolution))))
+        return;
+
+    vec4 h = texelFetch(iPreviousGuide, p, 0);
+    if (g.w > 0.0)
+    {
+        if (h.w <= 0.0)
+            return;
+        if (abs(h.w - length(q)) > iDepthTolerance*h.w)
+            return;
+        if (dot(g.xyz, h.xyz) < NORMAL_TOLERANCE)
+            return;
+    }
+    else if (h.w > 0.0)
+    {
+        return;
+    }
+
+    float n = texelFetch(iAccumulated, p, 0).a;
+    float weight = n > iMaxHistory ? iMaxHistory/n : 1.0;
+    fragColor = weight*texelFetch(iChannel0, p, 0);
+}
@@ -0,0 +1,132 @@
+// Developed by Simen Haugo.
+// See LICENSE.txt for copyright and licensing details (standard MIT License).
+
+// Per-pixel adaptive sampling. The GUI marks the pixels whose estimate has
+// converged in iConverged (see libf/converge.f), and renderers skip them
+// by discarding the fragment when pixelConverged() is true. Skipped
+// pixels add nothing to the accumulated samples, whose alpha channel then
+// counts the samples of each pixel (every sample must have alpha 1).
+
+uniform int       iAdaptive;
+uniform sampler2D iConverged;
+
+bool pixelConverged()
+{
+    return iAdaptive == 1 && texelFetch(iConverged, ivec2(gl_FragCoord.xy), 0).r > 0.5;
+}
+
+// Low-discrepancy sampling. Renderers draw random numbers in pairs with
+// sample2f, each call using the next pair of dimensions of the sequence
+// selected by iSampler. Paths that draw a varying number of pairs should
+// call sampleBounce at each bounce, so that each bounce starts at fixed
+// dimensions for every sample of a pixel. The sequences are decorrelated
+// between pixels by a per-pixel seed.
+//   SAMPLER_SOBOL: Owen-scrambled and shuffled Sobol points (Burley,
+//     Practical Hash-based Owen Scrambling, 2020). Default.
+//   SAMPLER_R2: the R2 sequence (Roberts, 2018) with a per-pixel random
+//     offset (Cranley-Patterson rotation).
+//   SAMPLER_BLUE_NOISE: the tileable blue noise in iBlueNoise, offset per
+//     dimension, and advanced per sample by the R2 sequence, so that the
+//     error is spread as high-frequency noise between pixels.
+
+uniform int       iSampler;
+uniform sampler2D iBlueNoise;
+uniform int       iSamples;
+
+#define SAMPLER_SOBOL      0
+#define SAMPLER_R2         1
+#define SAMPLER_BLUE_NOISE 2
+#define SAMPLER_DIMENSIONS_PER_BOUNCE 8 // pairs
+#define R2_ALPHA vec2(0.75487766624669276, 0.56984029099805327)
+
+int samplerDimension = 0;
+
+uint hashUint(uint x)
+{
+    // https://nullprogram.com/blog/2018/07/31/
+    x ^= x >> 16; x *= 0x7feb352du;
+    x ^= x >> 15; x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint hashCombine(uint seed, uint x)
+{
+    return hashUint(seed ^ (x + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+uint reverseBits(uint x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+uint nestedUniformScramble(uint x, uint seed)
+{
+    // Laine-Karras permutation of the reversed bits
+    x = reverseBits(x);
+    x += seed;
+    x ^= x*0x6c50b47cu;
+    x ^= x*0xb82f1e52u;
+    x ^= x*0xc7afe638u;
+    x ^= x*0x8d22f6e6u;
+    return reverseBits(x);
+}
+
+// Second dimension of the Sobol sequence (the first is reverseBits)
+uint sobol1(uint index)
+{
+    uint result = 0u;
+    uint v = 1u << 31;
+    for (; index != 0u; index >>= 1)
+    {
+        if ((index & 1u) != 0u)
+            result ^= v;
+        v ^= v >> 1;
+    }
+    return result;
+}
+
+float uintToUnit(uint x)
+{
+    return float(x >> 8)*(1.0/16777216.0);
+}
+
+void sampleBounce(int bounce)
+{
+    samplerDimension = 1 + bounce*SAMPLER_DIMENSIONS_PER_BOUNCE;
+}
+
+vec2 sample2f()
+{
+    uint index = uint(iSamples + iSampleIndex);
+    uint pixel = hashCombine(hashUint(uint(gl_FragCoord.x)), uint(gl_FragCoord.y));
+    uint seed = hashCombine(pixel, uint(samplerDimension));
+    int dimension = samplerDimension++;
+
+    if (iSampler == SAMPLER_R2)
+    {
+        vec2 offset = vec2(uintToUnit(hashUint(seed)), uintToUnit(hashUint(seed + 1u)));
+        return fract(offset + float(index)*R2_ALPHA);
+    }
+    else if (iSampler == SAMPLER_BLUE_NOISE)
+    {
+        // Shift the texture by the R2 sequence over the dimensions
+        ivec2 size = textureSize(iBlueNoise, 0);
+        vec2 shift = fract(float(dimension)*R2_ALPHA);
+        ivec2 p = ivec2(gl_FragCoord.xy) + ivec2(shift*vec2(size));
+        float x = texelFetch(iBlueNoise, p % size, 0).r;
+        float y = texelFetch(iBlueNoise, (p + size/2) % size, 0).r;
+        return fract(vec2(x, y) + float(index)*R2_ALPHA);
+    }
+    else
+    {
+        index = nestedUniformScramble(index, seed);
+        uint x = nestedUniformScramble(reverseBits(index), hashUint(seed));
+        uint y = nestedUniformScramble(sobol1(index), hashUint(seed + 1u));
+        return vec2(uintToUnit(x), uintToUnit(y));
+    }
+}
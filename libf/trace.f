@@ -0,0 +1,87 @@
+// Developed by Simen Haugo.
+// See LICENSE.txt for copyright and licensing details (standard MIT License).
+
+// Sphere tracing shared by the renderers. Steps are lengthened by an
+// over-relaxation factor (Keinert et al., Enhanced Sphere Tracing, 2014),
+// and if the spheres of two consecutive steps do not overlap, the last step
+// may have skipped past the surface, so it is undone and tracing continues
+// without relaxation. Primary rays stop when the distance is within the
+// footprint of a pixel, which grows along the ray, so that far and grazing
+// rays do not spend all their steps on detail smaller than a pixel.
+//
+// The parameters are set per model by the Tracing widget in the GUI. A
+// value of zero (i.e. the parameter is not set) selects the default, which
+// traces without relaxation and stops only within epsilon of the surface,
+// as the renderers did before.
+//
+// If iBoundsEnabled is 1, rays are clipped to the box [iBoundsMin,
+// iBoundsMax], which must contain the model (see fraktal_estimate_bounds):
+// rays that miss it are not traced, and rays stop once they leave it.
+
+uniform int   iTraceSteps;      // Maximum number of steps (default 512)
+uniform float iTraceLipschitz;  // Lipschitz bound of the model (default 1)
+uniform float iTraceRelaxation; // Over-relaxation factor in [1,2) (default 1)
+uniform float iTraceFootprint;  // Hit tolerance in pixels (default 0)
+uniform float iCameraF;
+uniform int   iBoundsEnabled;
+uniform vec3  iBoundsMin;
+uniform vec3  iBoundsMax;
+
+#define TRACE_DEFAULT_STEPS 512
+#define TRACE_DEFAULT_RELAXATION 1.0
+
+float modelCached(vec3 p); // see libf/brickmap.f
+
+float traceLipschitz()
+{
+    return iTraceLipschitz > 0.0 ? iTraceLipschitz : 1.0;
+}
+
+// Radius of a pixel's footprint per unit distance along a primary ray
+float tracePixelAngle()
+{
+    return 0.5*max(iTraceFootprint, 0.0)/iCameraF;
+}
+
+// Returns the distance to the first point along the ray, beginning at t,
+// where the model is within max(epsilon, pixelAngle*t), or -1 if there is
+// no such point before tmax. Secondary rays should use pixelAngle = 0.
+float sphereTrace(vec3 ro, vec3 rd, float t, float tmax, float epsilon, float pixelAngle)
+{
+    if (iBoundsEnabled == 1)
+    {
+        vec3 t0 = (iBoundsMin - ro)/rd;
+        vec3 t1 = (iBoundsMax - ro)/rd;
+        vec3 tNear = min(t0, t1);
+        vec3 tFar = max(t0, t1);
+        t = max(t, max(max(tNear.x, tNear.y), tNear.z));
+        tmax = min(tmax, min(min(tFar.x, tFar.y), tFar.z));
+        if (t > tmax)
+            return -1.0;
+    }
+
+    int steps = iTraceSteps > 0 ? iTraceSteps : TRACE_DEFAULT_STEPS;
+    float lipschitz = traceLipschitz();
+    float omega = iTraceRelaxation > 0.0 ? clamp(iTraceRelaxation, 1.0, 1.99) : TRACE_DEFAULT_RELAXATION;
+    float previousRadius = 0.0;
+    float stepLength = 0.0;
+    for (int i = ZERO; i < steps; i++)
+    {
+        float d = modelCached(ro + t*rd)/lipschitz;
+        if (omega > 1.0 && d + previousRadius < stepLength)
+        {
+            t += previousRadius - stepLength;
+            stepLength = previousRadius;
+            omega = 1.0;
+            continue;
+        }
+        if (d <= max(epsilon, pixelAngle*t))
+            return t;
+        if (t + d > tmax)
+            break;
+        previousRadius = d;
+        stepLength = omega*d;
+        t += stepLength;
+    }
+    return -1.0;
+}
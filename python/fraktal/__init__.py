@@ -50,6 +50,12 @@ CLAMP_TO_EDGE = 4
 REPEAT        = 5
 LINEAR        = 6
 NEAREST       = 7
+REDUCE_MAX    = 8
+REDUCE_SUM    = 9
+BOX           = 10
+GAUSSIAN      = 11
+PLY           = 12
+OBJ           = 13
 
 class FraktalError(Exception):
     def __init__(self, message):
@@ -102,6 +108,36 @@ def to_cpu(array):
     else:
         raise
 
+_fraktal.fraktal_copy_array.restype = None
+_fraktal.fraktal_copy_array.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.POINTER(ctypes.c_int), ctypes.POINTER(ctypes.c_int), ctypes.c_char_p]
+def copy_array(dst, src, src_rect=None, dst_xy=None, swizzle=None):
+    if src_rect is not None:
+        src_rect = (ctypes.c_int * 4)(*src_rect)
+    if dst_xy is not None:
+        dst_xy = (ctypes.c_int * 2)(*dst_xy)
+    if swizzle is not None:
+        swizzle = _to_char_p(swizzle)
+    _fraktal.fraktal_copy_array(dst, src, src_rect, dst_xy, swizzle)
+
+_fraktal.fraktal_reduce.restype = None
+_fraktal.fraktal_reduce.argtypes = [ctypes.POINTER(ctypes.c_float), ctypes.c_void_p, ctypes.c_int]
+def reduce(array, op):
+    result = (ctypes.c_float * 4)()
+    _fraktal.fraktal_reduce(result, array, op)
+    return [float(i) for i in result[:array_channels(array)]]
+
+_fraktal.fraktal_build_pyramid.restype = ctypes.c_int
+_fraktal.fraktal_build_pyramid.argtypes = [ctypes.POINTER(ctypes.c_void_p), ctypes.c_int, ctypes.c_void_p, ctypes.c_int]
+def build_pyramid(array, num_levels, filter=GAUSSIAN):
+    levels = (ctypes.c_void_p * num_levels)()
+    count = _fraktal.fraktal_build_pyramid(levels, num_levels, array, filter)
+    return [levels[i] for i in range(count)]
+
+_fraktal.fraktal_generate_mipmaps.restype = None
+_fraktal.fraktal_generate_mipmaps.argtypes = [ctypes.c_void_p]
+def generate_mipmaps(array):
+    _fraktal.fraktal_generate_mipmaps(array)
+
 _fraktal.fraktal_array_size.restype = None
 _fraktal.fraktal_array_size.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_int), ctypes.POINTER(ctypes.c_int)]
 def array_size(array):
@@ -112,6 +148,16 @@ def array_size(array):
     _fraktal.fraktal_array_size(array, pwidth, pheight)
     return width.value, height.value
 
+_fraktal.fraktal_array_bytes.restype = ctypes.c_size_t
+_fraktal.fraktal_array_bytes.argtypes = [ctypes.c_void_p]
+def array_bytes(array):
+    return _fraktal.fraktal_array_bytes(array)
+
+_fraktal.fraktal_array_levels.restype = ctypes.c_int
+_fraktal.fraktal_array_levels.argtypes = [ctypes.c_void_p]
+def array_levels(array):
+    return _fraktal.fraktal_array_levels(array)
+
 _fraktal.fraktal_array_channels.restype = ctypes.c_int
 _fraktal.fraktal_array_channels.argtypes = [ctypes.c_void_p]
 def array_format(array):
@@ -166,6 +212,23 @@ _fraktal.fraktal_run_kernel.argtypes = [ctypes.c_void_p]
 def run_kernel(array):
     _fraktal.fraktal_run_kernel(array)
 
+_fraktal.fraktal_run_kernel_n.restype = None
+_fraktal.fraktal_run_kernel_n.argtypes = [ctypes.c_void_p, ctypes.c_int]
+def run_kernel_n(array, n):
+    _fraktal.fraktal_run_kernel_n(array, n)
+
+_fraktal.fraktal_iterate.restype = ctypes.c_void_p
+_fraktal.fraktal_iterate.argtypes = [ctypes.c_int, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_int]
+def iterate(offset, a, b, n):
+    return _fraktal.fraktal_iterate(offset, a, b, n)
+
+_fraktal.fraktal_iterate_until.restype = ctypes.c_void_p
+_fraktal.fraktal_iterate_until.argtypes = [ctypes.c_int, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_float, ctypes.POINTER(ctypes.c_int)]
+def iterate_until(offset, a, b, max_steps, check_every, tolerance):
+    steps = ctypes.c_int()
+    result = _fraktal.fraktal_iterate_until(offset, a, b, max_steps, check_every, tolerance, ctypes.byref(steps))
+    return result, steps.value
+
 ############################################################
 # §4 Parameters
 ############################################################
@@ -259,3 +322,402 @@ _fraktal.fraktal_pop_current_context.restype = None
 _fraktal.fraktal_pop_current_context.argtypes = []
 def pop_current_context():
     _fraktal.fraktal_pop_current_context()
+
+############################################################
+# §6 Command lists
+############################################################
+
+class CommandPatch(ctypes.Structure):
+    _fields_ = [('kernel', ctypes.c_void_p),
+                ('offset', ctypes.c_int),
+                ('f', ctypes.c_float*16),
+                ('i', ctypes.c_int*4),
+                ('array', ctypes.c_void_p)]
+
+_fraktal.fraktal_create_command_list.restype = ctypes.c_void_p
+_fraktal.fraktal_create_command_list.argtypes = []
+def create_command_list():
+    return _fraktal.fraktal_create_command_list()
+
+_fraktal.fraktal_destroy_command_list.restype = None
+_fraktal.fraktal_destroy_command_list.argtypes = [ctypes.c_void_p]
+def destroy_command_list(command_list):
+    _fraktal.fraktal_destroy_command_list(command_list)
+
+_fraktal.fraktal_begin_command_list.restype = None
+_fraktal.fraktal_begin_command_list.argtypes = [ctypes.c_void_p]
+def begin_command_list(command_list):
+    _fraktal.fraktal_begin_command_list(command_list)
+
+_fraktal.fraktal_end_command_list.restype = None
+_fraktal.fraktal_end_command_list.argtypes = []
+def end_command_list():
+    _fraktal.fraktal_end_command_list()
+
+_fraktal.fraktal_run_command_list.restype = None
+_fraktal.fraktal_run_command_list.argtypes = [ctypes.c_void_p, ctypes.POINTER(CommandPatch), ctypes.c_int]
+def run_command_list(command_list, patches=[]):
+    ppatches = (CommandPatch*len(patches))(*patches)
+    _fraktal.fraktal_run_command_list(command_list, ppatches, len(patches))
+
+############################################################
+# §7 Render graphs
+############################################################
+
+PassCallback = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_void_p)
+
+_fraktal.fraktal_create_graph.restype = ctypes.c_void_p
+_fraktal.fraktal_create_graph.argtypes = []
+def create_graph():
+    return _fraktal.fraktal_create_graph()
+
+_fraktal.fraktal_destroy_graph.restype = None
+_fraktal.fraktal_destroy_graph.argtypes = [ctypes.c_void_p]
+def destroy_graph(graph):
+    _fraktal.fraktal_destroy_graph(graph)
+
+_fraktal.fraktal_graph_array.restype = ctypes.c_int
+_fraktal.fraktal_graph_array.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+def graph_array(graph, channels, width, height, format):
+    return _fraktal.fraktal_graph_array(graph, channels, width, height, format)
+
+_fraktal.fraktal_graph_import.restype = ctypes.c_int
+_fraktal.fraktal_graph_import.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+def graph_import(graph, array):
+    return _fraktal.fraktal_graph_import(graph, array)
+
+_fraktal.fraktal_graph_pass.restype = ctypes.c_int
+_fraktal.fraktal_graph_pass.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_int, ctypes.c_bool, PassCallback, ctypes.c_void_p]
+def graph_pass(graph, kernel, output, clear, callback=None):
+    # The callback object must be kept alive for as long as the graph is run
+    if callback is None:
+        callback = PassCallback()
+    return _fraktal.fraktal_graph_pass(graph, kernel, output, clear, callback, None)
+
+_fraktal.fraktal_graph_input.restype = None
+_fraktal.fraktal_graph_input.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+def graph_input(graph, graph_pass, offset, array):
+    _fraktal.fraktal_graph_input(graph, graph_pass, offset, array)
+
+_fraktal.fraktal_compile_graph.restype = ctypes.c_bool
+_fraktal.fraktal_compile_graph.argtypes = [ctypes.c_void_p]
+def compile_graph(graph):
+    return _fraktal.fraktal_compile_graph(graph)
+
+_fraktal.fraktal_run_graph.restype = None
+_fraktal.fraktal_run_graph.argtypes = [ctypes.c_void_p]
+def run_graph(graph):
+    _fraktal.fraktal_run_graph(graph)
+
+############################################################
+# §8 Memory
+############################################################
+
+class MemoryStats(ctypes.Structure):
+    _fields_ = [('array_bytes', ctypes.c_size_t),
+                ('array_bytes_float', ctypes.c_size_t),
+                ('array_bytes_uint8', ctypes.c_size_t),
+                ('peak_array_bytes', ctypes.c_size_t),
+                ('host_bytes', ctypes.c_size_t),
+                ('budget', ctypes.c_size_t),
+                ('num_arrays', ctypes.c_int),
+                ('num_kernels', ctypes.c_int),
+                ('num_command_lists', ctypes.c_int),
+                ('num_graphs', ctypes.c_int)]
+
+_fraktal.fraktal_get_memory_stats.restype = None
+_fraktal.fraktal_get_memory_stats.argtypes = [ctypes.POINTER(MemoryStats)]
+def get_memory_stats():
+    stats = MemoryStats()
+    _fraktal.fraktal_get_memory_stats(ctypes.byref(stats))
+    return stats
+
+_fraktal.fraktal_set_memory_budget.restype = None
+_fraktal.fraktal_set_memory_budget.argtypes = [ctypes.c_size_t]
+def set_memory_budget(bytes):
+    _fraktal.fraktal_set_memory_budget(bytes)
+
+############################################################
+# §9 Tracing
+############################################################
+
+_fraktal.fraktal_trace_begin.restype = None
+_fraktal.fraktal_trace_begin.argtypes = [ctypes.c_char_p]
+def trace_begin(exit_path=None):
+    if exit_path is not None:
+        exit_path = _to_char_p(exit_path)
+    _fraktal.fraktal_trace_begin(exit_path)
+
+_fraktal.fraktal_trace_end.restype = None
+_fraktal.fraktal_trace_end.argtypes = []
+def trace_end():
+    _fraktal.fraktal_trace_end()
+
+_fraktal.fraktal_trace_dump.restype = ctypes.c_bool
+_fraktal.fraktal_trace_dump.argtypes = [ctypes.c_char_p]
+def trace_dump(path):
+    return _fraktal.fraktal_trace_dump(_to_char_p(path))
+
+############################################################
+# §10 Interpreter
+############################################################
+
+OP_END                  = 0
+OP_TRANSLATE            = 1
+OP_ROTATE               = 2
+OP_SCALE                = 3
+OP_MIRROR               = 4
+OP_MOD_INTERVAL         = 5
+OP_MOD_POLAR            = 6
+OP_SPHERE               = 16
+OP_BOX                  = 17
+OP_CYLINDER             = 18
+OP_CAPSULE              = 19
+OP_TORUS                = 20
+OP_PLANE                = 21
+OP_CONE                 = 22
+OP_HEXAGON              = 23
+OP_UNION                = 32
+OP_INTERSECTION         = 33
+OP_DIFFERENCE           = 34
+OP_UNION_ROUND          = 35
+OP_INTERSECTION_ROUND   = 36
+OP_DIFFERENCE_ROUND     = 37
+OP_UNION_CHAMFER        = 38
+OP_INTERSECTION_CHAMFER = 39
+OP_DIFFERENCE_CHAMFER   = 40
+OP_UNION_SOFT           = 41
+OP_OFFSET               = 42
+OP_DIST_SCALE           = 43
+
+class Instruction(ctypes.Structure):
+    _fields_ = [('op', ctypes.c_float),
+                ('dst', ctypes.c_float),
+                ('a', ctypes.c_float),
+                ('b', ctypes.c_float),
+                ('arg', ctypes.c_float * 8)]
+
+_fraktal.fraktal_create_program.restype = ctypes.c_void_p
+_fraktal.fraktal_create_program.argtypes = [ctypes.c_int]
+def create_program(capacity):
+    return _fraktal.fraktal_create_program(capacity)
+
+_fraktal.fraktal_upload_program.restype = None
+_fraktal.fraktal_upload_program.argtypes = [ctypes.c_void_p, ctypes.POINTER(Instruction), ctypes.c_int]
+def _to_instructions(instructions):
+    code = (Instruction * len(instructions))()
+    for i,(op,dst,a,b,args) in enumerate(instructions):
+        code[i].op = op
+        code[i].dst = dst
+        code[i].a = a
+        code[i].b = b
+        for j,x in enumerate(args):
+            code[i].arg[j] = x
+    return code
+
+def upload_program(program, instructions):
+    """
+    instructions: list of (op, dst, a, b, [args...]) tuples
+    """
+    code = _to_instructions(instructions)
+    _fraktal.fraktal_upload_program(program, code, len(instructions))
+
+############################################################
+# §11 CPU evaluation
+############################################################
+
+_fraktal.fraktal_cpu_eval.restype = None
+_fraktal.fraktal_cpu_eval.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_int, ctypes.POINTER(Instruction), ctypes.c_int]
+def cpu_eval(points, instructions):
+    """
+    points: list of (x, y, z) tuples
+    instructions: list of (op, dst, a, b, [args...]) tuples
+    Returns a list with one distance per point
+    """
+    count = len(points)
+    pdata = (ctypes.c_float*(3*count))(*[x for p in points for x in p])
+    distances = (ctypes.c_float*count)()
+    code = _to_instructions(instructions)
+    _fraktal.fraktal_cpu_eval(distances, pdata, count, code, len(instructions))
+    return [float(d) for d in distances]
+
+_fraktal.fraktal_cpu_isa.restype = ctypes.c_char_p
+_fraktal.fraktal_cpu_isa.argtypes = []
+def cpu_isa():
+    return _fraktal.fraktal_cpu_isa().decode('utf-8')
+
+_fraktal.fraktal_cpu_eval_interval.restype = None
+_fraktal.fraktal_cpu_eval_interval.argtypes = [ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_float), ctypes.POINTER(Instruction), ctypes.c_int]
+def cpu_eval_interval(box_min, box_max, instructions):
+    """
+    Returns (lower, upper) bounds on the distance over the box
+    """
+    result = (ctypes.c_float*2)()
+    code = _to_instructions(instructions)
+    _fraktal.fraktal_cpu_eval_interval(result, (ctypes.c_float*3)(*box_min), (ctypes.c_float*3)(*box_max), code, len(instructions))
+    return (result[0], result[1])
+
+_fraktal.fraktal_cpu_bounds.restype = ctypes.c_bool
+_fraktal.fraktal_cpu_bounds.argtypes = [ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_float), ctypes.c_int, ctypes.POINTER(Instruction), ctypes.c_int]
+def cpu_bounds(region_min, region_max, max_depth, instructions):
+    """
+    Returns (bounds_min, bounds_max), or None if the model does not
+    intersect the region
+    """
+    bounds_min = (ctypes.c_float*3)()
+    bounds_max = (ctypes.c_float*3)()
+    code = _to_instructions(instructions)
+    if not _fraktal.fraktal_cpu_bounds(bounds_min, bounds_max, (ctypes.c_float*3)(*region_min), (ctypes.c_float*3)(*region_max), max_depth, code, len(instructions)):
+        return None
+    return (list(bounds_min), list(bounds_max))
+
+############################################################
+# §12 Mesh extraction
+############################################################
+
+_fraktal.fraktal_extract_mesh.restype = ctypes.c_bool
+_fraktal.fraktal_extract_mesh.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_float), ctypes.c_int, ctypes.c_float, ctypes.c_int]
+def extract_mesh(path, format, bounds_min, bounds_max, resolution, lipschitz=1.0, num_threads=0):
+    return _fraktal.fraktal_extract_mesh(_to_char_p(path), format, (ctypes.c_float*3)(*bounds_min), (ctypes.c_float*3)(*bounds_max), resolution, lipschitz, num_threads)
+
+_fraktal.fraktal_estimate_bounds.restype = ctypes.c_bool
+_fraktal.fraktal_estimate_bounds.argtypes = [ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_float), ctypes.c_int, ctypes.c_float]
+def estimate_bounds(region_min, region_max, resolution, lipschitz=1.0):
+    """
+    Returns (bounds_min, bounds_max) containing the inside of the model
+    of the current kernel, or None if it may extend outside the region
+    or is not found in it
+    """
+    bounds_min = (ctypes.c_float*3)()
+    bounds_max = (ctypes.c_float*3)()
+    if not _fraktal.fraktal_estimate_bounds(bounds_min, bounds_max, (ctypes.c_float*3)(*region_min), (ctypes.c_float*3)(*region_max), resolution, lipschitz):
+        return None
+    return (tuple(bounds_min), tuple(bounds_max))
+
+############################################################
+# §13 Brick maps
+############################################################
+
+_fraktal.fraktal_create_brick_map.restype = ctypes.c_void_p
+_fraktal.fraktal_create_brick_map.argtypes = []
+def create_brick_map():
+    return _fraktal.fraktal_create_brick_map()
+
+_fraktal.fraktal_destroy_brick_map.restype = None
+_fraktal.fraktal_destroy_brick_map.argtypes = [ctypes.c_void_p]
+def destroy_brick_map(brick_map):
+    _fraktal.fraktal_destroy_brick_map(brick_map)
+
+_fraktal.fraktal_bake_brick_map.restype = ctypes.c_bool
+_fraktal.fraktal_bake_brick_map.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_float), ctypes.c_int]
+def bake_brick_map(brick_map, bounds_min, bounds_max, resolution):
+    return _fraktal.fraktal_bake_brick_map(brick_map, (ctypes.c_float*3)(*bounds_min), (ctypes.c_float*3)(*bounds_max), resolution)
+
+_fraktal.fraktal_invalidate_brick_map.restype = None
+_fraktal.fraktal_invalidate_brick_map.argtypes = [ctypes.c_void_p]
+def invalidate_brick_map(brick_map):
+    _fraktal.fraktal_invalidate_brick_map(brick_map)
+
+_fraktal.fraktal_is_brick_map_current.restype = ctypes.c_bool
+_fraktal.fraktal_is_brick_map_current.argtypes = [ctypes.c_void_p]
+def is_brick_map_current(brick_map):
+    return _fraktal.fraktal_is_brick_map_current(brick_map)
+
+_fraktal.fraktal_param_brick_map.restype = None
+_fraktal.fraktal_param_brick_map.argtypes = [ctypes.c_void_p]
+def param_brick_map(brick_map):
+    _fraktal.fraktal_param_brick_map(brick_map)
+
+_fraktal.fraktal_create_model_params.restype = ctypes.c_void_p
+_fraktal.fraktal_create_model_params.argtypes = []
+def create_model_params():
+    return _fraktal.fraktal_create_model_params()
+
+_fraktal.fraktal_destroy_model_params.restype = None
+_fraktal.fraktal_destroy_model_params.argtypes = [ctypes.c_void_p]
+def destroy_model_params(model_params):
+    _fraktal.fraktal_destroy_model_params(model_params)
+
+_fraktal.fraktal_record_model_params.restype = None
+_fraktal.fraktal_record_model_params.argtypes = [ctypes.c_void_p]
+def record_model_params(model_params):
+    _fraktal.fraktal_record_model_params(model_params)
+
+_fraktal.fraktal_invalidate_model_params.restype = None
+_fraktal.fraktal_invalidate_model_params.argtypes = [ctypes.c_void_p]
+def invalidate_model_params(model_params):
+    _fraktal.fraktal_invalidate_model_params(model_params)
+
+_fraktal.fraktal_model_params_match.restype = ctypes.c_bool
+_fraktal.fraktal_model_params_match.argtypes = [ctypes.c_void_p]
+def model_params_match(model_params):
+    return _fraktal.fraktal_model_params_match(model_params)
+
+############################################################
+# §14 Model builder
+############################################################
+
+_fraktal.fraktal_create_model.restype = ctypes.c_void_p
+_fraktal.fraktal_create_model.argtypes = []
+def create_model():
+    return _fraktal.fraktal_create_model()
+
+_fraktal.fraktal_destroy_model.restype = None
+_fraktal.fraktal_destroy_model.argtypes = [ctypes.c_void_p]
+def destroy_model(model):
+    _fraktal.fraktal_destroy_model(model)
+
+_fraktal.fraktal_model_input.restype = ctypes.c_int
+_fraktal.fraktal_model_input.argtypes = [ctypes.c_void_p]
+def model_input(model):
+    return _fraktal.fraktal_model_input(model)
+
+_fraktal.fraktal_model_node.restype = ctypes.c_int
+_fraktal.fraktal_model_node.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.POINTER(ctypes.c_float)]
+def model_node(model, op, a, b=0, args=()):
+    """
+    args: list of up to 8 floats, as described for the OP_ constants in fraktal.h
+    Returns the index of the node
+    """
+    pargs = (ctypes.c_float*8)(*args)
+    return _fraktal.fraktal_model_node(model, op, a, b, pargs)
+
+_fraktal.fraktal_model_glsl.restype = ctypes.c_int
+_fraktal.fraktal_model_glsl.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_bool, ctypes.c_char_p, ctypes.c_int]
+def model_glsl(model, root, prune=True):
+    """
+    Returns GLSL source defining model(p) for the node 'root'
+    prune: skip unions of distant objects using their bounds
+    """
+    length = _fraktal.fraktal_model_glsl(model, root, prune, None, 0)
+    buffer = ctypes.create_string_buffer(length + 1)
+    _fraktal.fraktal_model_glsl(model, root, prune, buffer, length + 1)
+    return buffer.value.decode('utf-8')
+
+_fraktal.fraktal_model_bounds.restype = ctypes.c_bool
+_fraktal.fraktal_model_bounds.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_float)]
+def model_bounds(model, node):
+    """
+    Returns ((x0,y0,z0), (x1,y1,z1)) containing the inside of 'node',
+    or None if it is unbounded
+    """
+    lo = (ctypes.c_float*3)()
+    hi = (ctypes.c_float*3)()
+    if not _fraktal.fraktal_model_bounds(model, node, lo, hi):
+        return None
+    return (tuple(lo), tuple(hi))
+
+_fraktal.fraktal_model_program.restype = ctypes.c_int
+_fraktal.fraktal_model_program.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.POINTER(Instruction), ctypes.c_int]
+def model_program(model, root):
+    """
+    Returns a list of (op, dst, a, b, [args...]) tuples for upload_program
+    and cpu_eval, or None if the model could not be compiled
+    """
+    count = _fraktal.fraktal_model_program(model, root, None, 0)
+    if count < 0:
+        return None
+    code = (Instruction * count)()
+    if _fraktal.fraktal_model_program(model, root, code, count) < 0:
+        return None
+    return [(int(c.op), int(c.dst), int(c.a), int(c.b), list(c.arg)) for c in code]
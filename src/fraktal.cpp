@@ -23,6 +23,9 @@ or #define them directly if you do a unity build.
 -D FRAKTAL_OMIT_GL_SYMBOLS -> prevents definition of OpenGL symbols
                               (useful for unity-builds)
 -D fraktal_assert          -> bring your own assert macro
+-D FRAKTAL_TRACE           -> record CPU time spent in every API call and
+                              GPU time of draws and readbacks, to be dumped
+                              as Chrome trace JSON (see fraktal_trace_begin)
 
 */
 
@@ -45,8 +48,21 @@ or #define them directly if you do a unity build.
 #define fraktal_check_gl_error() fraktal_assert(glGetError() == GL_NO_ERROR)
 
 #include "fraktal_types.h"
+#include "fraktal_trace.h"
 #include "fraktal_context.h"
 #include "fraktal_array.h"
 #include "fraktal_kernel.h"
 #include "fraktal_parse.h"
 #include "fraktal_link.h"
+#include "fraktal_copy.h"
+#include "fraktal_iterate.h"
+#include "fraktal_pyramid.h"
+#include "fraktal_interpreter.h"
+#include "fraktal_cpu.h"
+#include "fraktal_interval.h"
+#include "fraktal_mesh.h"
+#include "fraktal_brickmap.h"
+#include "fraktal_model.h"
+#include "fraktal_command.h"
+#include "fraktal_graph.h"
+#include "fraktal_memory.h"
@@ -13,9 +13,16 @@ Index of this file:
 ....fraktal_destroy_array
 ....fraktal_zero_array
 ....fraktal_to_cpu
+....fraktal_copy_array
+....fraktal_reduce
+....fraktal_build_pyramid
+....fraktal_build_pyramid_custom
+....fraktal_generate_mipmaps
 ....fraktal_array_format
 ....fraktal_array_size
 ....fraktal_array_channels
+....fraktal_array_levels
+....fraktal_array_bytes
 ....fraktal_is_valid_array
 ....fraktal_get_gl_handle
 §3 Kernels
@@ -27,6 +34,9 @@ Index of this file:
 ....fraktal_load_kernel
 ....fraktal_use_kernel
 ....fraktal_run_kernel
+....fraktal_run_kernel_n
+....fraktal_iterate
+....fraktal_iterate_until
 §4 Parameters
 ....fraktal_get_param_offset
 ....fraktal_param_...
@@ -35,9 +45,66 @@ Index of this file:
 ....fraktal_destroy_context
 ....fraktal_push_current_context
 ....fraktal_pop_current_context
+§6 Command lists
+....fraktal_create_command_list
+....fraktal_destroy_command_list
+....fraktal_begin_command_list
+....fraktal_end_command_list
+....fraktal_run_command_list
+§7 Render graphs
+....fraktal_create_graph
+....fraktal_destroy_graph
+....fraktal_graph_array
+....fraktal_graph_import
+....fraktal_graph_pass
+....fraktal_graph_input
+....fraktal_compile_graph
+....fraktal_run_graph
+§8 Memory
+....fMemoryStats
+....fraktal_get_memory_stats
+....fraktal_set_memory_budget
+§9 Tracing
+....fraktal_trace_begin
+....fraktal_trace_end
+....fraktal_trace_dump
+§10 Interpreter
+....fOpcode
+....fInstruction
+....fraktal_create_program
+....fraktal_upload_program
+§11 CPU evaluation
+....fraktal_cpu_eval
+....fraktal_cpu_isa
+....fraktal_cpu_eval_interval
+....fraktal_cpu_bounds
+§12 Mesh extraction
+....fraktal_extract_mesh
+....fraktal_estimate_bounds
+§13 Brick maps
+....fraktal_create_brick_map
+....fraktal_destroy_brick_map
+....fraktal_bake_brick_map
+....fraktal_invalidate_brick_map
+....fraktal_is_brick_map_current
+....fraktal_param_brick_map
+....fraktal_create_model_params
+....fraktal_destroy_model_params
+....fraktal_record_model_params
+....fraktal_invalidate_model_params
+....fraktal_model_params_match
+§14 Model builder
+....fraktal_create_model
+....fraktal_destroy_model
+....fraktal_model_input
+....fraktal_model_node
+....fraktal_model_glsl
+....fraktal_model_bounds
+....fraktal_model_program
 */
 
 #pragma once
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -78,11 +145,28 @@ enum fEnum_
     // Texture filter modes
     FRAKTAL_LINEAR,
     FRAKTAL_NEAREST,
+
+    // Reduction operators
+    FRAKTAL_REDUCE_MAX,
+    FRAKTAL_REDUCE_SUM,
+
+    // Pyramid filters
+    FRAKTAL_BOX,
+    FRAKTAL_GAUSSIAN,
+
+    // Mesh file formats
+    FRAKTAL_PLY,
+    FRAKTAL_OBJ,
 };
 
 struct fArray;
 struct fKernel;
 struct fLinkState;
+struct fCommandList;
+struct fRenderGraph;
+struct fBrickMap;
+struct fModelParams;
+struct fModel;
 
 //-----------------------------------------------------------------------------
 // §2 Arrays
@@ -145,12 +229,97 @@ FRAKTALAPI void fraktal_zero_array(fArray *a);
 */
 FRAKTALAPI void fraktal_to_cpu(void *cpu_memory, fArray *a);
 
+/*
+    Copies a region of 'src' into 'dst' without leaving the GPU.
+
+    'src_rect' is the region {x, y, width, height} to copy from 'src'.
+    If NULL the whole source array is copied. 'dst_xy' is the lower-
+    left corner {x, y} of the destination region. If NULL the region
+    is copied to the origin. Both regions must lie inside their array.
+    Values outside the destination region are left untouched.
+
+    'swizzle' selects the source channel written to each destination
+    channel, e.g. "bgra", "rrr1" or "a". Each character is one of
+    r,g,b,a (or x,y,z,w), 0 or 1. Missing characters default to the
+    identity, and NULL means "rgba". Channels that are not present in
+    the source read as (0,0,0,1); channels that are not present in the
+    destination are discarded.
+
+    The arrays may have different formats. Values written to a uint8
+    array are clamped to [0,1] and stored as round(255*value).
+
+    'dst' must be read-write and different from 'src'. Both arrays
+    must be 1D or 2D. The function must not be called between
+    fraktal_use_kernel(f) and fraktal_use_kernel(NULL), or while
+    recording a command list.
+*/
+FRAKTALAPI void fraktal_copy_array(fArray *dst, fArray *src, const int *src_rect, const int *dst_xy, const char *swizzle);
+
+/*
+    Reduces all elements of 'a' to a single value per channel on the
+    GPU and writes it to 'result'. 'op' is either FRAKTAL_REDUCE_MAX
+    or FRAKTAL_REDUCE_SUM. Channels not present in 'a' are undefined.
+    Only the four resulting values are copied back to the CPU.
+
+    The function may be called between fraktal_use_kernel(f) and
+    fraktal_use_kernel(NULL), but not while recording a command list.
+*/
+FRAKTALAPI void fraktal_reduce(float result[4], fArray *a, fEnum op);
+
+/*
+    Builds an image pyramid from 'a' as a chain of separate arrays,
+    where each level has half the width and height (rounded up) of the
+    previous one. levels[0] is the first downsampled level; 'a' itself
+    is not part of the chain. Building stops after 'num_levels' levels
+    or when a level of size 1x1 has been produced.
+
+    'filter' is FRAKTAL_BOX (2x2 average) or FRAKTAL_GAUSSIAN (4x4
+    binomial approximation of a Gaussian). Values outside an array
+    are clamped to the edge.
+
+    Entries of 'levels' that are NULL are created as read-write arrays
+    with the channels and format of 'a' and are owned by the caller.
+    Existing entries are reused, which lets a pyramid be rebuilt every
+    frame without allocations; they must have the size of the level.
+
+    Returns the number of levels built. Must not be called between
+    fraktal_use_kernel(f) and fraktal_use_kernel(NULL).
+
+    Example (coarse-to-fine loss):
+      fArray *levels[8] = {0};
+      int n = fraktal_build_pyramid(levels, 8, target, FRAKTAL_GAUSSIAN);
+*/
+FRAKTALAPI int fraktal_build_pyramid(fArray **levels, int num_levels, fArray *a, fEnum filter);
+
+/*
+    Same as fraktal_build_pyramid, but each level is computed by the
+    current kernel (set by fraktal_use_kernel) with a custom filter.
+    The previous level (or 'a') is passed to the array parameter at
+    'offset'. If the kernel declares 'uniform int iLevel', it is set
+    to the index of the level being computed. Each level overwrites
+    the contents of its array. Note that levels of height 1 are 1D
+    arrays.
+*/
+FRAKTALAPI int fraktal_build_pyramid_custom(int offset, fArray **levels, int num_levels, fArray *a);
+
+/*
+    Computes a full chain of mipmap levels stored in the array itself,
+    using the driver's (box) filter. Kernels can then read a specific
+    level with texelFetch(sampler, p, level) or textureLod(sampler, uv,
+    level). Levels are not updated automatically: call this function
+    again after writing to the array. fraktal_array_levels returns the
+    number of levels (1 if mipmaps were never generated).
+*/
+FRAKTALAPI void fraktal_generate_mipmaps(fArray *a);
+
 /*
     These methods return information about an array.
 */
 FRAKTALAPI void fraktal_array_size(fArray *a, int *width, int *height, int *depth);
 FRAKTALAPI fEnum fraktal_array_format(fArray *a); // -1 if 'a' is NULL
 FRAKTALAPI int fraktal_array_channels(fArray *a); // 0 is 'a' is NULL
+FRAKTALAPI int fraktal_array_levels(fArray *a); // 0 if 'a' is NULL
+FRAKTALAPI size_t fraktal_array_bytes(fArray *a); // GPU memory, 0 if 'a' is NULL
 
 /*
     Returns true if the fArray satisfies the following properties:
@@ -275,6 +444,47 @@ FRAKTALAPI void fraktal_use_kernel(fKernel *f);
 */
 FRAKTALAPI void fraktal_run_kernel(fArray *out);
 
+/*
+    Equivalent to calling fraktal_run_kernel(out) 'n' times, but issued
+    as a single GPU submission. Each run can read its index (0, 1, ...,
+    n-1) from the built-in input 'iSampleIndex' (declared for every
+    kernel as 'flat in int iSampleIndex'), which is 0 for
+    fraktal_run_kernel. For example, a progressive renderer can add 'n'
+    samples at once, using iSamples + iSampleIndex as the sample number.
+*/
+FRAKTALAPI void fraktal_run_kernel_n(fArray *out, int n);
+
+/*
+    Runs the current kernel 'n' times, alternating between 'a' and 'b'
+    as input and output. The first step reads from 'a' and writes to
+    'b', the second reads from 'b' and writes to 'a', and so on. The
+    input is passed to the array parameter at 'offset'. Unlike
+    fraktal_run_kernel, each step overwrites its output.
+
+    If the kernel declares 'uniform int iIteration', it is set to the
+    index of the step (0, 1, ..., n-1). Other parameters keep the
+    values set before the call.
+
+    Returns the array holding the result of the last step ('a' if n
+    is even, 'b' if n is odd). 'a' and 'b' must be different read-write
+    arrays of the same size. This function can be recorded in a
+    command list.
+*/
+FRAKTALAPI fArray *fraktal_iterate(int offset, fArray *a, fArray *b, int n);
+
+/*
+    Same as fraktal_iterate, but checks for convergence every
+    'check_every' steps (and after the last step). The iteration stops
+    when the largest absolute change of any element in the last step,
+    computed by a reduction on the GPU, is at most 'tolerance'.
+
+    'max_steps' limits the number of steps. If 'steps' is not NULL it
+    receives the number of steps taken. Returns the array holding the
+    result of the last step. This function cannot be recorded in a
+    command list.
+*/
+FRAKTALAPI fArray *fraktal_iterate_until(int offset, fArray *a, fArray *b, int max_steps, int check_every, float tolerance, int *steps);
+
 //-----------------------------------------------------------------------------
 // §4 Parameters
 //-----------------------------------------------------------------------------
@@ -351,6 +561,567 @@ FRAKTALAPI void fraktal_push_current_context();
 */
 FRAKTALAPI void fraktal_pop_current_context();
 
+//-----------------------------------------------------------------------------
+// §6 Command lists
+//-----------------------------------------------------------------------------
+
+/*
+    A command list records a sequence of fraktal_use_kernel,
+    fraktal_param_..., fraktal_zero_array and fraktal_run_kernel calls
+    once, so that it can be replayed many times with little overhead.
+    For example:
+
+      fCommandList *list = fraktal_create_command_list();
+      fraktal_begin_command_list(list);
+      fraktal_use_kernel(f);
+      fraktal_param_1i(loc_iSamples, 0);
+      fraktal_run_kernel(out);
+      fraktal_use_kernel(NULL);
+      fraktal_end_command_list();
+
+      for (int i = 0; i < n; i++)
+      {
+          fCommandPatch patch = { f, loc_iSamples };
+          patch.i[0] = i;
+          fraktal_run_command_list(list, &patch, 1);
+      }
+
+    The caller owns the returned fCommandList, which should eventually
+    be destroyed with fraktal_destroy_command_list.
+*/
+FRAKTALAPI fCommandList *fraktal_create_command_list();
+
+/*
+    Frees memory associated with a command list.
+
+    If 'list' is NULL the function silently returns.
+*/
+FRAKTALAPI void fraktal_destroy_command_list(fCommandList *list);
+
+/*
+    Begins recording into 'list', discarding any commands previously
+    recorded into it. Until fraktal_end_command_list is called, calls
+    to the functions listed above are validated and appended to 'list'
+    instead of being executed.
+
+    No kernel can be in use when recording begins. Kernels and arrays
+    referenced by the recorded commands must outlive the list.
+*/
+FRAKTALAPI void fraktal_begin_command_list(fCommandList *list);
+FRAKTALAPI void fraktal_end_command_list();
+
+/*
+    Identifies a parameter by the kernel and offset it was recorded
+    with and provides the value to use in its place during a replay.
+    Float parameters read from 'f' (matrices in column major order),
+    int parameters read from 'i' and array parameters read from 'array'.
+*/
+struct fCommandPatch
+{
+    fKernel *kernel;
+    int offset;
+    float f[16];
+    int i[4];
+    fArray *array;
+};
+
+/*
+    Executes the commands recorded in 'list'. Parameters matching an
+    entry in 'patches' use the patched value, all others use the value
+    they were recorded with. 'patches' may be NULL if 'num_patches' is 0.
+
+    Unlike fraktal_use_kernel, replay does not query and restore the
+    GPU state. On return, the current program, vertex array, framebuffer
+    and texture unit are reset to their defaults and blending is disabled.
+    A list must always be replayed on the same context.
+*/
+FRAKTALAPI void fraktal_run_command_list(fCommandList *list, fCommandPatch *patches, int num_patches);
+
+//-----------------------------------------------------------------------------
+// §7 Render graphs
+//-----------------------------------------------------------------------------
+
+/*
+    A render graph describes a multi-pass pipeline declaratively: each
+    pass runs a kernel into one output array and may read any number of
+    other arrays. The graph decides the order in which passes run and
+    allocates the arrays that only live inside the graph (transient
+    arrays). Transient arrays with equal dimensions and format share
+    memory if no pass needs both at the same time.
+
+    For example, a two-pass pipeline that renders into an intermediate
+    array and composes the result into an existing array 'out':
+
+      fRenderGraph *g = fraktal_create_graph();
+      int tmp = fraktal_graph_array(g, 4, width, height, FRAKTAL_FLOAT);
+      int dst = fraktal_graph_import(g, out);
+      int render = fraktal_graph_pass(g, render_kernel, tmp, true, set_params, NULL);
+      int compose = fraktal_graph_pass(g, compose_kernel, dst, true, NULL, NULL);
+      fraktal_graph_input(g, compose, loc_iChannel0, tmp);
+      fraktal_run_graph(g);
+
+    The caller owns the returned fRenderGraph, which should eventually
+    be destroyed with fraktal_destroy_graph. Destroying the graph frees
+    its transient arrays, but not imported arrays.
+*/
+FRAKTALAPI fRenderGraph *fraktal_create_graph();
+FRAKTALAPI void fraktal_destroy_graph(fRenderGraph *g);
+
+/*
+    Declares a transient 2D array and returns a handle to it, or -1 on
+    failure. The contents of a transient array are only defined between
+    the first pass writing to it and the last pass reading from it. The
+    first pass writing to a transient array always clears it.
+*/
+FRAKTALAPI int fraktal_graph_array(fRenderGraph *g, int channels, int width, int height, fEnum format);
+
+/*
+    Declares an array owned by the caller and returns a handle to it, or
+    -1 on failure. Imported arrays keep their contents between runs and
+    are never aliased. Use this for results that must be read after the
+    graph has run, or that accumulate over several runs.
+*/
+FRAKTALAPI int fraktal_graph_import(fRenderGraph *g, fArray *a);
+
+/*
+    Declares a pass that runs kernel 'f' into the array 'output' and
+    returns a handle to it, or -1 on failure.
+
+    'clear'   : If true, 'output' is cleared to zero before the pass runs.
+                Otherwise results are added to its contents.
+    'callback': Optional. Called after the kernel is put in use and its
+                inputs are bound, so that it may set other parameters.
+
+    Passes run after all passes writing to their inputs. Passes writing
+    to the same array run in the order they were declared.
+*/
+typedef void (*fPassCallback)(fKernel *f, void *userdata);
+FRAKTALAPI int fraktal_graph_pass(fRenderGraph *g, fKernel *f, int output, bool clear, fPassCallback callback, void *userdata);
+
+/*
+    Binds 'array' to the array parameter at 'offset' when 'pass' runs.
+    If 'offset' is -1 (the parameter is unused) the call has no effect.
+*/
+FRAKTALAPI void fraktal_graph_input(fRenderGraph *g, int pass, int offset, int array);
+
+/*
+    Orders the passes and allocates transient arrays. Returns false if
+    the passes have a cyclic dependency or allocation fails. Adding
+    passes, arrays or inputs requires the graph to be compiled again,
+    which fraktal_run_graph does automatically.
+*/
+FRAKTALAPI bool fraktal_compile_graph(fRenderGraph *g);
+
+/*
+    Runs all passes in the graph. No kernel may be in use when calling
+    this function.
+*/
+FRAKTALAPI void fraktal_run_graph(fRenderGraph *g);
+
+//-----------------------------------------------------------------------------
+// §8 Memory
+//-----------------------------------------------------------------------------
+
+/*
+    Memory held by live fraktal objects. GPU memory is estimated from
+    the dimensions, channels, format and mipmap levels of each array
+    (see fraktal_array_bytes); drivers may use more. Host memory covers
+    the objects' CPU-side state. GPU memory used by kernels is not
+    known and only the number of kernels is reported.
+*/
+struct fMemoryStats
+{
+    size_t array_bytes;       // GPU memory held by all arrays
+    size_t array_bytes_float; // ... by arrays of format FRAKTAL_FLOAT
+    size_t array_bytes_uint8; // ... by arrays of format FRAKTAL_UINT8
+    size_t peak_array_bytes;  // largest value of array_bytes so far
+    size_t host_bytes;        // CPU memory held by fraktal objects
+    size_t budget;            // see fraktal_set_memory_budget (0 if none)
+    int num_arrays;
+    int num_kernels;
+    int num_command_lists;
+    int num_graphs;
+};
+
+FRAKTALAPI void fraktal_get_memory_stats(fMemoryStats *stats);
+
+/*
+    Sets a hard limit on the GPU memory held by arrays, or removes the
+    limit if 'bytes' is 0 (the default).
+
+    When creating an array would exceed the budget, fraktal first frees
+    arrays it keeps only for reuse (transient arrays of render graphs
+    that are not running, and intermediate arrays of fraktal_reduce).
+    These are recreated when next needed. If the array still does not
+    fit, fraktal_create_array logs an error and returns NULL, and
+    fraktal_generate_mipmaps leaves the array unchanged.
+
+    Lowering the budget below the current usage does not free arrays
+    owned by the caller.
+*/
+FRAKTALAPI void fraktal_set_memory_budget(size_t bytes);
+
+//-----------------------------------------------------------------------------
+// §9 Tracing
+//-----------------------------------------------------------------------------
+
+/*
+    These functions only have an effect if fraktal was compiled with
+    FRAKTAL_TRACE defined (see fraktal.cpp). Otherwise they do nothing
+    and fraktal_trace_dump returns false.
+
+    While tracing, every API call records a CPU span, including shader
+    compilation, and draws, clears and readbacks record a GPU span using
+    timer queries (if supported by the driver, i.e. OpenGL 3.3 or
+    ARB_timer_query). Spans are written to a ring buffer per thread
+    holding the most recent 65536 events, without locking.
+
+    'exit_path': Optional. If not NULL, the trace is written to this
+                 file when the process exits. GPU spans that have not
+                 been resolved by then are dropped.
+*/
+FRAKTALAPI void fraktal_trace_begin(const char *exit_path);
+FRAKTALAPI void fraktal_trace_end();
+
+/*
+    Writes all recorded spans to 'path' in the Chrome trace event
+    format, which can be opened in chrome://tracing or Perfetto. Waits
+    for pending GPU spans issued by the calling thread. Should not be
+    called while other threads are making traced calls. Returns false
+    if tracing is not compiled in or the file cannot be written.
+*/
+FRAKTALAPI bool fraktal_trace_dump(const char *path);
+
+//-----------------------------------------------------------------------------
+// §10 Interpreter
+//-----------------------------------------------------------------------------
+
+/*
+    The model libf/interpreter.f evaluates a distance field encoded as a
+    stream of instructions, stored in an array bound to its 'iProgram'
+    parameter. Many candidate models can then be evaluated with a single
+    kernel, since switching models only uploads a new program.
+
+    The interpreter has 8 point registers P[0..7] and 16 distance
+    registers R[0..15]. P[0] initially holds the point being evaluated,
+    and R[0] holds the result when FRAKTAL_OP_END is reached. Register
+    indices and arguments are stored as floats. Primitive and operator
+    arguments follow hg_sdf (libf/hg_sdf.f).
+
+    Example (a sphere with a box cut out of it, moved up by 1):
+      fInstruction code[] = {
+          { FRAKTAL_OP_TRANSLATE,  1, 0, 0, { 0, 1, 0 } },       // P1 = P0 - (0,1,0)
+          { FRAKTAL_OP_SPHERE,     1, 1, 0, { 1.0f } },          // R1 = sphere(P1)
+          { FRAKTAL_OP_BOX,        2, 1, 0, { 0.5f, 2, 0.5f } }, // R2 = box(P1)
+          { FRAKTAL_OP_DIFFERENCE, 0, 1, 2 },                    // R0 = R1 - R2
+          { FRAKTAL_OP_END },
+      };
+*/
+enum fOpcode_
+{
+    FRAKTAL_OP_END                  = 0,
+
+    // Point operations: P[dst] = f(P[a])
+    FRAKTAL_OP_TRANSLATE            = 1,  // P[a] - arg[0..2]
+    FRAKTAL_OP_ROTATE               = 2,  // rotates the shape by the unit quaternion arg[0..3] (x,y,z,w)
+    FRAKTAL_OP_SCALE                = 3,  // P[a] / arg[0] (follow with FRAKTAL_OP_DIST_SCALE)
+    FRAKTAL_OP_MIRROR               = 4,  // abs() along axes where arg[0..2] is 1
+    FRAKTAL_OP_MOD_INTERVAL         = 5,  // repeat with cell size arg[0..2] (0: no repetition) for cell
+                                          // indices arg[3] to arg[4] (unbounded if arg[3] > arg[4])
+    FRAKTAL_OP_MOD_POLAR            = 6,  // arg[0] repetitions around the y axis
+
+    // Primitives: R[dst] = f(P[a])
+    FRAKTAL_OP_SPHERE               = 16, // radius arg[0]
+    FRAKTAL_OP_BOX                  = 17, // half-extents arg[0..2]
+    FRAKTAL_OP_CYLINDER             = 18, // radius arg[0], half-height arg[1]
+    FRAKTAL_OP_CAPSULE              = 19, // radius arg[0], half-length arg[1]
+    FRAKTAL_OP_TORUS                = 20, // small radius arg[0], large radius arg[1]
+    FRAKTAL_OP_PLANE                = 21, // normal arg[0..2], distance from origin arg[3]
+    FRAKTAL_OP_CONE                 = 22, // radius arg[0], height arg[1]
+    FRAKTAL_OP_HEXAGON              = 23, // circumcircle radius arg[0], half-height arg[1]
+
+    // Distance operations: R[dst] = f(R[a], R[b])
+    FRAKTAL_OP_UNION                = 32,
+    FRAKTAL_OP_INTERSECTION         = 33,
+    FRAKTAL_OP_DIFFERENCE           = 34,
+    FRAKTAL_OP_UNION_ROUND          = 35, // radius arg[0]
+    FRAKTAL_OP_INTERSECTION_ROUND   = 36, // radius arg[0]
+    FRAKTAL_OP_DIFFERENCE_ROUND     = 37, // radius arg[0]
+    FRAKTAL_OP_UNION_CHAMFER        = 38, // radius arg[0]
+    FRAKTAL_OP_INTERSECTION_CHAMFER = 39, // radius arg[0]
+    FRAKTAL_OP_DIFFERENCE_CHAMFER   = 40, // radius arg[0]
+    FRAKTAL_OP_UNION_SOFT           = 41, // radius arg[0]
+    FRAKTAL_OP_OFFSET               = 42, // R[a] - arg[0]
+    FRAKTAL_OP_DIST_SCALE           = 43, // R[a] * arg[0]
+};
+
+struct fInstruction
+{
+    float op;
+    float dst;
+    float a;
+    float b;
+    float arg[8];
+};
+
+/*
+    Creates a read-only array with room for 'capacity' instructions.
+    The caller owns the array and should destroy it with
+    fraktal_destroy_array.
+*/
+FRAKTALAPI fArray *fraktal_create_program(int capacity);
+
+/*
+    Uploads 'count' instructions to a program array. The last
+    instruction must be FRAKTAL_OP_END. Programs shorter than the
+    capacity can be uploaded without padding. Command lists that use
+    the array see the new program when they are next run.
+*/
+FRAKTALAPI void fraktal_upload_program(fArray *program, const fInstruction *code, int count);
+
+//-----------------------------------------------------------------------------
+// §11 CPU evaluation
+//-----------------------------------------------------------------------------
+
+/*
+    Evaluates an interpreter program (see §10) at 'count' points on the
+    CPU, without a GPU context. 'points' holds xyz triples and one
+    distance is written per point. The primitives and operators mirror
+    libf/hg_sdf.f, so results agree with the GPU interpreter up to
+    floating point rounding.
+
+    Points are evaluated in batches of 1, 4, 8 or 16 using the widest of
+    scalar, SSE4.1, AVX2 or AVX-512 supported by the CPU. The functions
+    are thread-safe, so large batches can be split across threads.
+*/
+FRAKTALAPI void fraktal_cpu_eval(float *distances, const float *points, int count, const fInstruction *code, int num_instructions);
+
+/*
+    Returns the name of the instruction set used by fraktal_cpu_eval:
+    "scalar", "sse4.1", "avx2" or "avx512".
+*/
+FRAKTALAPI const char *fraktal_cpu_isa();
+
+/*
+    Computes bounds on the distance field of a program over the box
+    [box_min, box_max] using interval arithmetic. 'result' receives
+    (lower, upper), such that every point in the box has a distance in
+    that range. If the lower bound is positive, the box lies entirely
+    outside the model; if the upper bound is negative, it lies entirely
+    inside. The bounds are conservative and tighten as the box shrinks.
+*/
+FRAKTALAPI void fraktal_cpu_eval_interval(float result[2], const float box_min[3], const float box_max[3], const fInstruction *code, int num_instructions);
+
+/*
+    Finds an axis-aligned box that contains the part of the model inside
+    the region [region_min, region_max], by octree subdivision of the
+    region down to 'max_depth' levels. Cells that are entirely outside or
+    entirely inside (see fraktal_cpu_eval_interval) are not subdivided.
+    The result is conservative, and is tight to within the size of a
+    cell at the deepest level, (region_max - region_min)/2^max_depth.
+    Returns false if the model does not intersect the region.
+*/
+FRAKTALAPI bool fraktal_cpu_bounds(float bounds_min[3], float bounds_max[3], const float region_min[3], const float region_max[3], int max_depth, const fInstruction *code, int num_instructions);
+
+//-----------------------------------------------------------------------------
+// §12 Mesh extraction
+//-----------------------------------------------------------------------------
+
+/*
+    Extracts a triangle mesh of the surface model(p) = 0 inside the box
+    [bounds_min, bounds_max] and writes it to 'path' as binary PLY
+    (FRAKTAL_PLY) or OBJ (FRAKTAL_OBJ). Returns false if the file could
+    not be written.
+
+    The current kernel must be linked from a model and libf/grid.f.
+    The box is divided into cubic voxels, 'resolution' along its longest
+    side, which are processed in chunks of 64^3. A chunk is sampled on
+    the GPU only if the distance at its center is within 'lipschitz'
+    times its half-diagonal (use 1 for exact distance fields, and larger
+    values for models that overestimate the distance). The samples are
+    triangulated with marching tetrahedra by 'num_threads' worker threads
+    (0: one per core) and streamed to the file, so memory use does not
+    depend on the resolution.
+
+    Vertices are shared within a chunk, but duplicated along the seams
+    between chunks. Triangles are oriented with normals pointing out of
+    the model.
+*/
+FRAKTALAPI bool fraktal_extract_mesh(const char *path, fEnum format, const float bounds_min[3], const float bounds_max[3], int resolution, float lipschitz, int num_threads);
+
+/*
+    Estimates an axis-aligned box that contains the inside of the model
+    of the current kernel, which must be linked from a model and
+    libf/grid.f. The region [region_min, region_max] is divided into
+    cubic cells, 'resolution' along its longest side (at most 256), and
+    the model is sampled at their centers. A cell can only contain
+    points inside the model if the distance at its center is within
+    'lipschitz' times its half-diagonal, and the box is the union of
+    such cells. The result is conservative if 'lipschitz' bounds how
+    much the model overestimates the distance (see fraktal_extract_mesh).
+
+    Returns false if no cell can contain the model, or if a cell on the
+    border of the region can, since the model may then extend outside
+    the region (e.g. an infinite ground plane).
+*/
+FRAKTALAPI bool fraktal_estimate_bounds(float bounds_min[3], float bounds_max[3], const float region_min[3], const float region_max[3], int resolution, float lipschitz);
+
+//-----------------------------------------------------------------------------
+// §13 Brick maps
+//-----------------------------------------------------------------------------
+
+/*
+    A brick map is a sparse cache of a model's distance field, used by
+    the raymarchers in libf/ through modelCached(p) (libf/brickmap.f).
+    Cells far from the surface store a lower bound on the distance, and
+    cells near the surface store a brick of 9^3 distance samples that is
+    interpolated trilinearly. The model itself is evaluated close to the
+    surface and outside the bounds, so hits are still found with the
+    model, but far fewer model evaluations are needed per ray.
+
+    The cache assumes that model(p) never overestimates the distance.
+*/
+FRAKTALAPI fBrickMap *fraktal_create_brick_map();
+FRAKTALAPI void fraktal_destroy_brick_map(fBrickMap *m);
+
+/*
+    Bakes the model of the current kernel, which must be linked from a
+    model and libf/grid.f, into the brick map. The box [bounds_min,
+    bounds_max] is divided into cubic cells, 'resolution' along its
+    longest side (at most 256), each holding a brick of 8^3 voxels.
+
+    The values of the model's parameters are recorded, so that the map
+    is no longer used once they change; see fraktal_is_brick_map_current.
+    Returns false if the map could not be baked, in which case the map
+    keeps its previous contents.
+*/
+FRAKTALAPI bool fraktal_bake_brick_map(fBrickMap *m, const float bounds_min[3], const float bounds_max[3], int resolution);
+
+/*
+    Marks the map as out of date. Parameter changes are detected
+    automatically, but changes to the model source, or to arrays used
+    by the model (e.g. programs uploaded with fraktal_upload_program),
+    are not.
+*/
+FRAKTALAPI void fraktal_invalidate_brick_map(fBrickMap *m);
+
+/*
+    Returns true if the map has been baked, has not been invalidated,
+    and the model parameters of the current kernel have the same values
+    as when the map was baked. Parameters that the current kernel does
+    not have are ignored.
+*/
+FRAKTALAPI bool fraktal_is_brick_map_current(fBrickMap *m);
+
+/*
+    Sets the libf/brickmap.f parameters of the current kernel. If 'm' is
+    NULL or not current, modelCached(p) falls back to model(p).
+*/
+FRAKTALAPI void fraktal_param_brick_map(fBrickMap *m);
+
+/*
+    A record of the values of the model parameters of a kernel, the same
+    ones a brick map is baked with. Results that are derived from the
+    model without a brick map, e.g. by fraktal_estimate_bounds, can be
+    kept until the parameters change.
+*/
+FRAKTALAPI fModelParams *fraktal_create_model_params();
+FRAKTALAPI void fraktal_destroy_model_params(fModelParams *p);
+
+/*
+    Records the values of the model parameters of the current kernel.
+*/
+FRAKTALAPI void fraktal_record_model_params(fModelParams *p);
+
+/*
+    Marks the record as out of date, like fraktal_invalidate_brick_map.
+*/
+FRAKTALAPI void fraktal_invalidate_model_params(fModelParams *p);
+
+/*
+    Returns true if the parameters have been recorded, the record has
+    not been invalidated, and the model parameters of the current kernel
+    have the recorded values. Parameters that the current kernel does
+    not have are ignored.
+*/
+FRAKTALAPI bool fraktal_model_params_match(fModelParams *p);
+
+//-----------------------------------------------------------------------------
+// §14 Model builder
+//-----------------------------------------------------------------------------
+
+/*
+    Builds a model as a graph of the operations of the interpreter (see
+    §10), which can be compiled to GLSL for fraktal_add_link_data, or to
+    a program for the interpreter and the CPU evaluators.
+
+    Nodes are referred to by index. Building an operation that already
+    exists returns the existing node, so subexpressions that are used
+    several times (e.g. a transform shared by many primitives) are only
+    evaluated once. Consecutive translations, rotations, scales and
+    mirrors are merged, offsets and distance scales likewise, and
+    operations that do nothing (e.g. translating by zero, or the union
+    of a node with itself) return their operand.
+
+    Example (the same model as in §10):
+      fModel *m = fraktal_create_model();
+      float up[] = { 0, 1, 0 }, radius[] = { 1 }, size[] = { 0.5f, 2, 0.5f };
+      int p = fraktal_model_node(m, FRAKTAL_OP_TRANSLATE, fraktal_model_input(m), 0, up);
+      int a = fraktal_model_node(m, FRAKTAL_OP_SPHERE, p, 0, radius);
+      int b = fraktal_model_node(m, FRAKTAL_OP_BOX, p, 0, size);
+      int root = fraktal_model_node(m, FRAKTAL_OP_DIFFERENCE, a, b, NULL);
+*/
+FRAKTALAPI fModel *fraktal_create_model();
+FRAKTALAPI void fraktal_destroy_model(fModel *m);
+
+/*
+    Returns the node of the point the model is evaluated at.
+*/
+FRAKTALAPI int fraktal_model_input(fModel *m);
+
+/*
+    Returns the node for operation 'op' (an fOpcode other than
+    FRAKTAL_OP_END) with arguments 'args', which are as described in
+    fOpcode and may be NULL for operations without arguments. 'a' is a
+    point node for point operations and primitives, and a distance node
+    for distance operations. 'b' is the second distance node of binary
+    distance operations and is ignored otherwise.
+*/
+FRAKTALAPI int fraktal_model_node(fModel *m, int op, int a, int b, const float *args);
+
+/*
+    Writes GLSL source defining 'float model(vec3 p)' for the distance
+    node 'root' to 'buffer', truncated to 'size' bytes including the
+    null terminator, and returns the length of the full source. The
+    source uses hg_sdf, which must be prepended (see libf/hg_sdf.f).
+
+    If 'prune' is true, the operands of unions are grouped by their
+    bounds (see fraktal_model_bounds) into a hierarchy, and a group is
+    only evaluated if the point is near its bounds; otherwise the
+    distance to the bounds is used. This makes large unions (e.g. a
+    scene of many objects) cheaper to evaluate away from most of them.
+    The distance is exact near the surface, and a lower bound elsewhere,
+    which is all that sphere tracing needs.
+*/
+FRAKTALAPI int fraktal_model_glsl(fModel *m, int root, bool prune, char *buffer, int size);
+
+/*
+    Computes an axis-aligned box in the frame of the input point that
+    contains the inside of the distance node 'node'. Returns false if
+    the node is unbounded, e.g. because it contains a plane or infinite
+    repetition, in which case the box is not valid.
+*/
+FRAKTALAPI bool fraktal_model_bounds(fModel *m, int node, float bounds_min[3], float bounds_max[3]);
+
+/*
+    Compiles the distance node 'root' to at most 'capacity' instructions,
+    ending with FRAKTAL_OP_END, and returns the number of instructions.
+    If 'code' is NULL, only the number of instructions is returned.
+    Returns -1 if the program does not fit in 'capacity', or if the model
+    needs more registers than the interpreter has.
+*/
+FRAKTALAPI int fraktal_model_program(fModel *m, int root, fInstruction *code, int capacity);
+
 #ifdef __cplusplus
 }
 #endif
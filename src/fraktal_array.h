@@ -1,6 +1,12 @@
 #pragma once
 #include "reuse/log.h"
 
+// While a command list is being recorded (see fraktal_command.h) array
+// and kernel operations are appended to the list instead of executed.
+struct fCommandList;
+static fCommandList *fraktal_recording = NULL;
+static void fraktal_record_command(fCommandType type, fArray *array, fParamType param_type, int offset, int tex_unit, const float *f, const int *i);
+
 struct fArray
 {
     GLuint fbo;
@@ -11,8 +17,57 @@ struct fArray
     int channels;
     fEnum format;
     fEnum access;
+    int levels; // number of mipmap levels, see fraktal_generate_mipmaps
 };
 
+// Memory held by fraktal objects. Arrays are accounted for when they
+// are created, destroyed or get mipmaps. See fraktal_memory.h.
+static fMemoryStats fraktal_memory = {0};
+static void fraktal_evict_pooled_arrays();
+
+static size_t fraktal_array_bytes_internal(int channels, int width, int height, int depth, fEnum format, int levels)
+{
+    size_t bytes_per_channel = format == FRAKTAL_FLOAT ? 4 : 1;
+    size_t bytes = 0;
+    for (int i = 0; i < levels; i++)
+    {
+        bytes += (size_t)width*height*depth*channels*bytes_per_channel;
+        if (width > 1) width /= 2;
+        if (height > 1) height /= 2;
+        if (depth > 1) depth /= 2;
+    }
+    return bytes;
+}
+
+static void fraktal_track_array_bytes(fEnum format, size_t bytes, bool allocated)
+{
+    size_t *by_format = format == FRAKTAL_FLOAT ? &fraktal_memory.array_bytes_float : &fraktal_memory.array_bytes_uint8;
+    if (allocated)
+    {
+        fraktal_memory.array_bytes += bytes;
+        *by_format += bytes;
+        if (fraktal_memory.array_bytes > fraktal_memory.peak_array_bytes)
+            fraktal_memory.peak_array_bytes = fraktal_memory.array_bytes;
+    }
+    else
+    {
+        fraktal_memory.array_bytes -= bytes;
+        *by_format -= bytes;
+    }
+}
+
+// Returns true if 'bytes' more can be allocated without exceeding the
+// memory budget. Arrays pooled by fraktal are evicted if necessary.
+static bool fraktal_reserve_array_bytes(size_t bytes)
+{
+    size_t budget = fraktal_memory.budget;
+    if (budget == 0)
+        return true;
+    if (fraktal_memory.array_bytes + bytes > budget)
+        fraktal_evict_pooled_arrays();
+    return fraktal_memory.array_bytes + bytes <= budget;
+}
+
 static bool fraktal_format_to_gl_format(int channels,
                                  fEnum format,
                                  GLenum *internal_format,
@@ -45,6 +100,7 @@ fArray *fraktal_create_array(
     fEnum format,
     fEnum access)
 {
+    FRAKTAL_TRACE_FUNCTION();
     fraktal_ensure_context();
     fraktal_check_gl_error();
     fraktal_assert(channels > 0 && channels <= 4);
@@ -55,13 +111,21 @@ fArray *fraktal_create_array(
     GLenum internal_format,data_format,data_type;
     fraktal_assert(fraktal_format_to_gl_format(channels, format, &internal_format, &data_format, &data_type) && "Invalid array format");
 
+    size_t bytes = fraktal_array_bytes_internal(channels, width, height, depth, format, 1);
+    if (!fraktal_reserve_array_bytes(bytes))
+    {
+        log_err("Failed to create array: %zu bytes would exceed the memory budget (%zu of %zu bytes in use).\n",
+                bytes, fraktal_memory.array_bytes, fraktal_memory.budget);
+        return NULL;
+    }
+
     GLenum target;
-    if (width > 1 && height > 1 && depth > 1)
+    if (depth > 1)
     {
         fraktal_assert(access == FRAKTAL_READ_ONLY && "3D arrays must be read-only.");
         target = GL_TEXTURE_3D;
     }
-    else if (width > 1 && height > 1)
+    else if (height > 1)
     {
         target = GL_TEXTURE_2D;
     }
@@ -132,18 +196,26 @@ fArray *fraktal_create_array(
     a->depth = depth;
     a->format = format;
     a->access = access;
+    a->levels = 1;
+    fraktal_track_array_bytes(format, bytes, true);
+    fraktal_memory.host_bytes += sizeof(fArray);
+    fraktal_memory.num_arrays++;
     fraktal_check_gl_error();
     return a;
 }
 
 void fraktal_destroy_array(fArray *a)
 {
+    FRAKTAL_TRACE_FUNCTION();
     if (a)
     {
         fraktal_ensure_context();
         fraktal_check_gl_error();
         glDeleteTextures(1, &a->color0);
         glDeleteFramebuffers(1, &a->fbo);
+        fraktal_track_array_bytes(a->format, fraktal_array_bytes(a), false);
+        fraktal_memory.host_bytes -= sizeof(fArray);
+        fraktal_memory.num_arrays--;
         free(a);
         fraktal_check_gl_error();
     }
@@ -151,12 +223,19 @@ void fraktal_destroy_array(fArray *a)
 
 void fraktal_zero_array(fArray *a)
 {
+    FRAKTAL_TRACE_FUNCTION();
     fraktal_assert(a);
     fraktal_assert(a->access == FRAKTAL_READ_WRITE);
     fraktal_assert(a->fbo);
     fraktal_assert(a->color0);
+    if (fraktal_recording)
+    {
+        fraktal_record_command(FRAKTAL_COMMAND_ZERO_ARRAY, a, 0, -1, -1, NULL, NULL);
+        return;
+    }
     fraktal_ensure_context();
     fraktal_check_gl_error();
+    FRAKTAL_TRACE_GPU_SCOPE("fraktal_zero_array");
     GLint last_framebuffer; glGetIntegerv(GL_FRAMEBUFFER_BINDING, &last_framebuffer);
     glBindFramebuffer(GL_FRAMEBUFFER, a->fbo);
     glClearColor(0,0,0,0);
@@ -167,6 +246,7 @@ void fraktal_zero_array(fArray *a)
 
 void fraktal_to_cpu(void *cpu_memory, fArray *a)
 {
+    FRAKTAL_TRACE_FUNCTION();
     fraktal_assert(cpu_memory);
     fraktal_assert(a);
     fraktal_assert(a->color0);
@@ -175,6 +255,7 @@ void fraktal_to_cpu(void *cpu_memory, fArray *a)
     GLenum target = a->height == 1 ? GL_TEXTURE_1D : GL_TEXTURE_2D;
     GLenum internal_format,data_format,data_type;
     fraktal_assert(fraktal_format_to_gl_format(a->channels, a->format, &internal_format, &data_format, &data_type));
+    FRAKTAL_TRACE_GPU_SCOPE("fraktal_to_cpu");
     glPixelStorei(GL_PACK_ALIGNMENT, 1);
     glBindTexture(target, a->color0);
     glGetTexImage(target, 0, data_format, data_type, cpu_memory);
@@ -184,6 +265,7 @@ void fraktal_to_cpu(void *cpu_memory, fArray *a)
 
 void fraktal_array_size(fArray *a, int *width, int *height, int *depth)
 {
+    FRAKTAL_TRACE_FUNCTION();
     if (a)
     {
         if (width) *width = a->width;
@@ -194,18 +276,35 @@ void fraktal_array_size(fArray *a, int *width, int *height, int *depth)
 
 int fraktal_array_channels(fArray *a)
 {
+    FRAKTAL_TRACE_FUNCTION();
     if (a) return a->channels;
     return 0;
 }
 
+size_t fraktal_array_bytes(fArray *a)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    if (a) return fraktal_array_bytes_internal(a->channels, a->width, a->height, a->depth, a->format, a->levels);
+    return 0;
+}
+
+int fraktal_array_levels(fArray *a)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    if (a) return a->levels;
+    return 0;
+}
+
 fEnum fraktal_array_format(fArray *a)
 {
+    FRAKTAL_TRACE_FUNCTION();
     if (a) return a->format;
     return -1;
 }
 
 bool fraktal_is_valid_array(fArray *a)
 {
+    FRAKTAL_TRACE_FUNCTION();
     return a &&
            a->width > 0 &&
            a->height > 0 &&
@@ -217,5 +316,6 @@ bool fraktal_is_valid_array(fArray *a)
 
 unsigned int fraktal_get_gl_handle(fArray *a)
 {
+    FRAKTAL_TRACE_FUNCTION();
     return a->color0;
 }
@@ -0,0 +1,466 @@
+#pragma once
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// A brick map caches the distance field of a model in a sparse set of
+// narrow-band bricks, see libf/brickmap.f. Cells are sampled on the GPU
+// with libf/grid.f and the bricks are packed into a 3D atlas on the CPU,
+// since 3D arrays cannot be rendered to.
+enum { FRAKTAL_BRICK_SIZE = 8 }; // voxels per brick side
+enum { FRAKTAL_BRICK_SAMPLES = FRAKTAL_BRICK_SIZE + 1 };
+enum { FRAKTAL_BRICK_CHUNK = 8 }; // bricks per side sampled in one pass
+enum { FRAKTAL_BRICK_CHUNK_SAMPLES = FRAKTAL_BRICK_CHUNK*FRAKTAL_BRICK_SIZE + 1 };
+enum { FRAKTAL_MAX_BRICK_MAP_RESOLUTION = 256 };
+
+// Value of a model parameter at the time the map was baked, or the
+// parameters were recorded (see fModelParams)
+struct fModelParam
+{
+    char name[FRAKTAL_MAX_PARAM_NAME_LEN + 1];
+    fParamType type;
+    float f[16];
+    int i[4];
+};
+
+struct fBrickMap
+{
+    fArray *atlas; // bricks of 9^3 distance samples
+    fArray *index; // per cell: atlas brick coordinate, or -1 and a distance bound
+    float bounds_min[3];
+    float bounds_max[3];
+    float cell_size;
+    int num_bricks;
+    bool baked;
+    int num_params;
+    fModelParam *params;
+};
+
+fBrickMap *fraktal_create_brick_map()
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fBrickMap *m = (fBrickMap*)calloc(1, sizeof(fBrickMap));
+    fraktal_assert(m && "Ran out of memory");
+    return m;
+}
+
+void fraktal_destroy_brick_map(fBrickMap *m)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    if (!m)
+        return;
+    fraktal_destroy_array(m->atlas);
+    fraktal_destroy_array(m->index);
+    free(m->params);
+    free(m);
+}
+
+void fraktal_invalidate_brick_map(fBrickMap *m)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(m);
+    m->baked = false;
+}
+
+static int fraktal_param_components(fParamType type)
+{
+    switch (type)
+    {
+        case FRAKTAL_PARAM_FLOAT:      return 1;
+        case FRAKTAL_PARAM_FLOAT_VEC2: return 2;
+        case FRAKTAL_PARAM_FLOAT_VEC3: return 3;
+        case FRAKTAL_PARAM_FLOAT_VEC4: return 4;
+        case FRAKTAL_PARAM_FLOAT_MAT2: return 4;
+        case FRAKTAL_PARAM_FLOAT_MAT3: return 9;
+        case FRAKTAL_PARAM_FLOAT_MAT4: return 16;
+        case FRAKTAL_PARAM_INT:        return 1;
+        case FRAKTAL_PARAM_INT_VEC2:   return 2;
+        case FRAKTAL_PARAM_INT_VEC3:   return 3;
+        case FRAKTAL_PARAM_INT_VEC4:   return 4;
+        default:                       return 0;
+    }
+}
+
+static bool fraktal_is_int_param(fParamType type)
+{
+    return type == FRAKTAL_PARAM_INT || type == FRAKTAL_PARAM_INT_VEC2 ||
+           type == FRAKTAL_PARAM_INT_VEC3 || type == FRAKTAL_PARAM_INT_VEC4;
+}
+
+// Model parameters are the non-array parameters of the bake kernel, except
+// for those of libf/grid.f.
+static bool fraktal_is_model_param(fKernel *f, int i)
+{
+    const char *name = f->params.name[i];
+    return f->params.offset[i] >= 0 &&
+           fraktal_param_components(f->params.type[i]) > 0 &&
+           strncmp(name, "iGrid", 5) != 0 &&
+           strcmp(name, "iTilesX") != 0;
+}
+
+static void fraktal_read_param(fKernel *f, int i, fModelParam *out)
+{
+    memset(out, 0, sizeof(fModelParam));
+    strcpy(out->name, f->params.name[i]);
+    out->type = f->params.type[i];
+    if (fraktal_is_int_param(out->type))
+        glGetUniformiv(f->program, f->params.offset[i], out->i);
+    else
+        glGetUniformfv(f->program, f->params.offset[i], out->f);
+}
+
+// Returns the values of the model parameters of 'f', and their number
+// in 'num_params'. The result must be freed.
+static fModelParam *fraktal_read_model_params(fKernel *f, int *num_params)
+{
+    *num_params = 0;
+    fModelParam *params = (fModelParam*)malloc((f->params.count > 0 ? f->params.count : 1)*sizeof(fModelParam));
+    fraktal_assert(params && "Ran out of memory");
+    for (int i = 0; i < f->params.count; i++)
+        if (fraktal_is_model_param(f, i))
+            fraktal_read_param(f, i, &params[(*num_params)++]);
+    return params;
+}
+
+// Checks that the parameters of 'f' that share a name with a recorded
+// model parameter still have the recorded values.
+static bool fraktal_model_params_match_kernel(const fModelParam *params, int num_params, fKernel *f)
+{
+    for (int j = 0; j < num_params; j++)
+    {
+        const fModelParam *baked = &params[j];
+        for (int i = 0; i < f->params.count; i++)
+        {
+            if (strcmp(f->params.name[i], baked->name) != 0 || f->params.offset[i] < 0)
+                continue;
+            if (f->params.type[i] != baked->type)
+                return false;
+            fModelParam current;
+            fraktal_read_param(f, i, &current);
+            if (memcmp(current.f, baked->f, sizeof(current.f)) != 0 ||
+                memcmp(current.i, baked->i, sizeof(current.i)) != 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+static bool fraktal_brick_map_matches(fBrickMap *m, fKernel *f)
+{
+    return m->baked && fraktal_model_params_match_kernel(m->params, m->num_params, f);
+}
+
+bool fraktal_is_brick_map_current(fBrickMap *m)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(m);
+    fraktal_assert(fraktal_current_kernel && "Call fraktal_use_kernel first.");
+    fraktal_assert(!fraktal_recording && "Brick map queries cannot be recorded in a command list.");
+    fraktal_ensure_context();
+    return fraktal_brick_map_matches(m, fraktal_current_kernel);
+}
+
+// 3D arrays use nearest filtering by default; the atlas is interpolated.
+static void fraktal_set_linear_filter_3d(fArray *a)
+{
+    GLint last_texture; glGetIntegerv(GL_TEXTURE_BINDING_3D, &last_texture);
+    glBindTexture(GL_TEXTURE_3D, a->color0);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_3D, last_texture);
+}
+
+bool fraktal_bake_brick_map(fBrickMap *m, const float bounds_min[3], const float bounds_max[3], int resolution)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(m);
+    fraktal_assert(fraktal_current_kernel && "Call fraktal_use_kernel first.");
+    fraktal_assert(bounds_min && bounds_max);
+    fraktal_assert(bounds_min[0] < bounds_max[0] && bounds_min[1] < bounds_max[1] && bounds_min[2] < bounds_max[2]);
+    fraktal_assert(resolution > 0 && resolution <= FRAKTAL_MAX_BRICK_MAP_RESOLUTION);
+    fraktal_assert(!fraktal_recording && "Brick map baking cannot be recorded in a command list.");
+
+    fKernel *f = fraktal_current_kernel;
+    int loc_origin = fraktal_get_param_offset(f, "iGridOrigin");
+    int loc_spacing = fraktal_get_param_offset(f, "iGridSpacing");
+    int loc_size = fraktal_get_param_offset(f, "iGridSize");
+    int loc_tiles_x = fraktal_get_param_offset(f, "iTilesX");
+    if (loc_origin < 0 || loc_spacing < 0 || loc_size < 0 || loc_tiles_x < 0)
+    {
+        log_err("Failed to bake brick map: the current kernel must be linked with libf/grid.f.\n");
+        return false;
+    }
+
+    // Cells are cubes; 'resolution' is the number of cells along the
+    // longest side of the bounds. The index needs a depth of at least 2
+    // to be a 3D array.
+    float extent = 0.0f;
+    for (int k = 0; k < 3; k++)
+        if (bounds_max[k] - bounds_min[k] > extent)
+            extent = bounds_max[k] - bounds_min[k];
+    float cell_size = extent/resolution;
+    int cells[3];
+    int max_cells = 0;
+    for (int k = 0; k < 3; k++)
+    {
+        cells[k] = (int)ceil((bounds_max[k] - bounds_min[k])/cell_size - 1e-3f);
+        if (cells[k] < 1) cells[k] = 1;
+    }
+    if (cells[2] < 2) cells[2] = 2;
+    for (int k = 0; k < 3; k++)
+        if (cells[k] > max_cells) max_cells = cells[k];
+    int num_cells = cells[0]*cells[1]*cells[2];
+
+    fArray *coarse_array = fraktal_create_grid_tiles(max_cells);
+    fArray *chunk_array = fraktal_create_grid_tiles(FRAKTAL_BRICK_CHUNK_SAMPLES);
+    if (!coarse_array || !chunk_array)
+    {
+        log_err("Failed to bake brick map: could not create sample arrays.\n");
+        fraktal_destroy_array(coarse_array);
+        fraktal_destroy_array(chunk_array);
+        return false;
+    }
+
+    // Coarse pass: the distance at the center of each cell. A cell can only
+    // contain the surface if the distance is within its half-diagonal, and
+    // otherwise the distance anywhere in the cell is at least the
+    // difference between the two.
+    float *coarse = (float*)malloc(max_cells*max_cells*max_cells*sizeof(float));
+    float *coarse_texels = (float*)malloc(coarse_array->width*coarse_array->height*sizeof(float));
+    float *index = (float*)malloc(4*num_cells*sizeof(float));
+    int *brick_of_cell = (int*)malloc(num_cells*sizeof(int));
+    fraktal_assert(coarse && coarse_texels && index && brick_of_cell && "Ran out of memory");
+    {
+        float origin[3];
+        for (int k = 0; k < 3; k++)
+            origin[k] = bounds_min[k] + 0.5f*cell_size;
+        fraktal_sample_grid(coarse_array, coarse_texels, coarse, max_cells, origin, cell_size,
+                            loc_origin, loc_spacing, loc_size, loc_tiles_x);
+    }
+    float half_diagonal = 0.5f*sqrtf(3.0f)*cell_size;
+    int num_bricks = 0;
+    for (int z = 0; z < cells[2]; z++)
+    for (int y = 0; y < cells[1]; y++)
+    for (int x = 0; x < cells[0]; x++)
+    {
+        int cell = (z*cells[1] + y)*cells[0] + x;
+        float d = coarse[(z*max_cells + y)*max_cells + x];
+        if (fabsf(d) > half_diagonal)
+        {
+            brick_of_cell[cell] = -1;
+            index[4*cell + 0] = -1.0f;
+            index[4*cell + 1] = -1.0f;
+            index[4*cell + 2] = -1.0f;
+            index[4*cell + 3] = d > 0.0f ? d - half_diagonal : d + half_diagonal;
+        }
+        else
+        {
+            brick_of_cell[cell] = num_bricks++;
+        }
+    }
+    free(coarse);
+    free(coarse_texels);
+
+    // Pack the bricks into a 3D atlas that fits the texture size limit
+    GLint max_size; glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+    int per_axis = max_size/FRAKTAL_BRICK_SAMPLES;
+    int bricks_x = num_bricks < per_axis ? (num_bricks > 0 ? num_bricks : 1) : per_axis;
+    int bricks_y = (num_bricks + bricks_x - 1)/bricks_x;
+    if (bricks_y > per_axis) bricks_y = per_axis;
+    if (bricks_y < 1) bricks_y = 1;
+    int bricks_z = (num_bricks + bricks_x*bricks_y - 1)/(bricks_x*bricks_y);
+    if (bricks_z < 2) bricks_z = 2;
+    if (bricks_z > per_axis)
+    {
+        log_err("Failed to bake brick map: %d bricks do not fit in a 3D array; reduce the resolution.\n", num_bricks);
+        free(index);
+        free(brick_of_cell);
+        fraktal_destroy_array(coarse_array);
+        fraktal_destroy_array(chunk_array);
+        return false;
+    }
+    int atlas_width = bricks_x*FRAKTAL_BRICK_SAMPLES;
+    int atlas_height = bricks_y*FRAKTAL_BRICK_SAMPLES;
+    int atlas_depth = bricks_z*FRAKTAL_BRICK_SAMPLES;
+    float *atlas = (float*)calloc((size_t)atlas_width*atlas_height*atlas_depth, sizeof(float));
+    fraktal_assert(atlas && "Ran out of memory");
+
+    // Fine pass: sample the bricks in chunks of FRAKTAL_BRICK_CHUNK^3 cells
+    const int S = FRAKTAL_BRICK_CHUNK_SAMPLES;
+    const int B = FRAKTAL_BRICK_SAMPLES;
+    float *texels = (float*)malloc(chunk_array->width*chunk_array->height*sizeof(float));
+    float *samples = (float*)malloc(S*S*S*sizeof(float));
+    fraktal_assert(texels && samples && "Ran out of memory");
+    int chunks[3];
+    for (int k = 0; k < 3; k++)
+        chunks[k] = (cells[k] + FRAKTAL_BRICK_CHUNK - 1)/FRAKTAL_BRICK_CHUNK;
+    for (int cz = 0; cz < chunks[2]; cz++)
+    for (int cy = 0; cy < chunks[1]; cy++)
+    for (int cx = 0; cx < chunks[0]; cx++)
+    {
+        int c0[3] = { cx*FRAKTAL_BRICK_CHUNK, cy*FRAKTAL_BRICK_CHUNK, cz*FRAKTAL_BRICK_CHUNK };
+        int c1[3];
+        for (int k = 0; k < 3; k++)
+            c1[k] = c0[k] + FRAKTAL_BRICK_CHUNK < cells[k] ? c0[k] + FRAKTAL_BRICK_CHUNK : cells[k];
+
+        bool any_bricks = false;
+        for (int z = c0[2]; z < c1[2] && !any_bricks; z++)
+        for (int y = c0[1]; y < c1[1] && !any_bricks; y++)
+        for (int x = c0[0]; x < c1[0] && !any_bricks; x++)
+            any_bricks = brick_of_cell[(z*cells[1] + y)*cells[0] + x] >= 0;
+        if (!any_bricks)
+            continue;
+
+        float origin[3];
+        for (int k = 0; k < 3; k++)
+            origin[k] = bounds_min[k] + cell_size*c0[k];
+        fraktal_sample_grid(chunk_array, texels, samples, S, origin, cell_size/FRAKTAL_BRICK_SIZE,
+                            loc_origin, loc_spacing, loc_size, loc_tiles_x);
+
+        for (int z = c0[2]; z < c1[2]; z++)
+        for (int y = c0[1]; y < c1[1]; y++)
+        for (int x = c0[0]; x < c1[0]; x++)
+        {
+            int cell = (z*cells[1] + y)*cells[0] + x;
+            int brick = brick_of_cell[cell];
+            if (brick < 0)
+                continue;
+            int bx = brick % bricks_x;
+            int by = (brick / bricks_x) % bricks_y;
+            int bz = brick / (bricks_x*bricks_y);
+            index[4*cell + 0] = (float)bx;
+            index[4*cell + 1] = (float)by;
+            index[4*cell + 2] = (float)bz;
+            index[4*cell + 3] = 0.0f;
+
+            int sx = (x - c0[0])*FRAKTAL_BRICK_SIZE;
+            int sy = (y - c0[1])*FRAKTAL_BRICK_SIZE;
+            int sz = (z - c0[2])*FRAKTAL_BRICK_SIZE;
+            for (int k = 0; k < B; k++)
+            for (int j = 0; j < B; j++)
+            {
+                float *dst = atlas + ((size_t)(bz*B + k)*atlas_height + by*B + j)*atlas_width + bx*B;
+                const float *src = samples + ((sz + k)*S + sy + j)*S + sx;
+                memcpy(dst, src, B*sizeof(float));
+            }
+        }
+    }
+    free(texels);
+    free(samples);
+    free(brick_of_cell);
+    fraktal_destroy_array(coarse_array);
+    fraktal_destroy_array(chunk_array);
+
+    fArray *atlas_array = fraktal_create_array(atlas, 1, atlas_width, atlas_height, atlas_depth, FRAKTAL_FLOAT, FRAKTAL_READ_ONLY);
+    fArray *index_array = fraktal_create_array(index, 4, cells[0], cells[1], cells[2], FRAKTAL_FLOAT, FRAKTAL_READ_ONLY);
+    free(atlas);
+    free(index);
+    if (!atlas_array || !index_array)
+    {
+        log_err("Failed to bake brick map: could not create atlas.\n");
+        fraktal_destroy_array(atlas_array);
+        fraktal_destroy_array(index_array);
+        return false;
+    }
+    fraktal_set_linear_filter_3d(atlas_array);
+
+    // Remember the model parameters so that changes can be detected
+    int num_params;
+    fModelParam *params = fraktal_read_model_params(f, &num_params);
+
+    fraktal_destroy_array(m->atlas);
+    fraktal_destroy_array(m->index);
+    free(m->params);
+    m->atlas = atlas_array;
+    m->index = index_array;
+    m->params = params;
+    m->num_params = num_params;
+    m->num_bricks = num_bricks;
+    m->cell_size = cell_size;
+    for (int k = 0; k < 3; k++)
+    {
+        m->bounds_min[k] = bounds_min[k];
+        m->bounds_max[k] = bounds_min[k] + cell_size*cells[k];
+    }
+    m->baked = true;
+    fraktal_check_gl_error();
+    return true;
+}
+
+void fraktal_param_brick_map(fBrickMap *m)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(fraktal_current_kernel && "Call fraktal_use_kernel first.");
+    fKernel *f = fraktal_current_kernel;
+    int loc_enabled = fraktal_get_param_offset(f, "iBrickMapEnabled");
+    if (!m || !m->baked || (!fraktal_recording && !fraktal_brick_map_matches(m, f)))
+    {
+        fraktal_param_1i(loc_enabled, 0);
+        return;
+    }
+    float voxel_size = m->cell_size/FRAKTAL_BRICK_SIZE;
+    fraktal_param_1i(loc_enabled, 1);
+    fraktal_param_array(fraktal_get_param_offset(f, "iBrickAtlas"), m->atlas);
+    fraktal_param_array(fraktal_get_param_offset(f, "iBrickIndex"), m->index);
+    fraktal_param_3f(fraktal_get_param_offset(f, "iBrickBoundsMin"), m->bounds_min[0], m->bounds_min[1], m->bounds_min[2]);
+    fraktal_param_3f(fraktal_get_param_offset(f, "iBrickBoundsMax"), m->bounds_max[0], m->bounds_max[1], m->bounds_max[2]);
+    fraktal_param_1f(fraktal_get_param_offset(f, "iBrickCellSize"), m->cell_size);
+    fraktal_param_1f(fraktal_get_param_offset(f, "iBrickErrorBound"), sqrtf(3.0f)*voxel_size);
+    fraktal_param_1f(fraktal_get_param_offset(f, "iBrickExactDistance"), voxel_size);
+}
+
+// Values of the model parameters of a kernel, for results that are derived
+// from the model outside a brick map (e.g. fraktal_estimate_bounds)
+struct fModelParams
+{
+    bool recorded;
+    int num_params;
+    fModelParam *params;
+};
+
+fModelParams *fraktal_create_model_params()
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fModelParams *p = (fModelParams*)calloc(1, sizeof(fModelParams));
+    fraktal_assert(p && "Ran out of memory");
+    return p;
+}
+
+void fraktal_destroy_model_params(fModelParams *p)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    if (!p)
+        return;
+    free(p->params);
+    free(p);
+}
+
+void fraktal_record_model_params(fModelParams *p)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(p);
+    fraktal_assert(fraktal_current_kernel && "Call fraktal_use_kernel first.");
+    fraktal_assert(!fraktal_recording && "Model parameters cannot be recorded in a command list.");
+    fraktal_ensure_context();
+    free(p->params);
+    p->params = fraktal_read_model_params(fraktal_current_kernel, &p->num_params);
+    p->recorded = true;
+    fraktal_check_gl_error();
+}
+
+void fraktal_invalidate_model_params(fModelParams *p)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(p);
+    p->recorded = false;
+}
+
+bool fraktal_model_params_match(fModelParams *p)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(p);
+    fraktal_assert(fraktal_current_kernel && "Call fraktal_use_kernel first.");
+    fraktal_assert(!fraktal_recording && "Model parameters cannot be compared in a command list.");
+    fraktal_ensure_context();
+    return p->recorded && fraktal_model_params_match_kernel(p->params, p->num_params, fraktal_current_kernel);
+}
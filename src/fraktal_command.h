@@ -0,0 +1,168 @@
+#pragma once
+#include <stdlib.h>
+#include <string.h>
+#include "reuse/log.h"
+
+struct fCommandList
+{
+    fCommand *commands;
+    int count;
+    int capacity;
+    GLuint vao; // created on first replay, owned by the list
+};
+
+static void fraktal_record_command(fCommandType type, fArray *array, fParamType param_type, int offset, int tex_unit, const float *f, const int *i)
+{
+    fCommandList *list = fraktal_recording;
+    fraktal_assert(list);
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity ? 2*list->capacity : 64;
+        fCommand *commands = (fCommand*)realloc(list->commands, capacity*sizeof(fCommand));
+        fraktal_assert(commands && "Ran out of memory");
+        fraktal_memory.host_bytes += (capacity - list->capacity)*sizeof(fCommand);
+        list->commands = commands;
+        list->capacity = capacity;
+    }
+    fCommand *c = &list->commands[list->count++];
+    memset(c, 0, sizeof(fCommand));
+    c->type = type;
+    c->kernel = fraktal_current_kernel;
+    c->array = array;
+    c->param_type = param_type;
+    c->offset = offset;
+    c->tex_unit = tex_unit;
+    if (f) memcpy(c->f, f, (param_type == FRAKTAL_PARAM_FLOAT_MAT4 ? 16 : 4)*sizeof(float));
+    if (i) memcpy(c->i, i, 4*sizeof(int));
+}
+
+fCommandList *fraktal_create_command_list()
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fCommandList *list = (fCommandList*)calloc(1, sizeof(fCommandList));
+    fraktal_assert(list && "Ran out of memory");
+    fraktal_memory.host_bytes += sizeof(fCommandList);
+    fraktal_memory.num_command_lists++;
+    return list;
+}
+
+void fraktal_destroy_command_list(fCommandList *list)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    if (list)
+    {
+        fraktal_assert(fraktal_recording != list && "Cannot destroy a command list while it is being recorded.");
+        if (list->vao)
+        {
+            fraktal_ensure_context();
+            glDeleteVertexArrays(1, &list->vao);
+        }
+        fraktal_memory.host_bytes -= sizeof(fCommandList) + list->capacity*sizeof(fCommand);
+        fraktal_memory.num_command_lists--;
+        free(list->commands);
+        free(list);
+    }
+}
+
+void fraktal_begin_command_list(fCommandList *list)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(list);
+    fraktal_assert(!fraktal_recording && "Already recording a command list.");
+    fraktal_assert(!fraktal_current_kernel && "Call fraktal_use_kernel(NULL) before recording.");
+    list->count = 0;
+    fraktal_recording = list;
+}
+
+void fraktal_end_command_list()
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(fraktal_recording && "Call fraktal_begin_command_list first.");
+    fraktal_recording = NULL;
+    fraktal_current_kernel = NULL;
+}
+
+static fCommandPatch *fraktal_find_patch(fCommand *c, fCommandPatch *patches, int num_patches)
+{
+    for (int i = 0; i < num_patches; i++)
+        if (patches[i].kernel == c->kernel && patches[i].offset == c->offset)
+            return &patches[i];
+    return NULL;
+}
+
+void fraktal_run_command_list(fCommandList *list, fCommandPatch *patches, int num_patches)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(list);
+    fraktal_assert(!fraktal_recording && "Cannot run a command list while recording.");
+    fraktal_assert(!fraktal_current_kernel && "Call fraktal_use_kernel(NULL) before running a command list.");
+    fraktal_assert(num_patches == 0 || patches);
+    fraktal_ensure_context();
+    fraktal_check_gl_error();
+
+    FRAKTAL_TRACE_GPU_SCOPE("fraktal_run_command_list");
+    if (!list->vao)
+        glGenVertexArrays(1, &list->vao);
+    glBindVertexArray(list->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, fraktal_get_quad_buffer());
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_COLOR_LOGIC_OP);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glBlendEquation(GL_FUNC_ADD);
+
+    for (int i = 0; i < list->count; i++)
+    {
+        fCommand *c = &list->commands[i];
+        if (c->type == FRAKTAL_COMMAND_USE_KERNEL)
+        {
+            if (c->kernel)
+            {
+                glUseProgram(c->kernel->program);
+                glEnableVertexAttribArray(c->kernel->loc_iPosition);
+                glVertexAttribPointer(c->kernel->loc_iPosition, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 2, 0);
+            }
+        }
+        else if (c->type == FRAKTAL_COMMAND_PARAM)
+        {
+            fCommandPatch *patch = fraktal_find_patch(c, patches, num_patches);
+            if (patch)
+                fraktal_apply_param(c->param_type, c->offset, patch->f, patch->i);
+            else
+                fraktal_apply_param(c->param_type, c->offset, c->f, c->i);
+        }
+        else if (c->type == FRAKTAL_COMMAND_PARAM_ARRAY)
+        {
+            fCommandPatch *patch = fraktal_find_patch(c, patches, num_patches);
+            fArray *a = (patch && patch->array) ? patch->array : c->array;
+            glUniform1i(c->offset, c->tex_unit);
+            fraktal_bind_array(c->tex_unit, a);
+        }
+        else if (c->type == FRAKTAL_COMMAND_ZERO_ARRAY)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, c->array->fbo);
+            glClearColor(0,0,0,0);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+        else if (c->type == FRAKTAL_COMMAND_RUN_KERNEL)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, c->array->fbo);
+            glViewport(0, 0, c->array->width, c->array->height);
+            if (c->i[0] == 1)
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+            else
+                glDrawArraysInstanced(GL_TRIANGLES, 0, 6, c->i[0]);
+        }
+    }
+
+    // Reset to defaults (the previous state is not queried)
+    glUseProgram(0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDisable(GL_BLEND);
+    glActiveTexture(GL_TEXTURE0);
+    fraktal_check_gl_error();
+}
@@ -21,6 +21,7 @@ static const char *fraktal_glsl_version = "#version 150";
 
 bool fraktal_create_context()
 {
+    FRAKTAL_TRACE_FUNCTION();
     fraktal_assert(!fraktal_context && "A context already exists.");
     glfwSetErrorCallback(fraktal_glfw_error_callback);
     if (!glfwInit())
@@ -48,6 +49,7 @@ bool fraktal_create_context()
 
 void fraktal_destroy_context()
 {
+    FRAKTAL_TRACE_FUNCTION();
     if (fraktal_context)
         glfwDestroyWindow(fraktal_context);
     fraktal_context = NULL;
@@ -55,12 +57,14 @@ void fraktal_destroy_context()
 
 void fraktal_push_current_context()
 {
+    FRAKTAL_TRACE_FUNCTION();
     if (fraktal_context)
         glfwMakeContextCurrent(fraktal_context);
 }
 
 void fraktal_pop_current_context()
 {
+    FRAKTAL_TRACE_FUNCTION();
     if (fraktal_context)
         glfwMakeContextCurrent(NULL);
 }
@@ -0,0 +1,146 @@
+#pragma once
+#include <string.h>
+#include "reuse/log.h"
+
+static const char *fraktal_copy_source =
+    "uniform sampler1D iSource1D;\n"
+    "uniform sampler2D iSource2D;\n"
+    "uniform int       iSourceIs1D;\n"
+    "uniform ivec2     iOffset;\n"
+    "uniform mat4      iSwizzle;\n"
+    "uniform vec4      iConstant;\n"
+    "out vec4          fragColor;\n"
+    "void main()\n"
+    "{\n"
+    "    ivec2 p = ivec2(gl_FragCoord.xy) + iOffset;\n"
+    "    vec4 v;\n"
+    "    if (iSourceIs1D == 1) v = texelFetch(iSource1D, p.x, 0);\n"
+    "    else                  v = texelFetch(iSource2D, p, 0);\n"
+    "    fragColor = iSwizzle*v + iConstant;\n"
+    "}\n";
+
+// Parses a swizzle string into a matrix that selects source components
+// and a vector of constants. Returns false if the swizzle is invalid.
+static bool fraktal_parse_swizzle(const char *swizzle, float m[4*4], float c[4], bool *is_identity)
+{
+    for (int i = 0; i < 4*4; i++) m[i] = 0.0f;
+    for (int i = 0; i < 4; i++) c[i] = 0.0f;
+    *is_identity = true;
+    size_t len = swizzle ? strlen(swizzle) : 0;
+    if (len > 4)
+        return false;
+    for (int k = 0; k < 4; k++)
+    {
+        char s = k < (int)len ? swizzle[k] : "rgba"[k];
+        int j = -1;
+        if      (s == 'r' || s == 'x') j = 0;
+        else if (s == 'g' || s == 'y') j = 1;
+        else if (s == 'b' || s == 'z') j = 2;
+        else if (s == 'a' || s == 'w') j = 3;
+        else if (s == '0') c[k] = 0.0f;
+        else if (s == '1') c[k] = 1.0f;
+        else return false;
+        if (j >= 0)
+            m[k + 4*j] = 1.0f; // column major
+        if (j != k)
+            *is_identity = false;
+    }
+    return true;
+}
+
+void fraktal_copy_array(fArray *dst, fArray *src, const int *src_rect, const int *dst_xy, const char *swizzle)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(fraktal_is_valid_array(dst));
+    fraktal_assert(fraktal_is_valid_array(src));
+    fraktal_assert(dst != src && "Source and destination must be different arrays.");
+    fraktal_assert(dst->access == FRAKTAL_READ_WRITE && "The destination array's access mode cannot be read-only.");
+    fraktal_assert(src->depth == 1 && dst->depth == 1 && "Arrays must be 1D or 2D.");
+    fraktal_assert(!fraktal_current_kernel && "Call fraktal_use_kernel(NULL) before copying arrays.");
+    fraktal_assert(!fraktal_recording && "Copies cannot be recorded in a command list.");
+
+    int sx = 0, sy = 0, w = src->width, h = src->height;
+    if (src_rect)
+    {
+        sx = src_rect[0];
+        sy = src_rect[1];
+        w = src_rect[2];
+        h = src_rect[3];
+    }
+    int dx = dst_xy ? dst_xy[0] : 0;
+    int dy = dst_xy ? dst_xy[1] : 0;
+    fraktal_assert(sx >= 0 && sy >= 0 && w > 0 && h > 0);
+    fraktal_assert(sx + w <= src->width && sy + h <= src->height && "Source region is out of bounds.");
+    fraktal_assert(dx >= 0 && dy >= 0);
+    fraktal_assert(dx + w <= dst->width && dy + h <= dst->height && "Destination region is out of bounds.");
+
+    float m[4*4], c[4];
+    bool is_identity;
+    if (!fraktal_parse_swizzle(swizzle, m, c, &is_identity))
+    {
+        log_err("Failed to copy array: invalid swizzle '%s'.\n", swizzle);
+        return;
+    }
+
+    fraktal_ensure_context();
+    fraktal_check_gl_error();
+    FRAKTAL_TRACE_GPU_SCOPE("fraktal_copy_array");
+
+    // If no conversion is needed the copy is done by the driver directly
+    // from the source framebuffer.
+    if (is_identity && src->fbo && src->format == dst->format && src->channels == dst->channels)
+    {
+        GLint last_read_framebuffer; glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &last_read_framebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, src->fbo);
+        if (dst->height == 1)
+        {
+            GLint last_texture; glGetIntegerv(GL_TEXTURE_BINDING_1D, &last_texture);
+            glBindTexture(GL_TEXTURE_1D, dst->color0);
+            glCopyTexSubImage1D(GL_TEXTURE_1D, 0, dx, sx, sy, w);
+            glBindTexture(GL_TEXTURE_1D, last_texture);
+        }
+        else
+        {
+            GLint last_texture; glGetIntegerv(GL_TEXTURE_BINDING_2D, &last_texture);
+            glBindTexture(GL_TEXTURE_2D, dst->color0);
+            glCopyTexSubImage2D(GL_TEXTURE_2D, 0, dx, dy, sx, sy, w, h);
+            glBindTexture(GL_TEXTURE_2D, last_texture);
+        }
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, last_read_framebuffer);
+        fraktal_check_gl_error();
+        return;
+    }
+
+    static fKernel *copy = NULL;
+    static int loc_iSource1D, loc_iSource2D, loc_iSourceIs1D;
+    static int loc_iOffset, loc_iSwizzle, loc_iConstant;
+    if (!copy)
+    {
+        copy = fraktal_link_builtin("built-in copy kernel", fraktal_copy_source);
+        loc_iSource1D = fraktal_get_param_offset(copy, "iSource1D");
+        loc_iSource2D = fraktal_get_param_offset(copy, "iSource2D");
+        loc_iSourceIs1D = fraktal_get_param_offset(copy, "iSourceIs1D");
+        loc_iOffset = fraktal_get_param_offset(copy, "iOffset");
+        loc_iSwizzle = fraktal_get_param_offset(copy, "iSwizzle");
+        loc_iConstant = fraktal_get_param_offset(copy, "iConstant");
+    }
+
+    fraktal_use_kernel(copy);
+    if (src->height == 1)
+        fraktal_param_array(loc_iSource1D, src);
+    else
+        fraktal_param_array(loc_iSource2D, src);
+    fraktal_param_1i(loc_iSourceIs1D, src->height == 1 ? 1 : 0);
+    fraktal_param_2i(loc_iOffset, sx - dx, sy - dy);
+    fraktal_param_matrix4f(loc_iSwizzle, m);
+    fraktal_param_4f(loc_iConstant, c[0], c[1], c[2], c[3]);
+
+    // Unlike fraktal_run_kernel the copy overwrites the destination
+    // region and leaves the rest of the array untouched.
+    glBindFramebuffer(GL_FRAMEBUFFER, dst->fbo);
+    glViewport(dx, dy, w, h);
+    glDisable(GL_BLEND);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    fraktal_use_kernel(NULL);
+    fraktal_check_gl_error();
+}
@@ -0,0 +1,146 @@
+#pragma once
+#include <math.h>
+
+// The CPU evaluator is compiled once per instruction set by including
+// fraktal_cpu_impl.h with different widths and target attributes, and
+// the widest one supported by the running CPU is picked on first use.
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define FRAKTAL_CPU_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__clang__)
+#define FRAKTAL_CPU_TARGET_BEGIN(isa) _Pragma(isa)
+#define FRAKTAL_CPU_TARGET_END() _Pragma("clang attribute pop")
+#define FRAKTAL_CPU_SSE41  "clang attribute push (__attribute__((target(\"sse4.1\"))), apply_to = function)"
+#define FRAKTAL_CPU_AVX2   "clang attribute push (__attribute__((target(\"avx2\"))), apply_to = function)"
+#define FRAKTAL_CPU_AVX512 "clang attribute push (__attribute__((target(\"avx512f\"))), apply_to = function)"
+#elif defined(__GNUC__)
+// GCC 12 gives false -Wmaybe-uninitialized warnings inside its AVX-512 headers
+#define FRAKTAL_CPU_TARGET_BEGIN(isa) _Pragma("GCC push_options") _Pragma(isa) \
+    _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wmaybe-uninitialized\"")
+#define FRAKTAL_CPU_TARGET_END() _Pragma("GCC diagnostic pop") _Pragma("GCC pop_options")
+#define FRAKTAL_CPU_SSE41  "GCC target(\"sse4.1\")"
+#define FRAKTAL_CPU_AVX2   "GCC target(\"avx2\")"
+#define FRAKTAL_CPU_AVX512 "GCC target(\"avx512f\")"
+#else
+// MSVC accepts intrinsics of any instruction set without target flags
+#define FRAKTAL_CPU_TARGET_BEGIN(isa)
+#define FRAKTAL_CPU_TARGET_END()
+#endif
+
+#define FRAKTAL_CPU_NAMESPACE fraktal_cpu_scalar
+#define FRAKTAL_CPU_WIDTH 1
+#include "fraktal_cpu_impl.h"
+#undef FRAKTAL_CPU_NAMESPACE
+#undef FRAKTAL_CPU_WIDTH
+
+#ifdef FRAKTAL_CPU_X86
+FRAKTAL_CPU_TARGET_BEGIN(FRAKTAL_CPU_SSE41)
+#define FRAKTAL_CPU_NAMESPACE fraktal_cpu_sse41
+#define FRAKTAL_CPU_WIDTH 4
+#include "fraktal_cpu_impl.h"
+#undef FRAKTAL_CPU_NAMESPACE
+#undef FRAKTAL_CPU_WIDTH
+FRAKTAL_CPU_TARGET_END()
+
+FRAKTAL_CPU_TARGET_BEGIN(FRAKTAL_CPU_AVX2)
+#define FRAKTAL_CPU_NAMESPACE fraktal_cpu_avx2
+#define FRAKTAL_CPU_WIDTH 8
+#include "fraktal_cpu_impl.h"
+#undef FRAKTAL_CPU_NAMESPACE
+#undef FRAKTAL_CPU_WIDTH
+FRAKTAL_CPU_TARGET_END()
+
+FRAKTAL_CPU_TARGET_BEGIN(FRAKTAL_CPU_AVX512)
+#define FRAKTAL_CPU_NAMESPACE fraktal_cpu_avx512
+#define FRAKTAL_CPU_WIDTH 16
+#include "fraktal_cpu_impl.h"
+#undef FRAKTAL_CPU_NAMESPACE
+#undef FRAKTAL_CPU_WIDTH
+FRAKTAL_CPU_TARGET_END()
+#endif
+
+typedef void (*fCpuEvalFunc)(float *distances, const float *points, int count, const fInstruction *code, int num_instructions);
+
+struct fCpuBackend
+{
+    const char *isa;
+    fCpuEvalFunc eval;
+};
+
+static fCpuBackend fraktal_cpu_select()
+{
+    fCpuBackend backend = { "scalar", fraktal_cpu_scalar::eval };
+    #if defined(FRAKTAL_CPU_X86) && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool avx_os = (xcr0 & 0x06) == 0x06;
+    bool avx512_os = (xcr0 & 0xe6) == 0xe6;
+    bool avx2 = false, avx512 = false;
+    if (max_leaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = avx_os && (info[1] & (1 << 5)) != 0;
+        avx512 = avx512_os && (info[1] & (1 << 16)) != 0;
+    }
+    #elif defined(FRAKTAL_CPU_X86)
+    __builtin_cpu_init();
+    bool sse41 = __builtin_cpu_supports("sse4.1") != 0;
+    bool avx2 = __builtin_cpu_supports("avx2") != 0;
+    bool avx512 = __builtin_cpu_supports("avx512f") != 0;
+    #endif
+
+    #ifdef FRAKTAL_CPU_X86
+    if (avx512)     { backend.isa = "avx512"; backend.eval = fraktal_cpu_avx512::eval; }
+    else if (avx2)  { backend.isa = "avx2";   backend.eval = fraktal_cpu_avx2::eval; }
+    else if (sse41) { backend.isa = "sse4.1"; backend.eval = fraktal_cpu_sse41::eval; }
+    #endif
+    return backend;
+}
+
+static fCpuBackend fraktal_cpu_backend()
+{
+    static fCpuBackend backend = fraktal_cpu_select();
+    return backend;
+}
+
+// Checks that register indices are in range, since out of range indices
+// would read or write outside the register files on the CPU.
+static void fraktal_assert_valid_program(const fInstruction *code, int num_instructions)
+{
+    fraktal_assert(code);
+    fraktal_assert(num_instructions > 0);
+    for (int i = 0; i < num_instructions && code[i].op != FRAKTAL_OP_END; i++)
+    {
+        int op = (int)code[i].op;
+        int max_a = op < FRAKTAL_OP_UNION ? (int)fraktal_cpu_scalar::NUM_POINT_REGISTERS : (int)fraktal_cpu_scalar::NUM_DISTANCE_REGISTERS;
+        int max_dst = op < FRAKTAL_OP_SPHERE ? (int)fraktal_cpu_scalar::NUM_POINT_REGISTERS : (int)fraktal_cpu_scalar::NUM_DISTANCE_REGISTERS;
+        fraktal_assert(code[i].dst >= 0 && (int)code[i].dst < max_dst && "Register index out of range.");
+        fraktal_assert(code[i].a >= 0 && (int)code[i].a < max_a && "Register index out of range.");
+        fraktal_assert(code[i].b >= 0 && (int)code[i].b < max_a && "Register index out of range.");
+    }
+}
+
+void fraktal_cpu_eval(float *distances, const float *points, int count, const fInstruction *code, int num_instructions)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(distances);
+    fraktal_assert(points);
+    fraktal_assert(count >= 0);
+    fraktal_assert_valid_program(code, num_instructions);
+    fraktal_cpu_backend().eval(distances, points, count, code, num_instructions);
+}
+
+const char *fraktal_cpu_isa()
+{
+    return fraktal_cpu_backend().isa;
+}
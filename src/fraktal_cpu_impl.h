@@ -0,0 +1,400 @@
+// This file is included once per instruction set by fraktal_cpu.h, with
+// FRAKTAL_CPU_NAMESPACE and FRAKTAL_CPU_WIDTH defined. Each inclusion is
+// compiled for its own target, so only one of them runs on a given CPU.
+//
+// The functions below mirror libf/hg_sdf.f and libf/interpreter.f, using
+// the same formulas in the same order so that CPU and GPU results agree
+// up to floating point rounding. Each operation works on a pack of
+// FRAKTAL_CPU_WIDTH points at once.
+
+namespace FRAKTAL_CPU_NAMESPACE {
+
+//-----------------------------------------------------------------------------
+// Packs of floats and comparison masks
+//-----------------------------------------------------------------------------
+
+#if FRAKTAL_CPU_WIDTH == 1
+struct F { float v; };
+struct M { bool v; };
+static inline F set1(float x)              { F r; r.v = x; return r; }
+static inline F load(const float *p)       { F r; r.v = *p; return r; }
+static inline void store(float *p, F a)    { *p = a.v; }
+static inline F operator+(F a, F b)        { F r; r.v = a.v + b.v; return r; }
+static inline F operator-(F a, F b)        { F r; r.v = a.v - b.v; return r; }
+static inline F operator*(F a, F b)        { F r; r.v = a.v * b.v; return r; }
+static inline F operator/(F a, F b)        { F r; r.v = a.v / b.v; return r; }
+static inline F min(F a, F b)              { F r; r.v = a.v < b.v ? a.v : b.v; return r; }
+static inline F max(F a, F b)              { F r; r.v = a.v > b.v ? a.v : b.v; return r; }
+static inline F sqrt(F a)                  { F r; r.v = sqrtf(a.v); return r; }
+static inline F floor(F a)                 { F r; r.v = floorf(a.v); return r; }
+static inline F abs(F a)                   { F r; r.v = fabsf(a.v); return r; }
+static inline M operator<(F a, F b)        { M r; r.v = a.v < b.v; return r; }
+static inline M operator>(F a, F b)        { M r; r.v = a.v > b.v; return r; }
+static inline M operator&(M a, M b)        { M r; r.v = a.v && b.v; return r; }
+static inline F select(M m, F a, F b)      { F r; r.v = m.v ? a.v : b.v; return r; }
+#elif FRAKTAL_CPU_WIDTH == 4
+struct F { __m128 v; };
+struct M { __m128 v; };
+static inline F set1(float x)              { F r; r.v = _mm_set1_ps(x); return r; }
+static inline F load(const float *p)       { F r; r.v = _mm_loadu_ps(p); return r; }
+static inline void store(float *p, F a)    { _mm_storeu_ps(p, a.v); }
+static inline F operator+(F a, F b)        { F r; r.v = _mm_add_ps(a.v, b.v); return r; }
+static inline F operator-(F a, F b)        { F r; r.v = _mm_sub_ps(a.v, b.v); return r; }
+static inline F operator*(F a, F b)        { F r; r.v = _mm_mul_ps(a.v, b.v); return r; }
+static inline F operator/(F a, F b)        { F r; r.v = _mm_div_ps(a.v, b.v); return r; }
+static inline F min(F a, F b)              { F r; r.v = _mm_min_ps(a.v, b.v); return r; }
+static inline F max(F a, F b)              { F r; r.v = _mm_max_ps(a.v, b.v); return r; }
+static inline F sqrt(F a)                  { F r; r.v = _mm_sqrt_ps(a.v); return r; }
+static inline F floor(F a)                 { F r; r.v = _mm_floor_ps(a.v); return r; }
+static inline F abs(F a)                   { F r; r.v = _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); return r; }
+static inline M operator<(F a, F b)        { M r; r.v = _mm_cmplt_ps(a.v, b.v); return r; }
+static inline M operator>(F a, F b)        { M r; r.v = _mm_cmpgt_ps(a.v, b.v); return r; }
+static inline M operator&(M a, M b)        { M r; r.v = _mm_and_ps(a.v, b.v); return r; }
+static inline F select(M m, F a, F b)      { F r; r.v = _mm_blendv_ps(b.v, a.v, m.v); return r; }
+#elif FRAKTAL_CPU_WIDTH == 8
+struct F { __m256 v; };
+struct M { __m256 v; };
+static inline F set1(float x)              { F r; r.v = _mm256_set1_ps(x); return r; }
+static inline F load(const float *p)       { F r; r.v = _mm256_loadu_ps(p); return r; }
+static inline void store(float *p, F a)    { _mm256_storeu_ps(p, a.v); }
+static inline F operator+(F a, F b)        { F r; r.v = _mm256_add_ps(a.v, b.v); return r; }
+static inline F operator-(F a, F b)        { F r; r.v = _mm256_sub_ps(a.v, b.v); return r; }
+static inline F operator*(F a, F b)        { F r; r.v = _mm256_mul_ps(a.v, b.v); return r; }
+static inline F operator/(F a, F b)        { F r; r.v = _mm256_div_ps(a.v, b.v); return r; }
+static inline F min(F a, F b)              { F r; r.v = _mm256_min_ps(a.v, b.v); return r; }
+static inline F max(F a, F b)              { F r; r.v = _mm256_max_ps(a.v, b.v); return r; }
+static inline F sqrt(F a)                  { F r; r.v = _mm256_sqrt_ps(a.v); return r; }
+static inline F floor(F a)                 { F r; r.v = _mm256_floor_ps(a.v); return r; }
+static inline F abs(F a)                   { F r; r.v = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); return r; }
+static inline M operator<(F a, F b)        { M r; r.v = _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); return r; }
+static inline M operator>(F a, F b)        { M r; r.v = _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); return r; }
+static inline M operator&(M a, M b)        { M r; r.v = _mm256_and_ps(a.v, b.v); return r; }
+static inline F select(M m, F a, F b)      { F r; r.v = _mm256_blendv_ps(b.v, a.v, m.v); return r; }
+#elif FRAKTAL_CPU_WIDTH == 16
+struct F { __m512 v; };
+struct M { __mmask16 v; };
+static inline F set1(float x)              { F r; r.v = _mm512_set1_ps(x); return r; }
+static inline F load(const float *p)       { F r; r.v = _mm512_loadu_ps(p); return r; }
+static inline void store(float *p, F a)    { _mm512_storeu_ps(p, a.v); }
+static inline F operator+(F a, F b)        { F r; r.v = _mm512_add_ps(a.v, b.v); return r; }
+static inline F operator-(F a, F b)        { F r; r.v = _mm512_sub_ps(a.v, b.v); return r; }
+static inline F operator*(F a, F b)        { F r; r.v = _mm512_mul_ps(a.v, b.v); return r; }
+static inline F operator/(F a, F b)        { F r; r.v = _mm512_div_ps(a.v, b.v); return r; }
+static inline F min(F a, F b)              { F r; r.v = _mm512_min_ps(a.v, b.v); return r; }
+static inline F max(F a, F b)              { F r; r.v = _mm512_max_ps(a.v, b.v); return r; }
+static inline F sqrt(F a)                  { F r; r.v = _mm512_sqrt_ps(a.v); return r; }
+static inline F floor(F a)                 { F r; r.v = _mm512_mask_roundscale_ps(a.v, 0xffff, a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); return r; }
+static inline F abs(F a)                   { F r; r.v = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a.v), _mm512_set1_epi32(0x7fffffff))); return r; }
+static inline M operator<(F a, F b)        { M r; r.v = _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); return r; }
+static inline M operator>(F a, F b)        { M r; r.v = _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ); return r; }
+static inline M operator&(M a, M b)        { M r; r.v = (__mmask16)(a.v & b.v); return r; }
+static inline F select(M m, F a, F b)      { F r; r.v = _mm512_mask_blend_ps(m.v, b.v, a.v); return r; }
+#else
+#error "Unsupported FRAKTAL_CPU_WIDTH"
+#endif
+
+static inline F operator-(F a) { return set1(0.0f) - a; }
+static inline F mod(F x, F y) { return x - y*floor(x/y); } // GLSL mod
+static inline F mix(F a, F b, F t) { return a + (b - a)*t; }
+static inline F step(F edge, F x) { return select(x < edge, set1(0.0f), set1(1.0f)); }
+
+// Transcendental functions are evaluated per lane with libm
+static inline F atan2(F y, F x)
+{
+    float ys[FRAKTAL_CPU_WIDTH], xs[FRAKTAL_CPU_WIDTH];
+    store(ys, y); store(xs, x);
+    for (int i = 0; i < FRAKTAL_CPU_WIDTH; i++) ys[i] = atan2f(ys[i], xs[i]);
+    return load(ys);
+}
+static inline void sincos(F a, F *s, F *c)
+{
+    float as[FRAKTAL_CPU_WIDTH], ss[FRAKTAL_CPU_WIDTH], cs[FRAKTAL_CPU_WIDTH];
+    store(as, a);
+    for (int i = 0; i < FRAKTAL_CPU_WIDTH; i++) { ss[i] = sinf(as[i]); cs[i] = cosf(as[i]); }
+    *s = load(ss); *c = load(cs);
+}
+
+struct V2 { F x,y; };
+struct V3 { F x,y,z; };
+static inline V2 v2(F x, F y) { V2 r = { x, y }; return r; }
+static inline V3 v3(F x, F y, F z) { V3 r = { x, y, z }; return r; }
+static inline V3 v3(const float *p) { return v3(set1(p[0]), set1(p[1]), set1(p[2])); }
+static inline F length(V2 v) { return sqrt(v.x*v.x + v.y*v.y); }
+static inline F length(V3 v) { return sqrt(v.x*v.x + v.y*v.y + v.z*v.z); }
+static inline F dot(V2 a, V2 b) { return a.x*b.x + a.y*b.y; }
+static inline F dot(V3 a, V3 b) { return a.x*b.x + a.y*b.y + a.z*b.z; }
+static inline V3 cross(V3 a, V3 b) { return v3(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x); }
+static inline V2 operator-(V2 a, V2 b) { return v2(a.x - b.x, a.y - b.y); }
+static inline V3 operator+(V3 a, V3 b) { return v3(a.x + b.x, a.y + b.y, a.z + b.z); }
+static inline V3 operator-(V3 a, V3 b) { return v3(a.x - b.x, a.y - b.y, a.z - b.z); }
+static inline V3 operator*(F s, V3 a) { return v3(s*a.x, s*a.y, s*a.z); }
+static inline V2 abs(V2 v) { return v2(abs(v.x), abs(v.y)); }
+static inline V3 abs(V3 v) { return v3(abs(v.x), abs(v.y), abs(v.z)); }
+static inline V2 max(V2 v, F s) { return v2(max(v.x, s), max(v.y, s)); }
+static inline V3 max(V3 v, F s) { return v3(max(v.x, s), max(v.y, s), max(v.z, s)); }
+static inline V3 min(V3 v, F s) { return v3(min(v.x, s), min(v.y, s), min(v.z, s)); }
+static inline F vmax(V3 v) { return max(max(v.x, v.y), v.z); }
+
+//-----------------------------------------------------------------------------
+// hg_sdf
+//-----------------------------------------------------------------------------
+
+static inline F fSphere(V3 p, F r)
+{
+    return length(p) - r;
+}
+
+static inline F fPlane(V3 p, V3 n, F distanceFromOrigin)
+{
+    return dot(p, n) + distanceFromOrigin;
+}
+
+static inline F fBox(V3 p, V3 b)
+{
+    V3 d = abs(p) - b;
+    return length(max(d, set1(0.0f))) + vmax(min(d, set1(0.0f)));
+}
+
+static inline F fCylinder(V3 p, F r, F height)
+{
+    V2 d = abs(v2(length(v2(p.x, p.z)), p.y)) - v2(r, height);
+    return min(max(d.x, d.y), set1(0.0f)) + length(max(d, set1(0.0f)));
+}
+
+static inline F fCapsule(V3 p, F r, F c)
+{
+    return mix(length(v2(p.x, p.z)) - r, length(v3(p.x, abs(p.y) - c, p.z)) - r, step(c, abs(p.y)));
+}
+
+static inline F fTorus(V3 p, F smallRadius, F largeRadius)
+{
+    return length(v2(length(v2(p.x, p.z)) - largeRadius, p.y)) - smallRadius;
+}
+
+static inline F fHexagonCircumcircle(V3 p, V2 h)
+{
+    V3 q = abs(p);
+    return max(q.y - h.y, max(q.x*set1(sqrtf(3.0f)*0.5f) + q.z*set1(0.5f), q.z) - h.x);
+}
+
+static inline F fCone(V3 p, float radius, float height)
+{
+    V2 q = v2(length(v2(p.x, p.z)), p.y);
+    V2 tip = q - v2(set1(0.0f), set1(height));
+    float mantle_length = sqrtf(height*height + radius*radius);
+    V2 mantleDir = v2(set1(height/mantle_length), set1(radius/mantle_length));
+    F mantle = dot(tip, mantleDir);
+    F d = max(mantle, -q.y);
+    F projected = dot(tip, v2(mantleDir.y, -mantleDir.x));
+
+    // distance to tip
+    M to_tip = (q.y > set1(height)) & (projected < set1(0.0f));
+    d = select(to_tip, max(d, length(tip)), d);
+
+    // distance to base ring
+    M to_ring = (q.x > set1(radius)) & (projected > set1(mantle_length));
+    d = select(to_ring, max(d, length(q - v2(set1(radius), set1(0.0f)))), d);
+    return d;
+}
+
+static inline F fOpUnionChamfer(F a, F b, F r)
+{
+    return min(min(a, b), (a - r + b)*set1(sqrtf(0.5f)));
+}
+
+static inline F fOpIntersectionChamfer(F a, F b, F r)
+{
+    return max(max(a, b), (a + r + b)*set1(sqrtf(0.5f)));
+}
+
+static inline F fOpDifferenceChamfer(F a, F b, F r)
+{
+    return fOpIntersectionChamfer(a, -b, r);
+}
+
+static inline F fOpUnionRound(F a, F b, F r)
+{
+    V2 u = max(v2(r - a, r - b), set1(0.0f));
+    return max(r, min(a, b)) - length(u);
+}
+
+static inline F fOpIntersectionRound(F a, F b, F r)
+{
+    V2 u = max(v2(r + a, r + b), set1(0.0f));
+    return min(-r, max(a, b)) + length(u);
+}
+
+static inline F fOpDifferenceRound(F a, F b, F r)
+{
+    return fOpIntersectionRound(a, -b, r);
+}
+
+static inline F fOpUnionSoft(F a, F b, F r)
+{
+    F e = max(r - abs(a - b), set1(0.0f));
+    return min(a, b) - e*e*set1(0.25f)/r;
+}
+
+static inline F pMod1(F *p, F size)
+{
+    F halfsize = size*set1(0.5f);
+    F c = floor((*p + halfsize)/size);
+    *p = mod(*p + halfsize, size) - halfsize;
+    return c;
+}
+
+static inline F pModInterval1(F *p, F size, F start, F stop)
+{
+    F halfsize = size*set1(0.5f);
+    F c = floor((*p + halfsize)/size);
+    *p = mod(*p + halfsize, size) - halfsize;
+    M above = c > stop;
+    *p = select(above, *p + size*(c - stop), *p);
+    c = select(above, stop, c);
+    M below = c < start;
+    *p = select(below, *p + size*(c - start), *p);
+    c = select(below, start, c);
+    return c;
+}
+
+static inline F pModPolar(V2 *p, float repetitions)
+{
+    float angle = 2.0f*3.14159265359f/repetitions;
+    F a = atan2(p->y, p->x) + set1(angle/2.0f);
+    F r = length(*p);
+    F c = floor(a/set1(angle));
+    a = mod(a, set1(angle)) - set1(angle/2.0f);
+    F s, co;
+    sincos(a, &s, &co);
+    *p = v2(co*r, s*r);
+    c = select(abs(c) < set1(repetitions/2.0f), c, abs(c));
+    return c;
+}
+
+//-----------------------------------------------------------------------------
+// Interpreter (see libf/interpreter.f)
+//-----------------------------------------------------------------------------
+
+enum { NUM_POINT_REGISTERS = 8 };
+enum { NUM_DISTANCE_REGISTERS = 16 };
+
+// Rotates p by the inverse of the unit quaternion q
+static inline V3 interpreterRotate(V3 p, const float *q)
+{
+    V3 u = v3(set1(-q[0]), set1(-q[1]), set1(-q[2]));
+    V3 t = set1(2.0f)*cross(u, p);
+    return p + set1(q[3])*t + cross(u, t);
+}
+
+static inline void interpreterMod(F *p, float size, float start, float stop)
+{
+    if (size <= 0.0f) return;
+    if (start > stop) pMod1(p, set1(size));
+    else pModInterval1(p, set1(size), set1(start), set1(stop));
+}
+
+static F interpret(V3 p, const fInstruction *code, int count)
+{
+    V3 P[NUM_POINT_REGISTERS];
+    F R[NUM_DISTANCE_REGISTERS];
+    P[0] = p;
+    R[0] = set1(1e10f);
+
+    for (int i = 0; i < count; i++)
+    {
+        const fInstruction *in = &code[i];
+        int op = (int)in->op;
+        if (op == FRAKTAL_OP_END)
+            break;
+        int dst = (int)in->dst;
+        int a = (int)in->a;
+        int b = (int)in->b;
+        const float *u = in->arg;
+        const float *v = in->arg + 4;
+
+        if (op < FRAKTAL_OP_SPHERE)
+        {
+            V3 q = P[a];
+            if      (op == FRAKTAL_OP_TRANSLATE) q = q - v3(u);
+            else if (op == FRAKTAL_OP_ROTATE)    q = interpreterRotate(q, u);
+            else if (op == FRAKTAL_OP_SCALE)     q = v3(q.x/set1(u[0]), q.y/set1(u[0]), q.z/set1(u[0]));
+            else if (op == FRAKTAL_OP_MIRROR)
+            {
+                q.x = mix(q.x, abs(q.x), set1(u[0]));
+                q.y = mix(q.y, abs(q.y), set1(u[1]));
+                q.z = mix(q.z, abs(q.z), set1(u[2]));
+            }
+            else if (op == FRAKTAL_OP_MOD_INTERVAL)
+            {
+                interpreterMod(&q.x, u[0], u[3], v[0]);
+                interpreterMod(&q.y, u[1], u[3], v[0]);
+                interpreterMod(&q.z, u[2], u[3], v[0]);
+            }
+            else if (op == FRAKTAL_OP_MOD_POLAR)
+            {
+                V2 xz = v2(q.x, q.z);
+                pModPolar(&xz, u[0]);
+                q.x = xz.x;
+                q.z = xz.y;
+            }
+            P[dst] = q;
+        }
+        else if (op < FRAKTAL_OP_UNION)
+        {
+            V3 q = P[a];
+            F d = set1(1e10f);
+            if      (op == FRAKTAL_OP_SPHERE)   d = fSphere(q, set1(u[0]));
+            else if (op == FRAKTAL_OP_BOX)      d = fBox(q, v3(u));
+            else if (op == FRAKTAL_OP_CYLINDER) d = fCylinder(q, set1(u[0]), set1(u[1]));
+            else if (op == FRAKTAL_OP_CAPSULE)  d = fCapsule(q, set1(u[0]), set1(u[1]));
+            else if (op == FRAKTAL_OP_TORUS)    d = fTorus(q, set1(u[0]), set1(u[1]));
+            else if (op == FRAKTAL_OP_PLANE)    d = fPlane(q, v3(u), set1(u[3]));
+            else if (op == FRAKTAL_OP_CONE)     d = fCone(q, u[0], u[1]);
+            else if (op == FRAKTAL_OP_HEXAGON)  d = fHexagonCircumcircle(q, v2(set1(u[0]), set1(u[1])));
+            R[dst] = d;
+        }
+        else
+        {
+            F da = R[a];
+            F db = R[b];
+            F r = set1(u[0]);
+            F d = da;
+            if      (op == FRAKTAL_OP_UNION)                d = min(da, db);
+            else if (op == FRAKTAL_OP_INTERSECTION)         d = max(da, db);
+            else if (op == FRAKTAL_OP_DIFFERENCE)           d = max(da, -db);
+            else if (op == FRAKTAL_OP_UNION_ROUND)          d = fOpUnionRound(da, db, r);
+            else if (op == FRAKTAL_OP_INTERSECTION_ROUND)   d = fOpIntersectionRound(da, db, r);
+            else if (op == FRAKTAL_OP_DIFFERENCE_ROUND)     d = fOpDifferenceRound(da, db, r);
+            else if (op == FRAKTAL_OP_UNION_CHAMFER)        d = fOpUnionChamfer(da, db, r);
+            else if (op == FRAKTAL_OP_INTERSECTION_CHAMFER) d = fOpIntersectionChamfer(da, db, r);
+            else if (op == FRAKTAL_OP_DIFFERENCE_CHAMFER)   d = fOpDifferenceChamfer(da, db, r);
+            else if (op == FRAKTAL_OP_UNION_SOFT)           d = fOpUnionSoft(da, db, r);
+            else if (op == FRAKTAL_OP_OFFSET)               d = da - r;
+            else if (op == FRAKTAL_OP_DIST_SCALE)           d = da*r;
+            R[dst] = d;
+        }
+    }
+    return R[0];
+}
+
+// Evaluates the program at 'count' points stored as packed xyz triples.
+// The last pack is padded by repeating the last point.
+static void eval(float *distances, const float *points, int count, const fInstruction *code, int num_instructions)
+{
+    for (int i = 0; i < count; i += FRAKTAL_CPU_WIDTH)
+    {
+        float x[FRAKTAL_CPU_WIDTH], y[FRAKTAL_CPU_WIDTH], z[FRAKTAL_CPU_WIDTH], d[FRAKTAL_CPU_WIDTH];
+        for (int j = 0; j < FRAKTAL_CPU_WIDTH; j++)
+        {
+            int k = i + j < count ? i + j : count - 1;
+            x[j] = points[3*k + 0];
+            y[j] = points[3*k + 1];
+            z[j] = points[3*k + 2];
+        }
+        store(d, interpret(v3(load(x), load(y), load(z)), code, num_instructions));
+        for (int j = 0; j < FRAKTAL_CPU_WIDTH && i + j < count; j++)
+            distances[i + j] = d[j];
+    }
+}
+
+}
@@ -0,0 +1,350 @@
+#pragma once
+#include <stdlib.h>
+#include <string.h>
+#include "reuse/log.h"
+
+enum { FRAKTAL_MAX_GRAPH_PASSES = 64 };
+enum { FRAKTAL_MAX_GRAPH_ARRAYS = 64 };
+enum { FRAKTAL_MAX_PASS_INPUTS = 16 };
+
+struct fGraphArray
+{
+    fArray *imported;   // NULL if the array is transient
+    int channels;
+    int width;
+    int height;
+    fEnum format;
+    int first_pass;     // first and last position in the execution order
+    int last_pass;      // that touches the array (-1 if untouched)
+    int physical;       // index into the pool (transient arrays only)
+};
+
+struct fGraphPass
+{
+    fKernel *kernel;
+    int output;
+    bool clear;
+    fPassCallback callback;
+    void *userdata;
+    int input_offset[FRAKTAL_MAX_PASS_INPUTS];
+    int input_array[FRAKTAL_MAX_PASS_INPUTS];
+    int num_inputs;
+};
+
+struct fRenderGraph
+{
+    fGraphPass passes[FRAKTAL_MAX_GRAPH_PASSES];
+    fGraphArray arrays[FRAKTAL_MAX_GRAPH_ARRAYS];
+    int num_passes;
+    int num_arrays;
+
+    int order[FRAKTAL_MAX_GRAPH_PASSES];
+    bool compiled;
+
+    // Transient arrays are allocated from the pool. Arrays in the pool
+    // may back several transient arrays whose lifetimes do not overlap.
+    fArray *pool[FRAKTAL_MAX_GRAPH_ARRAYS];
+    bool pool_used[FRAKTAL_MAX_GRAPH_ARRAYS];
+    int pool_count;
+
+    fRenderGraph *next; // in the list of live graphs
+};
+
+// Live graphs, whose pools may be evicted to stay within the memory
+// budget. The graph being compiled or run is never evicted.
+static fRenderGraph *fraktal_graphs = NULL;
+static fRenderGraph *fraktal_active_graph = NULL;
+
+static void fraktal_release_graph_pool(fRenderGraph *g)
+{
+    for (int i = 0; i < g->pool_count; i++)
+        fraktal_destroy_array(g->pool[i]);
+    g->pool_count = 0;
+    g->compiled = false;
+}
+
+fRenderGraph *fraktal_create_graph()
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fRenderGraph *g = (fRenderGraph*)calloc(1, sizeof(fRenderGraph));
+    fraktal_assert(g && "Ran out of memory");
+    g->next = fraktal_graphs;
+    fraktal_graphs = g;
+    fraktal_memory.host_bytes += sizeof(fRenderGraph);
+    fraktal_memory.num_graphs++;
+    return g;
+}
+
+void fraktal_destroy_graph(fRenderGraph *g)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    if (g)
+    {
+        fRenderGraph **link = &fraktal_graphs;
+        while (*link != g)
+            link = &(*link)->next;
+        *link = g->next;
+        fraktal_release_graph_pool(g);
+        fraktal_memory.host_bytes -= sizeof(fRenderGraph);
+        fraktal_memory.num_graphs--;
+        free(g);
+    }
+}
+
+int fraktal_graph_array(fRenderGraph *g, int channels, int width, int height, fEnum format)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(g);
+    fraktal_assert(channels == 1 || channels == 2 || channels == 4);
+    fraktal_assert(width > 0 && height > 0);
+    fraktal_assert(format == FRAKTAL_FLOAT || format == FRAKTAL_UINT8);
+    if (g->num_arrays == FRAKTAL_MAX_GRAPH_ARRAYS)
+    {
+        log_err("Failed to add array to render graph: exceeded maximum number of arrays.\n");
+        return -1;
+    }
+    fGraphArray *r = &g->arrays[g->num_arrays];
+    r->imported = NULL;
+    r->channels = channels;
+    r->width = width;
+    r->height = height;
+    r->format = format;
+    g->compiled = false;
+    return g->num_arrays++;
+}
+
+int fraktal_graph_import(fRenderGraph *g, fArray *a)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(g);
+    fraktal_assert(fraktal_is_valid_array(a));
+    if (g->num_arrays == FRAKTAL_MAX_GRAPH_ARRAYS)
+    {
+        log_err("Failed to add array to render graph: exceeded maximum number of arrays.\n");
+        return -1;
+    }
+    fGraphArray *r = &g->arrays[g->num_arrays];
+    r->imported = a;
+    r->channels = a->channels;
+    r->width = a->width;
+    r->height = a->height;
+    r->format = a->format;
+    g->compiled = false;
+    return g->num_arrays++;
+}
+
+int fraktal_graph_pass(fRenderGraph *g, fKernel *f, int output, bool clear, fPassCallback callback, void *userdata)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(g);
+    fraktal_assert(f);
+    fraktal_assert(output >= 0 && output < g->num_arrays && "Invalid output array.");
+    fraktal_assert(!g->arrays[output].imported || g->arrays[output].imported->access == FRAKTAL_READ_WRITE);
+    if (g->num_passes == FRAKTAL_MAX_GRAPH_PASSES)
+    {
+        log_err("Failed to add pass to render graph: exceeded maximum number of passes.\n");
+        return -1;
+    }
+    fGraphPass *p = &g->passes[g->num_passes];
+    p->kernel = f;
+    p->output = output;
+    p->clear = clear;
+    p->callback = callback;
+    p->userdata = userdata;
+    p->num_inputs = 0;
+    g->compiled = false;
+    return g->num_passes++;
+}
+
+void fraktal_graph_input(fRenderGraph *g, int pass, int offset, int array)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(g);
+    fraktal_assert(pass >= 0 && pass < g->num_passes && "Invalid pass.");
+    fraktal_assert(array >= 0 && array < g->num_arrays && "Invalid input array.");
+    fGraphPass *p = &g->passes[pass];
+    fraktal_assert(p->output != array && "A pass cannot read from its own output.");
+    fraktal_assert(p->num_inputs < FRAKTAL_MAX_PASS_INPUTS && "Exceeded maximum number of pass inputs.");
+    if (offset < 0)
+        return;
+    p->input_offset[p->num_inputs] = offset;
+    p->input_array[p->num_inputs] = array;
+    p->num_inputs++;
+    g->compiled = false;
+}
+
+static bool fraktal_pass_reads(fGraphPass *p, int array)
+{
+    for (int i = 0; i < p->num_inputs; i++)
+        if (p->input_array[i] == array)
+            return true;
+    return false;
+}
+
+// Orders passes such that every pass runs after all passes writing to
+// its inputs. Writers to the same array keep their declaration order.
+static bool fraktal_sort_graph(fRenderGraph *g)
+{
+    int n = g->num_passes;
+    static bool edge[FRAKTAL_MAX_GRAPH_PASSES][FRAKTAL_MAX_GRAPH_PASSES];
+    int in_degree[FRAKTAL_MAX_GRAPH_PASSES] = {0};
+    bool done[FRAKTAL_MAX_GRAPH_PASSES] = {0};
+    for (int a = 0; a < n; a++)
+    for (int b = 0; b < n; b++)
+    {
+        fGraphPass *pa = &g->passes[a];
+        fGraphPass *pb = &g->passes[b];
+        edge[a][b] = a != b &&
+            (fraktal_pass_reads(pb, pa->output) ||
+             (pa->output == pb->output && a < b));
+        if (edge[a][b])
+            in_degree[b]++;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        int next = -1;
+        for (int j = 0; j < n && next < 0; j++)
+            if (!done[j] && in_degree[j] == 0)
+                next = j;
+        if (next < 0)
+        {
+            log_err("Failed to compile render graph: passes have a cyclic dependency.\n");
+            return false;
+        }
+        done[next] = true;
+        g->order[i] = next;
+        for (int j = 0; j < n; j++)
+            if (edge[next][j])
+                in_degree[j]--;
+    }
+    return true;
+}
+
+static bool fraktal_compile_graph_internal(fRenderGraph *g)
+{
+    g->compiled = false;
+    if (!fraktal_sort_graph(g))
+        return false;
+
+    // Compute lifetimes in terms of positions in the execution order
+    for (int i = 0; i < g->num_arrays; i++)
+    {
+        g->arrays[i].first_pass = -1;
+        g->arrays[i].last_pass = -1;
+        g->arrays[i].physical = -1;
+    }
+    for (int i = 0; i < g->num_passes; i++)
+    {
+        fGraphPass *p = &g->passes[g->order[i]];
+        for (int j = 0; j <= p->num_inputs; j++)
+        {
+            int array = j < p->num_inputs ? p->input_array[j] : p->output;
+            fGraphArray *r = &g->arrays[array];
+            if (r->first_pass < 0)
+                r->first_pass = i;
+            r->last_pass = i;
+        }
+    }
+
+    // Assign pool arrays to transient arrays. Transient arrays with the
+    // same dimensions and format share memory if they are not alive at
+    // the same time.
+    int pool_last_pass[FRAKTAL_MAX_GRAPH_ARRAYS];
+    for (int i = 0; i < g->pool_count; i++)
+    {
+        g->pool_used[i] = false;
+        pool_last_pass[i] = -1;
+    }
+    for (int i = 0; i < g->num_passes; i++)
+    for (int array = 0; array < g->num_arrays; array++)
+    {
+        fGraphArray *r = &g->arrays[array];
+        if (r->imported || r->first_pass != i)
+            continue;
+
+        int physical = -1;
+        for (int k = 0; k < g->pool_count && physical < 0; k++)
+        {
+            fArray *a = g->pool[k];
+            if ((!g->pool_used[k] || pool_last_pass[k] < i) &&
+                a->channels == r->channels &&
+                a->width == r->width &&
+                a->height == r->height &&
+                a->format == r->format)
+                physical = k;
+        }
+        if (physical < 0)
+        {
+            if (g->pool_count == FRAKTAL_MAX_GRAPH_ARRAYS)
+            {
+                log_err("Failed to compile render graph: exceeded maximum number of arrays.\n");
+                return false;
+            }
+            fArray *a = fraktal_create_array(NULL, r->channels, r->width, r->height, 1, r->format, FRAKTAL_READ_WRITE);
+            if (!a)
+            {
+                log_err("Failed to compile render graph: could not allocate transient array.\n");
+                return false;
+            }
+            physical = g->pool_count++;
+            g->pool[physical] = a;
+        }
+        g->pool_used[physical] = true;
+        pool_last_pass[physical] = r->last_pass;
+        r->physical = physical;
+    }
+
+    g->compiled = true;
+    return true;
+}
+
+bool fraktal_compile_graph(fRenderGraph *g)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(g);
+    fRenderGraph *last_active_graph = fraktal_active_graph;
+    fraktal_active_graph = g;
+    bool result = fraktal_compile_graph_internal(g);
+    fraktal_active_graph = last_active_graph;
+    return result;
+}
+
+static fArray *fraktal_graph_physical(fRenderGraph *g, int array)
+{
+    fGraphArray *r = &g->arrays[array];
+    if (r->imported)
+        return r->imported;
+    fraktal_assert(r->physical >= 0);
+    return g->pool[r->physical];
+}
+
+void fraktal_run_graph(fRenderGraph *g)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(g);
+    fraktal_assert(!fraktal_current_kernel && "Call fraktal_use_kernel(NULL) before running a render graph.");
+    if (!g->compiled && !fraktal_compile_graph(g))
+        return;
+    fraktal_active_graph = g;
+
+    for (int i = 0; i < g->num_passes; i++)
+    {
+        fGraphPass *p = &g->passes[g->order[i]];
+        fGraphArray *r = &g->arrays[p->output];
+        fArray *out = fraktal_graph_physical(g, p->output);
+        fraktal_use_kernel(p->kernel);
+        for (int j = 0; j < p->num_inputs; j++)
+            fraktal_param_array(p->input_offset[j], fraktal_graph_physical(g, p->input_array[j]));
+        if (p->callback)
+            p->callback(p->kernel, p->userdata);
+
+        // The contents of transient arrays are undefined until written,
+        // so the first pass writing to one always clears it.
+        if (p->clear || (!r->imported && r->first_pass == i))
+            fraktal_zero_array(out);
+        fraktal_run_kernel(out);
+    }
+    fraktal_use_kernel(NULL);
+    fraktal_active_graph = NULL;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "reuse/log.h"
+
+// An instruction is stored as three RGBA float texels, see libf/interpreter.f
+enum { FRAKTAL_TEXELS_PER_INSTRUCTION = sizeof(fInstruction)/(4*sizeof(float)) };
+
+fArray *fraktal_create_program(int capacity)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(capacity > 0);
+    return fraktal_create_array(NULL, 4, FRAKTAL_TEXELS_PER_INSTRUCTION*capacity, 1, 1, FRAKTAL_FLOAT, FRAKTAL_READ_ONLY);
+}
+
+void fraktal_upload_program(fArray *program, const fInstruction *code, int count)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(fraktal_is_valid_array(program));
+    fraktal_assert(program->height == 1 && program->channels == 4 && program->format == FRAKTAL_FLOAT &&
+                   "Program must be created with fraktal_create_program.");
+    fraktal_assert(code);
+    fraktal_assert(count > 0);
+    fraktal_assert(code[count - 1].op == FRAKTAL_OP_END && "Program must end with FRAKTAL_OP_END.");
+    if (FRAKTAL_TEXELS_PER_INSTRUCTION*count > program->width)
+    {
+        log_err("Failed to upload program: %d instructions exceed the capacity of %d.\n",
+                count, program->width/FRAKTAL_TEXELS_PER_INSTRUCTION);
+        return;
+    }
+    fraktal_ensure_context();
+    fraktal_check_gl_error();
+
+    // Only the used part is uploaded; the interpreter stops at the first
+    // FRAKTAL_OP_END, so the rest of the array is never read.
+    GLint last_texture; glGetIntegerv(GL_TEXTURE_BINDING_1D, &last_texture);
+    glBindTexture(GL_TEXTURE_1D, program->color0);
+    glTexSubImage1D(GL_TEXTURE_1D, 0, 0, FRAKTAL_TEXELS_PER_INSTRUCTION*count, GL_RGBA, GL_FLOAT, code);
+    glBindTexture(GL_TEXTURE_1D, last_texture);
+    fraktal_check_gl_error();
+}
@@ -0,0 +1,450 @@
+#pragma once
+#include <math.h>
+
+// Interval arithmetic version of the interpreter (see fraktal_cpu_impl.h).
+// Every function returns an interval that contains the result of the
+// corresponding point function for every point in its input intervals.
+// Bounds are conservative rather than tight: an expression that uses a
+// variable more than once (like fBox) is bounded as if each use were
+// independent.
+
+namespace fraktal_interval {
+
+struct I { float lo, hi; };
+
+static inline I iv(float x) { I r = { x, x }; return r; }
+static inline I iv(float lo, float hi) { I r = { lo, hi }; return r; }
+static inline float min(float a, float b) { return a < b ? a : b; }
+static inline float max(float a, float b) { return a > b ? a : b; }
+static inline I hull(I a, I b) { return iv(min(a.lo, b.lo), max(a.hi, b.hi)); }
+
+static inline I operator+(I a, I b)     { return iv(a.lo + b.lo, a.hi + b.hi); }
+static inline I operator-(I a, I b)     { return iv(a.lo - b.hi, a.hi - b.lo); }
+static inline I operator-(I a)          { return iv(-a.hi, -a.lo); }
+static inline I operator+(I a, float s) { return iv(a.lo + s, a.hi + s); }
+static inline I operator-(I a, float s) { return iv(a.lo - s, a.hi - s); }
+static inline I operator*(I a, float s) { return s >= 0.0f ? iv(a.lo*s, a.hi*s) : iv(a.hi*s, a.lo*s); }
+static inline I operator/(I a, float s) { return s >= 0.0f ? iv(a.lo/s, a.hi/s) : iv(a.hi/s, a.lo/s); }
+static inline I operator*(I a, I b)
+{
+    float p0 = a.lo*b.lo, p1 = a.lo*b.hi, p2 = a.hi*b.lo, p3 = a.hi*b.hi;
+    return iv(min(min(p0, p1), min(p2, p3)), max(max(p0, p1), max(p2, p3)));
+}
+
+static inline I min(I a, I b) { return iv(min(a.lo, b.lo), min(a.hi, b.hi)); }
+static inline I max(I a, I b) { return iv(max(a.lo, b.lo), max(a.hi, b.hi)); }
+static inline I min(I a, float s) { return min(a, iv(s)); }
+static inline I max(I a, float s) { return max(a, iv(s)); }
+static inline I sqrt(I a) { return iv(sqrtf(max(a.lo, 0.0f)), sqrtf(max(a.hi, 0.0f))); }
+static inline I abs(I a)
+{
+    if (a.lo >= 0.0f) return a;
+    if (a.hi <= 0.0f) return -a;
+    return iv(0.0f, max(-a.lo, a.hi));
+}
+static inline I sqr(I a)
+{
+    I b = abs(a);
+    return iv(b.lo*b.lo, b.hi*b.hi);
+}
+
+static inline I length(I x, I y) { return sqrt(sqr(x) + sqr(y)); }
+static inline I length(I x, I y, I z) { return sqrt(sqr(x) + sqr(y) + sqr(z)); }
+
+struct V3 { I x,y,z; };
+static inline V3 v3(I x, I y, I z) { V3 r = { x, y, z }; return r; }
+
+//-----------------------------------------------------------------------------
+// hg_sdf
+//-----------------------------------------------------------------------------
+
+static I fSphere(V3 p, float r)
+{
+    return length(p.x, p.y, p.z) - r;
+}
+
+static I fPlane(V3 p, const float *n, float distanceFromOrigin)
+{
+    return p.x*n[0] + p.y*n[1] + p.z*n[2] + distanceFromOrigin;
+}
+
+static I fBox(V3 p, const float *b)
+{
+    I dx = abs(p.x) - b[0];
+    I dy = abs(p.y) - b[1];
+    I dz = abs(p.z) - b[2];
+    I vmax = max(max(min(dx, 0.0f), min(dy, 0.0f)), min(dz, 0.0f));
+    return length(max(dx, 0.0f), max(dy, 0.0f), max(dz, 0.0f)) + vmax;
+}
+
+static I fCylinder(V3 p, float r, float height)
+{
+    I dx = abs(length(p.x, p.z)) - r;
+    I dy = abs(p.y) - height;
+    return min(max(dx, dy), 0.0f) + length(max(dx, 0.0f), max(dy, 0.0f));
+}
+
+static I fCapsule(V3 p, float r, float c)
+{
+    // step(c, abs(p.y)) selects between the two distances
+    I ay = abs(p.y);
+    I side = length(p.x, p.z) - r;
+    I cap = length(p.x, ay - c, p.z) - r;
+    if (ay.hi < c) return side;
+    if (ay.lo >= c) return cap;
+    return hull(side, cap);
+}
+
+static I fTorus(V3 p, float smallRadius, float largeRadius)
+{
+    return length(length(p.x, p.z) - largeRadius, p.y) - smallRadius;
+}
+
+static I fHexagonCircumcircle(V3 p, float hx, float hy)
+{
+    I qx = abs(p.x), qy = abs(p.y), qz = abs(p.z);
+    return max(qy - hy, max(qx*(sqrtf(3.0f)*0.5f) + qz*0.5f, qz) - hx);
+}
+
+static I fCone(V3 p, float radius, float height)
+{
+    I qx = length(p.x, p.z);
+    I qy = p.y;
+    I tipx = qx;
+    I tipy = qy - height;
+    float mantle_length = sqrtf(height*height + radius*radius);
+    float mx = height/mantle_length;
+    float my = radius/mantle_length;
+    I mantle = tipx*mx + tipy*my;
+    I d = max(mantle, -qy);
+    I projected = tipx*my - tipy*mx;
+
+    // distance to tip, where the condition may hold for some points
+    if (qy.hi > height && projected.lo < 0.0f)
+    {
+        I to_tip = max(d, length(tipx, tipy));
+        d = (qy.lo > height && projected.hi < 0.0f) ? to_tip : hull(d, to_tip);
+    }
+
+    // distance to base ring
+    if (qx.hi > radius && projected.hi > mantle_length)
+    {
+        I to_ring = max(d, length(qx - radius, qy));
+        d = (qx.lo > radius && projected.lo > mantle_length) ? to_ring : hull(d, to_ring);
+    }
+    return d;
+}
+
+static I fOpUnionChamfer(I a, I b, float r)
+{
+    return min(min(a, b), (a - r + b)*sqrtf(0.5f));
+}
+
+static I fOpIntersectionChamfer(I a, I b, float r)
+{
+    return max(max(a, b), (a + r + b)*sqrtf(0.5f));
+}
+
+static I fOpDifferenceChamfer(I a, I b, float r)
+{
+    return fOpIntersectionChamfer(a, -b, r);
+}
+
+static I fOpUnionRound(I a, I b, float r)
+{
+    I ux = max(iv(r) - a, 0.0f);
+    I uy = max(iv(r) - b, 0.0f);
+    return max(min(a, b), r) - length(ux, uy);
+}
+
+static I fOpIntersectionRound(I a, I b, float r)
+{
+    I ux = max(a + r, 0.0f);
+    I uy = max(b + r, 0.0f);
+    return min(max(a, b), -r) + length(ux, uy);
+}
+
+static I fOpDifferenceRound(I a, I b, float r)
+{
+    return fOpIntersectionRound(a, -b, r);
+}
+
+static I fOpUnionSoft(I a, I b, float r)
+{
+    I e = max(iv(r) - abs(a - b), 0.0f);
+    return min(a, b) - sqr(e)*(0.25f/r);
+}
+
+// Bounds pModInterval1 (or pMod1 if start > stop) over p. Points below
+// the first cell or above the last cell are translated rather than
+// repeated, and points within cells are wrapped into [-size/2, size/2].
+static I pModInterval1(I p, float size, float start, float stop)
+{
+    float halfsize = 0.5f*size;
+    I inner = p;
+    bool empty = true;
+    I result = iv(0.0f);
+    if (start <= stop)
+    {
+        float below = ceilf(start)*size - halfsize;        // c < start
+        float above = (floorf(stop) + 1.0f)*size - halfsize; // c > stop
+        if (p.lo < below)
+        {
+            I part = iv(p.lo, min(p.hi, below)) - start*size;
+            result = empty ? part : hull(result, part);
+            empty = false;
+        }
+        if (p.hi >= above)
+        {
+            I part = iv(max(p.lo, above), p.hi) - stop*size;
+            result = empty ? part : hull(result, part);
+            empty = false;
+        }
+        inner = iv(max(p.lo, below), min(p.hi, above));
+    }
+    if (inner.lo <= inner.hi)
+    {
+        float c_lo = floorf((inner.lo + halfsize)/size);
+        float c_hi = floorf((inner.hi + halfsize)/size);
+        I part = c_lo == c_hi ? inner - c_lo*size : iv(-halfsize, halfsize);
+        result = empty ? part : hull(result, part);
+    }
+    return result;
+}
+
+// Bounds pModPolar over the xz-plane. The result has the same radius as
+// the input and an angle within the first cell, [-angle/2, angle/2].
+static void pModPolar(I *x, I *z, float repetitions)
+{
+    float half_angle = 3.14159265359f/repetitions;
+    I r = length(*x, *z);
+    I c = iv(half_angle >= 3.14159265359f ? -1.0f : cosf(half_angle), 1.0f);
+    float s = half_angle >= 0.5f*3.14159265359f ? 1.0f : sinf(half_angle);
+    *x = r*c;
+    *z = r*iv(-s, s);
+}
+
+//-----------------------------------------------------------------------------
+// Interpreter (see libf/interpreter.f)
+//-----------------------------------------------------------------------------
+
+// Rotates p by the inverse of the unit quaternion q
+static void interpreterRotate(float out[3], const float p[3], const float *q)
+{
+    float u[3] = { -q[0], -q[1], -q[2] };
+    float t[3] = { 2.0f*(u[1]*p[2] - u[2]*p[1]), 2.0f*(u[2]*p[0] - u[0]*p[2]), 2.0f*(u[0]*p[1] - u[1]*p[0]) };
+    out[0] = p[0] + q[3]*t[0] + (u[1]*t[2] - u[2]*t[1]);
+    out[1] = p[1] + q[3]*t[1] + (u[2]*t[0] - u[0]*t[2]);
+    out[2] = p[2] + q[3]*t[2] + (u[0]*t[1] - u[1]*t[0]);
+}
+
+static I interpreterMod(I p, float size, float start, float stop)
+{
+    if (size <= 0.0f) return p;
+    return pModInterval1(p, size, start, stop);
+}
+
+static I mirror(I p, float u)
+{
+    if (u == 0.0f) return p;
+    if (u == 1.0f) return abs(p);
+    return p*(1.0f - u) + abs(p)*u;
+}
+
+static I interpret(V3 p, const fInstruction *code, int count)
+{
+    V3 P[fraktal_cpu_scalar::NUM_POINT_REGISTERS];
+    I R[fraktal_cpu_scalar::NUM_DISTANCE_REGISTERS];
+    P[0] = p;
+    R[0] = iv(1e10f);
+
+    for (int i = 0; i < count; i++)
+    {
+        const fInstruction *in = &code[i];
+        int op = (int)in->op;
+        if (op == FRAKTAL_OP_END)
+            break;
+        int dst = (int)in->dst;
+        int a = (int)in->a;
+        int b = (int)in->b;
+        const float *u = in->arg;
+        const float *v = in->arg + 4;
+
+        if (op < FRAKTAL_OP_SPHERE)
+        {
+            V3 q = P[a];
+            if (op == FRAKTAL_OP_TRANSLATE)
+            {
+                q = v3(q.x - u[0], q.y - u[1], q.z - u[2]);
+            }
+            else if (op == FRAKTAL_OP_ROTATE)
+            {
+                // The rotation is linear, so each output coordinate is a
+                // weighted sum of the input intervals
+                float e[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+                float m[3][3];
+                for (int j = 0; j < 3; j++)
+                    interpreterRotate(m[j], e[j], u);
+                q = v3(q.x*m[0][0] + q.y*m[1][0] + q.z*m[2][0],
+                       q.x*m[0][1] + q.y*m[1][1] + q.z*m[2][1],
+                       q.x*m[0][2] + q.y*m[1][2] + q.z*m[2][2]);
+            }
+            else if (op == FRAKTAL_OP_SCALE)
+            {
+                q = v3(q.x/u[0], q.y/u[0], q.z/u[0]);
+            }
+            else if (op == FRAKTAL_OP_MIRROR)
+            {
+                q = v3(mirror(q.x, u[0]), mirror(q.y, u[1]), mirror(q.z, u[2]));
+            }
+            else if (op == FRAKTAL_OP_MOD_INTERVAL)
+            {
+                q.x = interpreterMod(q.x, u[0], u[3], v[0]);
+                q.y = interpreterMod(q.y, u[1], u[3], v[0]);
+                q.z = interpreterMod(q.z, u[2], u[3], v[0]);
+            }
+            else if (op == FRAKTAL_OP_MOD_POLAR)
+            {
+                pModPolar(&q.x, &q.z, u[0]);
+            }
+            P[dst] = q;
+        }
+        else if (op < FRAKTAL_OP_UNION)
+        {
+            V3 q = P[a];
+            I d = iv(1e10f);
+            if      (op == FRAKTAL_OP_SPHERE)   d = fSphere(q, u[0]);
+            else if (op == FRAKTAL_OP_BOX)      d = fBox(q, u);
+            else if (op == FRAKTAL_OP_CYLINDER) d = fCylinder(q, u[0], u[1]);
+            else if (op == FRAKTAL_OP_CAPSULE)  d = fCapsule(q, u[0], u[1]);
+            else if (op == FRAKTAL_OP_TORUS)    d = fTorus(q, u[0], u[1]);
+            else if (op == FRAKTAL_OP_PLANE)    d = fPlane(q, u, u[3]);
+            else if (op == FRAKTAL_OP_CONE)     d = fCone(q, u[0], u[1]);
+            else if (op == FRAKTAL_OP_HEXAGON)  d = fHexagonCircumcircle(q, u[0], u[1]);
+            R[dst] = d;
+        }
+        else
+        {
+            I da = R[a];
+            I db = R[b];
+            float r = u[0];
+            I d = da;
+            if      (op == FRAKTAL_OP_UNION)                d = min(da, db);
+            else if (op == FRAKTAL_OP_INTERSECTION)         d = max(da, db);
+            else if (op == FRAKTAL_OP_DIFFERENCE)           d = max(da, -db);
+            else if (op == FRAKTAL_OP_UNION_ROUND)          d = fOpUnionRound(da, db, r);
+            else if (op == FRAKTAL_OP_INTERSECTION_ROUND)   d = fOpIntersectionRound(da, db, r);
+            else if (op == FRAKTAL_OP_DIFFERENCE_ROUND)     d = fOpDifferenceRound(da, db, r);
+            else if (op == FRAKTAL_OP_UNION_CHAMFER)        d = fOpUnionChamfer(da, db, r);
+            else if (op == FRAKTAL_OP_INTERSECTION_CHAMFER) d = fOpIntersectionChamfer(da, db, r);
+            else if (op == FRAKTAL_OP_DIFFERENCE_CHAMFER)   d = fOpDifferenceChamfer(da, db, r);
+            else if (op == FRAKTAL_OP_UNION_SOFT)           d = fOpUnionSoft(da, db, r);
+            else if (op == FRAKTAL_OP_OFFSET)               d = da - r;
+            else if (op == FRAKTAL_OP_DIST_SCALE)           d = da*r;
+            R[dst] = d;
+        }
+    }
+
+    // Widen the result to cover rounding differences between the interval
+    // bounds and the point evaluators
+    I d = R[0];
+    d.lo -= 1e-5f*max(1.0f, fabsf(d.lo));
+    d.hi += 1e-5f*max(1.0f, fabsf(d.hi));
+    return d;
+}
+
+static I eval_box(const float box_min[3], const float box_max[3], const fInstruction *code, int num_instructions)
+{
+    V3 p = v3(iv(box_min[0], box_max[0]), iv(box_min[1], box_max[1]), iv(box_min[2], box_max[2]));
+    return interpret(p, code, num_instructions);
+}
+
+struct Bounds
+{
+    float min[3];
+    float max[3];
+    bool empty;
+};
+
+// Subdivides cells that may contain the surface until max_depth is
+// reached, and grows 'bounds' by every cell that may be inside the model.
+// Cells that are entirely inside are added without subdivision.
+static void subdivide(Bounds *bounds, const float cell_min[3], const float cell_max[3], int depth, int max_depth,
+                      const fInstruction *code, int num_instructions)
+{
+    // Skip cells that cannot enlarge the bounds
+    if (!bounds->empty &&
+        cell_min[0] >= bounds->min[0] && cell_max[0] <= bounds->max[0] &&
+        cell_min[1] >= bounds->min[1] && cell_max[1] <= bounds->max[1] &&
+        cell_min[2] >= bounds->min[2] && cell_max[2] <= bounds->max[2])
+        return;
+
+    I d = eval_box(cell_min, cell_max, code, num_instructions);
+    if (d.lo > 0.0f)
+        return;
+
+    if (d.hi <= 0.0f || depth == max_depth)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            bounds->min[k] = bounds->empty ? cell_min[k] : min(bounds->min[k], cell_min[k]);
+            bounds->max[k] = bounds->empty ? cell_max[k] : max(bounds->max[k], cell_max[k]);
+        }
+        bounds->empty = false;
+        return;
+    }
+
+    float mid[3];
+    for (int k = 0; k < 3; k++)
+        mid[k] = 0.5f*(cell_min[k] + cell_max[k]);
+    for (int i = 0; i < 8; i++)
+    {
+        float child_min[3], child_max[3];
+        for (int k = 0; k < 3; k++)
+        {
+            bool upper = (i >> k) & 1;
+            child_min[k] = upper ? mid[k] : cell_min[k];
+            child_max[k] = upper ? cell_max[k] : mid[k];
+        }
+        subdivide(bounds, child_min, child_max, depth + 1, max_depth, code, num_instructions);
+    }
+}
+
+}
+
+void fraktal_cpu_eval_interval(float result[2], const float box_min[3], const float box_max[3], const fInstruction *code, int num_instructions)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(result);
+    fraktal_assert(box_min);
+    fraktal_assert(box_max);
+    fraktal_assert(box_min[0] <= box_max[0] && box_min[1] <= box_max[1] && box_min[2] <= box_max[2]);
+    fraktal_assert_valid_program(code, num_instructions);
+    fraktal_interval::I d = fraktal_interval::eval_box(box_min, box_max, code, num_instructions);
+    result[0] = d.lo;
+    result[1] = d.hi;
+}
+
+bool fraktal_cpu_bounds(float bounds_min[3], float bounds_max[3], const float region_min[3], const float region_max[3],
+                        int max_depth, const fInstruction *code, int num_instructions)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(bounds_min);
+    fraktal_assert(bounds_max);
+    fraktal_assert(region_min);
+    fraktal_assert(region_max);
+    fraktal_assert(region_min[0] <= region_max[0] && region_min[1] <= region_max[1] && region_min[2] <= region_max[2]);
+    fraktal_assert(max_depth >= 0);
+    fraktal_assert_valid_program(code, num_instructions);
+    fraktal_interval::Bounds bounds;
+    bounds.empty = true;
+    fraktal_interval::subdivide(&bounds, region_min, region_max, 0, max_depth, code, num_instructions);
+    if (bounds.empty)
+        return false;
+    for (int k = 0; k < 3; k++)
+    {
+        bounds_min[k] = bounds.min[k];
+        bounds_max[k] = bounds.max[k];
+    }
+    return true;
+}
@@ -0,0 +1,207 @@
+#pragma once
+#include "reuse/log.h"
+
+enum { FRAKTAL_MAX_REDUCE_LEVELS = 16 };
+
+// Intermediate arrays are kept between reductions and are only
+// reallocated when the input size changes. They are evicted (while
+// not reducing) when the memory budget is exceeded.
+static fArray *fraktal_reduce_levels[FRAKTAL_MAX_REDUCE_LEVELS];
+static bool fraktal_reducing = false;
+
+// Each thread combines a 4x4 block of the input (or 4 elements if the
+// input is 1D). If iOther is used, the absolute difference between the
+// two inputs is reduced instead.
+static const char *fraktal_reduce_source =
+    "uniform sampler1D iInput1D;\n"
+    "uniform sampler2D iInput2D;\n"
+    "uniform sampler1D iOther1D;\n"
+    "uniform sampler2D iOther2D;\n"
+    "uniform int       iIs1D;\n"
+    "uniform int       iHasOther;\n"
+    "uniform int       iMax;\n"
+    "uniform ivec2     iInputSize;\n"
+    "out vec4          fragColor;\n"
+    "vec4 fetch(ivec2 p)\n"
+    "{\n"
+    "    vec4 v = iIs1D == 1 ? texelFetch(iInput1D, p.x, 0) : texelFetch(iInput2D, p, 0);\n"
+    "    if (iHasOther == 1)\n"
+    "        v = abs(v - (iIs1D == 1 ? texelFetch(iOther1D, p.x, 0) : texelFetch(iOther2D, p, 0)));\n"
+    "    return v;\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "    ivec2 p0 = ivec2(gl_FragCoord.xy)*ivec2(4, iIs1D == 1 ? 1 : 4);\n"
+    "    ivec2 p1 = min(p0 + ivec2(4, iIs1D == 1 ? 1 : 4), iInputSize);\n"
+    "    vec4 r = fetch(p0);\n"
+    "    for (int y = p0.y; y < p1.y; y++)\n"
+    "    for (int x = p0.x; x < p1.x; x++)\n"
+    "    {\n"
+    "        if (x == p0.x && y == p0.y) continue;\n"
+    "        vec4 v = fetch(ivec2(x, y));\n"
+    "        r = iMax == 1 ? max(r, v) : r + v;\n"
+    "    }\n"
+    "    fragColor = r;\n"
+    "}\n";
+
+// Reduces 'a' (or |a - b| if 'b' is not NULL) down to a single value
+// per channel. The current kernel and the texture units used by the
+// reduction are restored on return.
+static void fraktal_reduce_internal(float result[4], fArray *a, fArray *b, fEnum op)
+{
+    fArray **levels = fraktal_reduce_levels;
+    static fKernel *reduce = NULL;
+    static int loc_iInput1D, loc_iInput2D, loc_iOther1D, loc_iOther2D;
+    static int loc_iIs1D, loc_iHasOther, loc_iMax, loc_iInputSize;
+    if (!reduce)
+    {
+        reduce = fraktal_link_builtin("built-in reduce kernel", fraktal_reduce_source);
+        loc_iInput1D = fraktal_get_param_offset(reduce, "iInput1D");
+        loc_iInput2D = fraktal_get_param_offset(reduce, "iInput2D");
+        loc_iOther1D = fraktal_get_param_offset(reduce, "iOther1D");
+        loc_iOther2D = fraktal_get_param_offset(reduce, "iOther2D");
+        loc_iIs1D = fraktal_get_param_offset(reduce, "iIs1D");
+        loc_iHasOther = fraktal_get_param_offset(reduce, "iHasOther");
+        loc_iMax = fraktal_get_param_offset(reduce, "iMax");
+        loc_iInputSize = fraktal_get_param_offset(reduce, "iInputSize");
+    }
+    fKernel *last_kernel = fraktal_current_kernel;
+
+    GLint last_texture_1d[FRAKTAL_MAX_PARAMS];
+    GLint last_texture_2d[FRAKTAL_MAX_PARAMS];
+    GLint last_active_texture; glGetIntegerv(GL_ACTIVE_TEXTURE, &last_active_texture);
+    for (int i = 0; i < reduce->params.sampler_count; i++)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glGetIntegerv(GL_TEXTURE_BINDING_1D, &last_texture_1d[i]);
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &last_texture_2d[i]);
+    }
+
+    fraktal_reducing = true;
+    fraktal_use_kernel(reduce);
+    fraktal_param_1i(loc_iMax, op == FRAKTAL_REDUCE_MAX ? 1 : 0);
+    fArray *input = a;
+    for (int level = 0; level < FRAKTAL_MAX_REDUCE_LEVELS; level++)
+    {
+        bool is_1d = input->height == 1;
+        int width = (input->width + 3)/4;
+        int height = is_1d ? 1 : (input->height + 3)/4;
+
+        fArray *out = levels[level];
+        if (!out || out->width != width || out->height != height)
+        {
+            fraktal_destroy_array(out);
+            out = fraktal_create_array(NULL, 4, width, height, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+            fraktal_assert(out && "Failed to create reduction array.");
+            levels[level] = out;
+        }
+
+        fraktal_param_array(is_1d ? loc_iInput1D : loc_iInput2D, input);
+        if (input == a && b)
+            fraktal_param_array(is_1d ? loc_iOther1D : loc_iOther2D, b);
+        fraktal_param_1i(loc_iHasOther, (input == a && b) ? 1 : 0);
+        fraktal_param_1i(loc_iIs1D, is_1d ? 1 : 0);
+        fraktal_param_2i(loc_iInputSize, input->width, input->height);
+        fraktal_zero_array(out);
+        fraktal_run_kernel(out);
+
+        input = out;
+        if (width == 1 && height == 1)
+            break;
+    }
+    fraktal_assert(input->width == 1 && input->height == 1 && "Array is too large to reduce.");
+    fraktal_use_kernel(last_kernel);
+
+    glActiveTexture(GL_TEXTURE0);
+    fraktal_to_cpu(result, input);
+    fraktal_reducing = false;
+    for (int i = 0; i < reduce->params.sampler_count; i++)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_1D, last_texture_1d[i]);
+        glBindTexture(GL_TEXTURE_2D, last_texture_2d[i]);
+    }
+    glActiveTexture(last_active_texture);
+    fraktal_check_gl_error();
+}
+
+void fraktal_reduce(float result[4], fArray *a, fEnum op)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(result);
+    fraktal_assert(fraktal_is_valid_array(a));
+    fraktal_assert(a->depth == 1 && "Array must be 1D or 2D.");
+    fraktal_assert(op == FRAKTAL_REDUCE_MAX || op == FRAKTAL_REDUCE_SUM);
+    fraktal_assert(!fraktal_recording && "Reductions cannot be recorded in a command list.");
+    fraktal_ensure_context();
+    fraktal_check_gl_error();
+    fraktal_reduce_internal(result, a, NULL, op);
+}
+
+// Runs a single step reading from 'src' and overwriting 'dst'. The offset
+// of iIteration is looked up by the caller for each call, since kernels
+// may be destroyed and a new one created at the same address.
+static void fraktal_iterate_step(int offset, int loc_iIteration, fArray *src, fArray *dst, int iteration)
+{
+    fraktal_param_array(offset, src);
+    fraktal_param_1i(loc_iIteration, iteration);
+    fraktal_zero_array(dst);
+    fraktal_run_kernel(dst);
+}
+
+static void fraktal_assert_iterate_arrays(fArray *a, fArray *b)
+{
+    fraktal_assert(fraktal_current_kernel && "Call fraktal_use_kernel first.");
+    fraktal_assert(fraktal_is_valid_array(a));
+    fraktal_assert(fraktal_is_valid_array(b));
+    fraktal_assert(a != b && "Iteration requires two different arrays.");
+    fraktal_assert(a->fbo && b->fbo && "The arrays' access modes cannot be read-only.");
+    fraktal_assert(a->width == b->width && a->height == b->height && a->depth == 1 && b->depth == 1 &&
+                   "The arrays must be 1D or 2D and of the same size.");
+}
+
+fArray *fraktal_iterate(int offset, fArray *a, fArray *b, int n)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert_iterate_arrays(a, b);
+    fraktal_assert(n >= 0);
+    int loc_iIteration = fraktal_get_param_offset(fraktal_current_kernel, "iIteration");
+    for (int i = 0; i < n; i++)
+    {
+        fraktal_iterate_step(offset, loc_iIteration, a, b, i);
+        fArray *t = a; a = b; b = t;
+    }
+    return a;
+}
+
+fArray *fraktal_iterate_until(int offset, fArray *a, fArray *b, int max_steps, int check_every, float tolerance, int *steps)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert_iterate_arrays(a, b);
+    fraktal_assert(max_steps >= 0);
+    fraktal_assert(check_every > 0);
+    fraktal_assert(!fraktal_recording && "Convergence checks cannot be recorded in a command list.");
+    int loc_iIteration = fraktal_get_param_offset(fraktal_current_kernel, "iIteration");
+    int i = 0;
+    while (i < max_steps)
+    {
+        fraktal_iterate_step(offset, loc_iIteration, a, b, i);
+        fArray *t = a; a = b; b = t;
+        i++;
+        if (i % check_every == 0 || i == max_steps)
+        {
+            // 'a' holds the result of the last step and 'b' its input
+            float change[4];
+            fraktal_reduce_internal(change, a, b, FRAKTAL_REDUCE_MAX);
+            float max_change = change[0];
+            for (int c = 1; c < a->channels; c++)
+                if (change[c] > max_change)
+                    max_change = change[c];
+            if (max_change <= tolerance)
+                break;
+        }
+    }
+    if (steps)
+        *steps = i;
+    return a;
+}
@@ -12,8 +12,24 @@ struct fKernel
 
 static fKernel *fraktal_current_kernel = NULL;
 
+static GLuint fraktal_get_quad_buffer()
+{
+    static GLuint quad = 0;
+    if (!quad)
+    {
+        static const float data[] = { -1,-1, +1,-1, +1,+1, +1,+1, -1,+1, -1,-1 };
+        glGenBuffers(1, &quad);
+        glBindBuffer(GL_ARRAY_BUFFER, quad);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    fraktal_assert(quad && "Failed to create vertex buffer");
+    return quad;
+}
+
 int fraktal_get_param_offset(fKernel *f, const char *name)
 {
+    FRAKTAL_TRACE_FUNCTION();
     fraktal_assert(name);
     fraktal_assert(f);
     fraktal_assert(f->program);
@@ -26,6 +42,16 @@ int fraktal_get_param_offset(fKernel *f, const char *name)
 
 void fraktal_use_kernel(fKernel *f)
 {
+    FRAKTAL_TRACE_FUNCTION();
+    if (fraktal_recording)
+    {
+        if (f)
+            fraktal_assert(f->program && "f must be a valid kernel object");
+        fraktal_current_kernel = f;
+        fraktal_record_command(FRAKTAL_COMMAND_USE_KERNEL, NULL, 0, -1, -1, NULL, NULL);
+        return;
+    }
+
     fraktal_ensure_context();
     fraktal_check_gl_error();
     static GLint last_program;
@@ -48,16 +74,7 @@ void fraktal_use_kernel(fKernel *f)
     static GLenum last_enable_color_logic_op;
     static GLuint vao = 0;
 
-    static GLuint quad = 0;
-    if (!quad)
-    {
-        static const float data[] = { -1,-1, +1,-1, +1,+1, +1,+1, -1,+1, -1,-1 };
-        glGenBuffers(1, &quad);
-        glBindBuffer(GL_ARRAY_BUFFER, quad);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-    }
-    fraktal_assert(quad && "Failed to create vertex buffer");
+    GLuint quad = fraktal_get_quad_buffer();
 
     if (f)
     {
@@ -70,8 +87,6 @@ void fraktal_use_kernel(fKernel *f)
         {
             fraktal_current_kernel = f;
             glUseProgram(f->program);
-            if (!f->loc_iPosition)
-                f->loc_iPosition = glGetAttribLocation(f->program, "iPosition");
             fraktal_assert(f->loc_iPosition >= 0);
             glEnableVertexAttribArray(f->loc_iPosition);
             glVertexAttribPointer(f->loc_iPosition, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 2, 0);
@@ -136,8 +151,6 @@ void fraktal_use_kernel(fKernel *f)
             glBindBuffer(GL_ARRAY_BUFFER, quad);
 
             glUseProgram(f->program);
-            if (!f->loc_iPosition)
-                f->loc_iPosition = glGetAttribLocation(f->program, "iPosition");
             fraktal_assert(f->loc_iPosition >= 0);
             glEnableVertexAttribArray(f->loc_iPosition);
             glVertexAttribPointer(f->loc_iPosition, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 2, 0);
@@ -150,19 +163,70 @@ void fraktal_use_kernel(fKernel *f)
     fraktal_check_gl_error();
 }
 
-void fraktal_param_1f(int offset, float x)                            { fraktal_assert(fraktal_current_kernel); if (offset < 0) return; glUniform1f(offset, x); }
-void fraktal_param_2f(int offset, float x, float y)                   { fraktal_assert(fraktal_current_kernel); if (offset < 0) return; glUniform2f(offset, x, y); }
-void fraktal_param_3f(int offset, float x, float y, float z)          { fraktal_assert(fraktal_current_kernel); if (offset < 0) return; glUniform3f(offset, x, y, z); }
-void fraktal_param_4f(int offset, float x, float y, float z, float w) { fraktal_assert(fraktal_current_kernel); if (offset < 0) return; glUniform4f(offset, x, y, z, w); }
-void fraktal_param_1i(int offset, int x)                              { fraktal_assert(fraktal_current_kernel); if (offset < 0) return; glUniform1i(offset, x); }
-void fraktal_param_2i(int offset, int x, int y)                       { fraktal_assert(fraktal_current_kernel); if (offset < 0) return; glUniform2i(offset, x, y); }
-void fraktal_param_3i(int offset, int x, int y, int z)                { fraktal_assert(fraktal_current_kernel); if (offset < 0) return; glUniform3i(offset, x, y, z); }
-void fraktal_param_4i(int offset, int x, int y, int z, int w)         { fraktal_assert(fraktal_current_kernel); if (offset < 0) return; glUniform4i(offset, x, y, z, w); }
-void fraktal_param_matrix4f(int offset, float m[4*4])                 { fraktal_assert(fraktal_current_kernel); if (offset < 0) return; glUniformMatrix4fv(offset, 1, false, m); }
-void fraktal_param_transpose_matrix4f(int offset, float m[4*4])       { fraktal_assert(fraktal_current_kernel); if (offset < 0) return; glUniformMatrix4fv(offset, 1, true, m); }
+// Applies a parameter value to the program currently in use. 'f' holds
+// float values (matrices in column major order) and 'i' holds int values.
+static void fraktal_apply_param(fParamType type, int offset, const float *f, const int *i)
+{
+    switch (type)
+    {
+        case FRAKTAL_PARAM_FLOAT:      glUniform1f(offset, f[0]); break;
+        case FRAKTAL_PARAM_FLOAT_VEC2: glUniform2f(offset, f[0], f[1]); break;
+        case FRAKTAL_PARAM_FLOAT_VEC3: glUniform3f(offset, f[0], f[1], f[2]); break;
+        case FRAKTAL_PARAM_FLOAT_VEC4: glUniform4f(offset, f[0], f[1], f[2], f[3]); break;
+        case FRAKTAL_PARAM_FLOAT_MAT4: glUniformMatrix4fv(offset, 1, false, f); break;
+        case FRAKTAL_PARAM_INT:        glUniform1i(offset, i[0]); break;
+        case FRAKTAL_PARAM_INT_VEC2:   glUniform2i(offset, i[0], i[1]); break;
+        case FRAKTAL_PARAM_INT_VEC3:   glUniform3i(offset, i[0], i[1], i[2]); break;
+        case FRAKTAL_PARAM_INT_VEC4:   glUniform4i(offset, i[0], i[1], i[2], i[3]); break;
+        default: fraktal_assert(false && "Unsupported parameter type.");
+    }
+}
+
+static void fraktal_set_param(fParamType type, int offset, const float *f, const int *i)
+{
+    FRAKTAL_TRACE_SCOPE("fraktal_param");
+    fraktal_assert(fraktal_current_kernel);
+    if (offset < 0)
+        return;
+    if (fraktal_recording)
+        fraktal_record_command(FRAKTAL_COMMAND_PARAM, NULL, type, offset, -1, f, i);
+    else
+        fraktal_apply_param(type, offset, f, i);
+}
+
+void fraktal_param_1f(int offset, float x)                            { float v[] = { x };          fraktal_set_param(FRAKTAL_PARAM_FLOAT, offset, v, NULL); }
+void fraktal_param_2f(int offset, float x, float y)                   { float v[] = { x, y };       fraktal_set_param(FRAKTAL_PARAM_FLOAT_VEC2, offset, v, NULL); }
+void fraktal_param_3f(int offset, float x, float y, float z)          { float v[] = { x, y, z };    fraktal_set_param(FRAKTAL_PARAM_FLOAT_VEC3, offset, v, NULL); }
+void fraktal_param_4f(int offset, float x, float y, float z, float w) { float v[] = { x, y, z, w }; fraktal_set_param(FRAKTAL_PARAM_FLOAT_VEC4, offset, v, NULL); }
+void fraktal_param_1i(int offset, int x)                              { int v[] = { x };            fraktal_set_param(FRAKTAL_PARAM_INT, offset, NULL, v); }
+void fraktal_param_2i(int offset, int x, int y)                       { int v[] = { x, y };         fraktal_set_param(FRAKTAL_PARAM_INT_VEC2, offset, NULL, v); }
+void fraktal_param_3i(int offset, int x, int y, int z)                { int v[] = { x, y, z };      fraktal_set_param(FRAKTAL_PARAM_INT_VEC3, offset, NULL, v); }
+void fraktal_param_4i(int offset, int x, int y, int z, int w)         { int v[] = { x, y, z, w };   fraktal_set_param(FRAKTAL_PARAM_INT_VEC4, offset, NULL, v); }
+void fraktal_param_matrix4f(int offset, float m[4*4])                 { fraktal_set_param(FRAKTAL_PARAM_FLOAT_MAT4, offset, m, NULL); }
+void fraktal_param_transpose_matrix4f(int offset, float m[4*4])
+{
+    FRAKTAL_TRACE_FUNCTION();
+    float t[4*4];
+    for (int row = 0; row < 4; row++)
+    for (int col = 0; col < 4; col++)
+        t[row + 4*col] = m[col + 4*row];
+    fraktal_set_param(FRAKTAL_PARAM_FLOAT_MAT4, offset, t, NULL);
+}
+
+static void fraktal_bind_array(int tex_unit, fArray *a)
+{
+    glActiveTexture(GL_TEXTURE0 + tex_unit);
+    if (a->depth > 1)
+        glBindTexture(GL_TEXTURE_3D, a->color0);
+    else if (a->height > 1)
+        glBindTexture(GL_TEXTURE_2D, a->color0);
+    else
+        glBindTexture(GL_TEXTURE_1D, a->color0);
+}
 
 void fraktal_param_array(int offset, fArray *a)
 {
+    FRAKTAL_TRACE_FUNCTION();
     fraktal_assert(a);
     fraktal_assert(a->color0);
     fraktal_assert(a->width > 0 && a->height > 0 && a->depth > 0 && "Array has invalid dimensions.");
@@ -177,20 +241,18 @@ void fraktal_param_array(int offset, fArray *a)
                 tex_unit = p->assigned_tex_unit[i];
         fraktal_assert(tex_unit >= 0 && "Array parameter with unassigned texture unit.");
     }
+    if (fraktal_recording)
+    {
+        fraktal_record_command(FRAKTAL_COMMAND_PARAM_ARRAY, a, FRAKTAL_PARAM_SAMPLER2D, offset, tex_unit, NULL, NULL);
+        return;
+    }
     glUniform1i(offset, tex_unit);
-    glActiveTexture(GL_TEXTURE0 + tex_unit);
-    if (a->width > 1 && a->height > 1 && a->depth > 1)
-        glBindTexture(GL_TEXTURE_3D, a->color0);
-    else if (a->width > 1 && a->height > 1)
-        glBindTexture(GL_TEXTURE_2D, a->color0);
-    else if (a->width > 1)
-        glBindTexture(GL_TEXTURE_1D, a->color0);
-    else
-        fraktal_assert(false && "Invalid array dimensions");
+    fraktal_bind_array(tex_unit, a);
 }
 
-void fraktal_run_kernel(fArray *out)
+void fraktal_run_kernel_n(fArray *out, int n)
 {
+    FRAKTAL_TRACE_FUNCTION();
     fraktal_assert(fraktal_current_kernel && "Call fraktal_use_kernel first.");
     fraktal_assert(out);
     fraktal_assert(out->width > 0);
@@ -198,14 +260,35 @@ void fraktal_run_kernel(fArray *out)
     fraktal_assert(out->depth == 1 && "Output array must be 1D or 2D.");
     fraktal_assert(out->fbo && "The output array's access mode cannot be read-only.");
     fraktal_assert(out->color0);
+    fraktal_assert(n >= 0);
+    if (n == 0)
+        return;
+    if (fraktal_recording)
+    {
+        int count[4] = { n };
+        fraktal_record_command(FRAKTAL_COMMAND_RUN_KERNEL, out, 0, -1, -1, NULL, count);
+        return;
+    }
     fraktal_ensure_context();
     fraktal_check_gl_error();
 
+    FRAKTAL_TRACE_GPU_SCOPE("fraktal_run_kernel");
     glBindFramebuffer(GL_FRAMEBUFFER, out->fbo);
     if (out->height == 0)
         glViewport(0, 0, out->width, 1);
     else
         glViewport(0, 0, out->width, out->height);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    // Each instance covers the whole output and is blended additively,
+    // while gl_InstanceID is passed to the kernel as iSampleIndex.
+    if (n == 1)
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+    else
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, n);
     fraktal_check_gl_error();
 }
+
+void fraktal_run_kernel(fArray *out)
+{
+    fraktal_run_kernel_n(out, 1);
+}
@@ -14,6 +14,7 @@ struct fLinkState
 
 static GLuint compile_shader(const char *name, const char **sources, int num_sources, GLenum type)
 {
+    FRAKTAL_TRACE_FUNCTION();
     fraktal_ensure_context();
     fraktal_check_gl_error();
     fraktal_assert(sources && "Missing shader source list");
@@ -84,6 +85,7 @@ static bool add_link_data(fLinkState *link, char *data, const char *name)
         link->glsl_version,
         "\nuniform int Dummy;\n"
         "#define ZERO (min(0, Dummy))\n"
+        "flat in int iSampleIndex;\n"
         #ifdef FRAKTAL_GUI
         "#define FRAKTAL_GUI\n"
         #endif
@@ -101,6 +103,7 @@ static bool add_link_data(fLinkState *link, char *data, const char *name)
 
 fLinkState *fraktal_create_link()
 {
+    FRAKTAL_TRACE_FUNCTION();
     fraktal_ensure_context();
     fLinkState *link = (fLinkState*)malloc(sizeof(fLinkState));
     link->num_shaders = 0;
@@ -112,6 +115,7 @@ fLinkState *fraktal_create_link()
 
 void fraktal_destroy_link(fLinkState *link)
 {
+    FRAKTAL_TRACE_FUNCTION();
     if (link)
     {
         fraktal_ensure_context();
@@ -126,6 +130,7 @@ void fraktal_destroy_link(fLinkState *link)
 
 bool fraktal_add_link_data(fLinkState *link, const char *data, unsigned int size, const char *name)
 {
+    FRAKTAL_TRACE_FUNCTION();
     // cannot assume that we are allowed to modify user data, so we make a copy.
     if (size == 0) size = (unsigned int)strlen(data);
     char *copy = (char*)malloc(size + 1);
@@ -138,6 +143,7 @@ bool fraktal_add_link_data(fLinkState *link, const char *data, unsigned int size
 
 bool fraktal_add_link_file(fLinkState *link, const char *path)
 {
+    FRAKTAL_TRACE_FUNCTION();
     char *data = read_file(path);
     if (!data)
     {
@@ -151,6 +157,7 @@ bool fraktal_add_link_file(fLinkState *link, const char *path)
 
 fKernel *fraktal_link_kernel(fLinkState *link)
 {
+    FRAKTAL_TRACE_FUNCTION();
     fraktal_assert(link);
     fraktal_ensure_context();
     fraktal_check_gl_error();
@@ -162,8 +169,10 @@ fKernel *fraktal_link_kernel(fLinkState *link)
     {
         static const char *source =
             "in vec2 iPosition;\n"
+            "flat out int iSampleIndex;\n"
             "void main()\n"
             "{\n"
+            "    iSampleIndex = gl_InstanceID;\n"
             "    gl_Position = vec4(iPosition, 0.0, 1.0);\n"
             "}\n"
         ;
@@ -193,10 +202,12 @@ fKernel *fraktal_link_kernel(fLinkState *link)
     }
 
     fKernel *kernel = (fKernel*)malloc(sizeof(fKernel));
+    fraktal_memory.host_bytes += sizeof(fKernel);
+    fraktal_memory.num_kernels++;
     kernel->program = program;
     kernel->params.count = link->params.count;
     kernel->params.sampler_count = link->params.sampler_count;
-    kernel->loc_iPosition = 0;
+    kernel->loc_iPosition = glGetAttribLocation(program, "iPosition");
     for (int i = 0; i < link->params.count; i++)
     {
         strcpy(kernel->params.name[i], link->params.name[i]);
@@ -208,6 +219,24 @@ fKernel *fraktal_link_kernel(fLinkState *link)
         kernel->params.std140_offset[i] = link->params.std140_offset[i];
         kernel->params.std140_size[i] = link->params.std140_size[i];
     }
+
+    // Point each sampler at its assigned texture unit, so that unused
+    // samplers of different types never share the default unit 0.
+    {
+        GLint last_program; glGetIntegerv(GL_CURRENT_PROGRAM, &last_program);
+        glUseProgram(program);
+        for (int i = 0; i < kernel->params.count; i++)
+        {
+            fParamType type = kernel->params.type[i];
+            if ((type == FRAKTAL_PARAM_SAMPLER1D ||
+                 type == FRAKTAL_PARAM_SAMPLER2D ||
+                 type == FRAKTAL_PARAM_SAMPLER3D) &&
+                kernel->params.offset[i] >= 0)
+                glUniform1i(kernel->params.offset[i], kernel->params.assigned_tex_unit[i]);
+        }
+        glUseProgram(last_program);
+    }
+
     // print kernel information
     #if 0
     {
@@ -233,19 +262,36 @@ fKernel *fraktal_link_kernel(fLinkState *link)
 
 void fraktal_destroy_kernel(fKernel *f)
 {
+    FRAKTAL_TRACE_FUNCTION();
     if (f)
     {
         fraktal_ensure_context();
         fraktal_check_gl_error();
         if (f->program)
             glDeleteProgram(f->program);
+        fraktal_memory.host_bytes -= sizeof(fKernel);
+        fraktal_memory.num_kernels--;
         free(f);
         fraktal_check_gl_error();
     }
 }
 
+// Links a kernel whose source is embedded in the library. These are
+// expected to always compile, so failure triggers an assertion.
+static fKernel *fraktal_link_builtin(const char *name, const char *source)
+{
+    fLinkState *link = fraktal_create_link();
+    fKernel *f = NULL;
+    if (fraktal_add_link_data(link, source, 0, name))
+        f = fraktal_link_kernel(link);
+    fraktal_destroy_link(link);
+    fraktal_assert(f && "Failed to link built-in kernel.");
+    return f;
+}
+
 fKernel *fraktal_load_kernel(const char *path)
 {
+    FRAKTAL_TRACE_FUNCTION();
     fraktal_assert(path);
     fLinkState *link = fraktal_create_link();
     fraktal_add_link_file(link, path);
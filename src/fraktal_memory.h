@@ -0,0 +1,35 @@
+#pragma once
+#include "reuse/log.h"
+
+// Frees arrays that fraktal keeps around only to avoid reallocation:
+// transient arrays of render graphs and intermediate reduction arrays.
+// They are recreated on demand the next time they are needed.
+static void fraktal_evict_pooled_arrays()
+{
+    for (fRenderGraph *g = fraktal_graphs; g; g = g->next)
+        if (g != fraktal_active_graph)
+            fraktal_release_graph_pool(g);
+    if (!fraktal_reducing)
+    {
+        for (int i = 0; i < FRAKTAL_MAX_REDUCE_LEVELS; i++)
+        {
+            fraktal_destroy_array(fraktal_reduce_levels[i]);
+            fraktal_reduce_levels[i] = NULL;
+        }
+    }
+}
+
+void fraktal_get_memory_stats(fMemoryStats *stats)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(stats);
+    *stats = fraktal_memory;
+}
+
+void fraktal_set_memory_budget(size_t bytes)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_memory.budget = bytes;
+    if (bytes > 0 && fraktal_memory.array_bytes > bytes)
+        fraktal_evict_pooled_arrays();
+}
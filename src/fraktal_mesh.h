@@ -0,0 +1,581 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include "reuse/log.h"
+
+enum { FRAKTAL_MESH_CHUNK = 64 };                        // voxels along each side of a chunk
+enum { FRAKTAL_MESH_CHUNK_SAMPLES = FRAKTAL_MESH_CHUNK + 1 };
+
+// A cube is split into six tetrahedra that share its main diagonal (from
+// corner 0 to 7). Corner bits are (x,y,z). Neighboring cubes split their
+// shared faces along the same diagonal, so the mesh has no cracks.
+static const int fraktal_mesh_tets[6][4] = {
+    { 0, 1, 3, 7 }, { 0, 1, 5, 7 }, { 0, 2, 3, 7 },
+    { 0, 2, 6, 7 }, { 0, 4, 5, 7 }, { 0, 4, 6, 7 },
+};
+
+struct fMeshJob
+{
+    int chunk[3];   // chunk index
+    int voxels[3];  // voxels to triangulate in this chunk (at most FRAKTAL_MESH_CHUNK)
+    float *samples; // FRAKTAL_MESH_CHUNK_SAMPLES^3 distances, x-major
+};
+
+struct fMeshWriter
+{
+    FILE *file;
+    FILE *faces;    // PLY faces are written after all vertices
+    fEnum format;
+    uint64_t num_vertices;
+    uint64_t num_faces;
+    bool failed;
+    std::mutex mutex;
+};
+
+// Jobs are produced by the thread that owns the GPU context and consumed
+// by the workers. The queue is bounded, so the number of chunks held in
+// memory does not depend on the grid resolution.
+struct fMeshQueue
+{
+    std::deque<fMeshJob> jobs;
+    size_t capacity;
+    bool done;
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+};
+
+struct fMeshChunk
+{
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    std::unordered_map<uint32_t, uint32_t> edge_to_vertex;
+};
+
+// Returns the index of the vertex on the grid edge from corner a to b of
+// the cube at (x,y,z), creating it if no triangle has used the edge yet.
+static uint32_t fraktal_mesh_vertex(fMeshChunk *chunk, const fMeshJob *job, const float origin[3], float spacing,
+                                    int x, int y, int z, int a, int b, float da, float db)
+{
+    // Corner a is always a subset of corner b, so the edge is identified
+    // by its lower endpoint and the direction b^a.
+    const int S = FRAKTAL_MESH_CHUNK_SAMPLES;
+    int ax = x + (a & 1), ay = y + ((a >> 1) & 1), az = z + ((a >> 2) & 1);
+    uint32_t key = (uint32_t)(((az*S + ay)*S + ax)*8 + (b ^ a));
+    std::unordered_map<uint32_t, uint32_t>::iterator it = chunk->edge_to_vertex.find(key);
+    if (it != chunk->edge_to_vertex.end())
+        return it->second;
+
+    float t = da/(da - db);
+    int bx = x + (b & 1), by = y + ((b >> 1) & 1), bz = z + ((b >> 2) & 1);
+    int base[3] = { job->chunk[0]*FRAKTAL_MESH_CHUNK, job->chunk[1]*FRAKTAL_MESH_CHUNK, job->chunk[2]*FRAKTAL_MESH_CHUNK };
+    chunk->vertices.push_back(origin[0] + spacing*(base[0] + ax + t*(bx - ax)));
+    chunk->vertices.push_back(origin[1] + spacing*(base[1] + ay + t*(by - ay)));
+    chunk->vertices.push_back(origin[2] + spacing*(base[2] + az + t*(bz - az)));
+    uint32_t index = (uint32_t)(chunk->vertices.size()/3 - 1);
+    chunk->edge_to_vertex[key] = index;
+    return index;
+}
+
+// Adds triangle (i0,i1,i2), flipped if needed so that its normal points
+// along 'outward'.
+static void fraktal_mesh_triangle(fMeshChunk *chunk, uint32_t i0, uint32_t i1, uint32_t i2, const float outward[3])
+{
+    const float *v = &chunk->vertices[0];
+    float e1[3], e2[3];
+    for (int k = 0; k < 3; k++)
+    {
+        e1[k] = v[3*i1 + k] - v[3*i0 + k];
+        e2[k] = v[3*i2 + k] - v[3*i0 + k];
+    }
+    float n[3] = { e1[1]*e2[2] - e1[2]*e2[1], e1[2]*e2[0] - e1[0]*e2[2], e1[0]*e2[1] - e1[1]*e2[0] };
+    bool flip = n[0]*outward[0] + n[1]*outward[1] + n[2]*outward[2] < 0.0f;
+    chunk->indices.push_back(i0);
+    chunk->indices.push_back(flip ? i2 : i1);
+    chunk->indices.push_back(flip ? i1 : i2);
+}
+
+// Marching tetrahedra over the voxels of one chunk
+static void fraktal_mesh_triangulate(fMeshChunk *chunk, const fMeshJob *job, const float origin[3], float spacing)
+{
+    const int S = FRAKTAL_MESH_CHUNK_SAMPLES;
+    const float *d = job->samples;
+    for (int z = 0; z < job->voxels[2]; z++)
+    for (int y = 0; y < job->voxels[1]; y++)
+    for (int x = 0; x < job->voxels[0]; x++)
+    {
+        float corner[8];
+        int num_inside = 0;
+        for (int c = 0; c < 8; c++)
+        {
+            corner[c] = d[((z + ((c >> 2) & 1))*S + y + ((c >> 1) & 1))*S + x + (c & 1)];
+            if (corner[c] < 0.0f)
+                num_inside++;
+        }
+        if (num_inside == 0 || num_inside == 8)
+            continue;
+
+        for (int t = 0; t < 6; t++)
+        {
+            int in[4], out[4];
+            int num_in = 0, num_out = 0;
+            for (int k = 0; k < 4; k++)
+            {
+                int c = fraktal_mesh_tets[t][k];
+                if (corner[c] < 0.0f) in[num_in++] = c;
+                else out[num_out++] = c;
+            }
+            if (num_in == 0 || num_out == 0)
+                continue;
+
+            // From the centroid of the inside corners to that of the outside corners
+            float outward[3] = { 0.0f, 0.0f, 0.0f };
+            for (int k = 0; k < 3; k++)
+            {
+                for (int i = 0; i < num_in; i++) outward[k] -= (float)((in[i] >> k) & 1)/num_in;
+                for (int i = 0; i < num_out; i++) outward[k] += (float)((out[i] >> k) & 1)/num_out;
+            }
+
+            // Edges are ordered from the lower to the higher corner
+            #define EDGE(a, b) ((a) < (b) ? \
+                fraktal_mesh_vertex(chunk, job, origin, spacing, x, y, z, (a), (b), corner[a], corner[b]) : \
+                fraktal_mesh_vertex(chunk, job, origin, spacing, x, y, z, (b), (a), corner[b], corner[a]))
+            if (num_in == 1)
+            {
+                fraktal_mesh_triangle(chunk, EDGE(in[0], out[0]), EDGE(in[0], out[1]), EDGE(in[0], out[2]), outward);
+            }
+            else if (num_in == 3)
+            {
+                fraktal_mesh_triangle(chunk, EDGE(in[0], out[0]), EDGE(in[1], out[0]), EDGE(in[2], out[0]), outward);
+            }
+            else
+            {
+                uint32_t q0 = EDGE(in[0], out[0]);
+                uint32_t q1 = EDGE(in[0], out[1]);
+                uint32_t q2 = EDGE(in[1], out[1]);
+                uint32_t q3 = EDGE(in[1], out[0]);
+                fraktal_mesh_triangle(chunk, q0, q1, q2, outward);
+                fraktal_mesh_triangle(chunk, q0, q2, q3, outward);
+            }
+            #undef EDGE
+        }
+    }
+}
+
+static void fraktal_mesh_write(fMeshWriter *w, fMeshChunk *chunk)
+{
+    size_t num_vertices = chunk->vertices.size()/3;
+    size_t num_faces = chunk->indices.size()/3;
+    if (num_faces == 0)
+        return;
+    std::lock_guard<std::mutex> lock(w->mutex);
+    if (w->failed)
+        return;
+    uint64_t offset = w->num_vertices;
+    bool ok = true;
+    if (w->format == FRAKTAL_OBJ)
+    {
+        // OBJ indices are global and 1-based, so vertices and faces of
+        // each chunk can be written as soon as the chunk is done.
+        for (size_t i = 0; i < num_vertices; i++)
+        {
+            const float *v = &chunk->vertices[3*i];
+            ok = ok && fprintf(w->file, "v %.7g %.7g %.7g\n", v[0], v[1], v[2]) > 0;
+        }
+        for (size_t i = 0; i < num_faces; i++)
+        {
+            const uint32_t *f = &chunk->indices[3*i];
+            ok = ok && fprintf(w->file, "f %llu %llu %llu\n",
+                (unsigned long long)(offset + f[0] + 1),
+                (unsigned long long)(offset + f[1] + 1),
+                (unsigned long long)(offset + f[2] + 1)) > 0;
+        }
+    }
+    else
+    {
+        ok = fwrite(&chunk->vertices[0], 3*sizeof(float), num_vertices, w->file) == num_vertices;
+        for (size_t i = 0; i < num_faces && ok; i++)
+        {
+            unsigned char count = 3;
+            int32_t f[3];
+            for (int k = 0; k < 3; k++)
+                f[k] = (int32_t)(offset + chunk->indices[3*i + k]);
+            ok = fwrite(&count, 1, 1, w->faces) == 1 && fwrite(f, sizeof(f), 1, w->faces) == 1;
+        }
+    }
+    if (!ok)
+        w->failed = true;
+    w->num_vertices += num_vertices;
+    w->num_faces += num_faces;
+}
+
+struct fMeshWorkerArgs
+{
+    fMeshQueue *queue;
+    fMeshWriter *writer;
+    float origin[3];
+    float spacing;
+};
+
+static void fraktal_mesh_worker(fMeshWorkerArgs *args)
+{
+    fMeshChunk chunk;
+    for (;;)
+    {
+        fMeshJob job;
+        {
+            std::unique_lock<std::mutex> lock(args->queue->mutex);
+            while (args->queue->jobs.empty() && !args->queue->done)
+                args->queue->not_empty.wait(lock);
+            if (args->queue->jobs.empty())
+                return;
+            job = args->queue->jobs.front();
+            args->queue->jobs.pop_front();
+        }
+        args->queue->not_full.notify_one();
+
+        FRAKTAL_TRACE_SCOPE("fraktal_mesh_triangulate");
+        chunk.vertices.clear();
+        chunk.indices.clear();
+        chunk.edge_to_vertex.clear();
+        fraktal_mesh_triangulate(&chunk, &job, args->origin, args->spacing);
+        free(job.samples);
+        fraktal_mesh_write(args->writer, &chunk);
+    }
+}
+
+static void fraktal_mesh_push(fMeshQueue *queue, fMeshJob job)
+{
+    {
+        std::unique_lock<std::mutex> lock(queue->mutex);
+        while (queue->jobs.size() >= queue->capacity)
+            queue->not_full.wait(lock);
+        queue->jobs.push_back(job);
+    }
+    queue->not_empty.notify_one();
+}
+
+// The vertex and face counts are zero-padded to a fixed width, so that
+// the header can be rewritten in place once the counts are known.
+static void fraktal_mesh_write_ply_header(FILE *f, uint64_t num_vertices, uint64_t num_faces)
+{
+    fprintf(f,
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex %020llu\n"
+        "property float x\n"
+        "property float y\n"
+        "property float z\n"
+        "element face %020llu\n"
+        "property list uchar int vertex_indices\n"
+        "end_header\n",
+        (unsigned long long)num_vertices,
+        (unsigned long long)num_faces);
+}
+
+// Appends the PLY faces that were buffered in a temporary file
+static bool fraktal_mesh_append_faces(fMeshWriter *w)
+{
+    char buffer[65536];
+    rewind(w->faces);
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), w->faces)) > 0)
+        if (fwrite(buffer, 1, n, w->file) != n)
+            return false;
+    return !ferror(w->faces);
+}
+
+// Evaluates the current kernel (linked with libf/grid.f) on size^3 grid
+// points and reads the result back into 'samples' (x-major).
+static void fraktal_sample_grid(fArray *out, float *texels, float *samples, int size, const float origin[3], float spacing,
+                                int loc_origin, int loc_spacing, int loc_size, int loc_tiles_x)
+{
+    int tiles_x = out->width/size;
+    fraktal_param_3f(loc_origin, origin[0], origin[1], origin[2]);
+    fraktal_param_1f(loc_spacing, spacing);
+    fraktal_param_1i(loc_size, size);
+    fraktal_param_1i(loc_tiles_x, tiles_x);
+    fraktal_zero_array(out);
+    fraktal_run_kernel(out);
+    fraktal_to_cpu(texels, out);
+    for (int z = 0; z < size; z++)
+    for (int y = 0; y < size; y++)
+    {
+        int tx = (z % tiles_x)*size;
+        int ty = (z / tiles_x)*size + y;
+        memcpy(samples + (z*size + y)*size, texels + ty*out->width + tx, size*sizeof(float));
+    }
+}
+
+// Creates an array that holds size^3 samples as z-slices in a grid of tiles
+static fArray *fraktal_create_grid_tiles(int size)
+{
+    int tiles_x = (int)ceil(sqrt((double)size));
+    int tiles_y = (size + tiles_x - 1)/tiles_x;
+    return fraktal_create_array(NULL, 1, tiles_x*size, tiles_y*size, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+}
+
+bool fraktal_extract_mesh(const char *path, fEnum format, const float bounds_min[3], const float bounds_max[3],
+                          int resolution, float lipschitz, int num_threads)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(fraktal_current_kernel && "Call fraktal_use_kernel first.");
+    fraktal_assert(path);
+    fraktal_assert(format == FRAKTAL_PLY || format == FRAKTAL_OBJ);
+    fraktal_assert(bounds_min && bounds_max);
+    fraktal_assert(bounds_min[0] < bounds_max[0] && bounds_min[1] < bounds_max[1] && bounds_min[2] < bounds_max[2]);
+    fraktal_assert(resolution > 0);
+    fraktal_assert(lipschitz > 0.0f);
+    fraktal_assert(num_threads >= 0);
+    fraktal_assert(!fraktal_recording && "Mesh extraction cannot be recorded in a command list.");
+
+    fKernel *f = fraktal_current_kernel;
+    int loc_origin = fraktal_get_param_offset(f, "iGridOrigin");
+    int loc_spacing = fraktal_get_param_offset(f, "iGridSpacing");
+    int loc_size = fraktal_get_param_offset(f, "iGridSize");
+    int loc_tiles_x = fraktal_get_param_offset(f, "iTilesX");
+    if (loc_origin < 0 || loc_spacing < 0 || loc_size < 0 || loc_tiles_x < 0)
+    {
+        log_err("Failed to extract mesh: the current kernel must be linked with libf/grid.f.\n");
+        return false;
+    }
+
+    // Voxels are cubes; 'resolution' is the number of voxels along the
+    // longest side of the bounds.
+    float extent = 0.0f;
+    for (int k = 0; k < 3; k++)
+        if (bounds_max[k] - bounds_min[k] > extent)
+            extent = bounds_max[k] - bounds_min[k];
+    float spacing = extent/resolution;
+    int voxels[3], chunks[3];
+    int max_chunks = 0;
+    for (int k = 0; k < 3; k++)
+    {
+        voxels[k] = (int)ceil((bounds_max[k] - bounds_min[k])/spacing - 1e-3f);
+        if (voxels[k] < 1) voxels[k] = 1;
+        chunks[k] = (voxels[k] + FRAKTAL_MESH_CHUNK - 1)/FRAKTAL_MESH_CHUNK;
+        if (chunks[k] > max_chunks) max_chunks = chunks[k];
+    }
+
+    fMeshWriter writer;
+    writer.file = fopen(path, format == FRAKTAL_OBJ ? "w" : "wb");
+    writer.faces = NULL;
+    writer.format = format;
+    writer.num_vertices = 0;
+    writer.num_faces = 0;
+    writer.failed = false;
+    if (!writer.file)
+    {
+        log_err("Failed to extract mesh: could not open '%s' for writing.\n", path);
+        return false;
+    }
+    if (format == FRAKTAL_PLY)
+    {
+        writer.faces = tmpfile();
+        if (!writer.faces)
+        {
+            log_err("Failed to extract mesh: could not create a temporary file.\n");
+            fclose(writer.file);
+            return false;
+        }
+        fraktal_mesh_write_ply_header(writer.file, 0, 0);
+    }
+
+    fArray *chunk_array = fraktal_create_grid_tiles(FRAKTAL_MESH_CHUNK_SAMPLES);
+    fArray *coarse_array = fraktal_create_grid_tiles(max_chunks);
+    if (!chunk_array || !coarse_array)
+    {
+        log_err("Failed to extract mesh: could not create sample arrays.\n");
+        fraktal_destroy_array(chunk_array);
+        fraktal_destroy_array(coarse_array);
+        if (writer.faces)
+            fclose(writer.faces);
+        fclose(writer.file);
+        return false;
+    }
+    float *texels = (float*)malloc(chunk_array->width*chunk_array->height*sizeof(float));
+    float *coarse = (float*)malloc(max_chunks*max_chunks*max_chunks*sizeof(float));
+    float *coarse_texels = (float*)malloc(coarse_array->width*coarse_array->height*sizeof(float));
+    fraktal_assert(texels && coarse && coarse_texels && "Ran out of memory");
+
+    // Coarse pass: the distance at the center of each chunk. If the model
+    // is Lipschitz with constant 'lipschitz', a chunk can only contain the
+    // surface if the distance at its center is within its half-diagonal.
+    float chunk_size = spacing*FRAKTAL_MESH_CHUNK;
+    float coarse_origin[3];
+    for (int k = 0; k < 3; k++)
+        coarse_origin[k] = bounds_min[k] + 0.5f*chunk_size;
+    fraktal_sample_grid(coarse_array, coarse_texels, coarse, max_chunks, coarse_origin, chunk_size,
+                        loc_origin, loc_spacing, loc_size, loc_tiles_x);
+    float cull_distance = lipschitz*0.5f*sqrtf(3.0f)*chunk_size;
+
+    if (num_threads == 0)
+        num_threads = (int)std::thread::hardware_concurrency();
+    if (num_threads < 1)
+        num_threads = 1;
+
+    fMeshQueue queue;
+    queue.capacity = 2*num_threads;
+    queue.done = false;
+    fMeshWorkerArgs args;
+    args.queue = &queue;
+    args.writer = &writer;
+    args.spacing = spacing;
+    for (int k = 0; k < 3; k++)
+        args.origin[k] = bounds_min[k];
+    std::vector<std::thread> workers;
+    for (int i = 0; i < num_threads; i++)
+        workers.push_back(std::thread(fraktal_mesh_worker, &args));
+
+    const int S = FRAKTAL_MESH_CHUNK_SAMPLES;
+    for (int cz = 0; cz < chunks[2]; cz++)
+    for (int cy = 0; cy < chunks[1]; cy++)
+    for (int cx = 0; cx < chunks[0]; cx++)
+    {
+        float d = coarse[(cz*max_chunks + cy)*max_chunks + cx];
+        if (fabsf(d) > cull_distance)
+            continue;
+
+        fMeshJob job;
+        job.chunk[0] = cx;
+        job.chunk[1] = cy;
+        job.chunk[2] = cz;
+        for (int k = 0; k < 3; k++)
+        {
+            int remaining = voxels[k] - job.chunk[k]*FRAKTAL_MESH_CHUNK;
+            job.voxels[k] = remaining < FRAKTAL_MESH_CHUNK ? remaining : FRAKTAL_MESH_CHUNK;
+        }
+        job.samples = (float*)malloc(S*S*S*sizeof(float));
+        fraktal_assert(job.samples && "Ran out of memory");
+        float origin[3];
+        for (int k = 0; k < 3; k++)
+            origin[k] = bounds_min[k] + chunk_size*job.chunk[k];
+        fraktal_sample_grid(chunk_array, texels, job.samples, S, origin, spacing,
+                            loc_origin, loc_spacing, loc_size, loc_tiles_x);
+        fraktal_mesh_push(&queue, job);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.done = true;
+    }
+    queue.not_empty.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    free(texels);
+    free(coarse);
+    free(coarse_texels);
+    fraktal_destroy_array(chunk_array);
+    fraktal_destroy_array(coarse_array);
+
+    bool ok = !writer.failed;
+    if (ok && format == FRAKTAL_PLY)
+    {
+        ok = fraktal_mesh_append_faces(&writer);
+        rewind(writer.file);
+        fraktal_mesh_write_ply_header(writer.file, writer.num_vertices, writer.num_faces);
+    }
+    if (writer.faces)
+        fclose(writer.faces);
+    if (fclose(writer.file) != 0)
+        ok = false;
+    if (!ok)
+        log_err("Failed to extract mesh: error writing to '%s'.\n", path);
+    return ok;
+}
+
+bool fraktal_estimate_bounds(float bounds_min[3], float bounds_max[3], const float region_min[3], const float region_max[3],
+                             int resolution, float lipschitz)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(fraktal_current_kernel && "Call fraktal_use_kernel first.");
+    fraktal_assert(bounds_min && bounds_max);
+    fraktal_assert(region_min && region_max);
+    fraktal_assert(region_min[0] < region_max[0] && region_min[1] < region_max[1] && region_min[2] < region_max[2]);
+    fraktal_assert(resolution > 0 && resolution <= 256);
+    fraktal_assert(lipschitz > 0.0f);
+    fraktal_assert(!fraktal_recording && "Bounds estimation cannot be recorded in a command list.");
+
+    fKernel *f = fraktal_current_kernel;
+    int loc_origin = fraktal_get_param_offset(f, "iGridOrigin");
+    int loc_spacing = fraktal_get_param_offset(f, "iGridSpacing");
+    int loc_size = fraktal_get_param_offset(f, "iGridSize");
+    int loc_tiles_x = fraktal_get_param_offset(f, "iTilesX");
+    if (loc_origin < 0 || loc_spacing < 0 || loc_size < 0 || loc_tiles_x < 0)
+    {
+        log_err("Failed to estimate bounds: the current kernel must be linked with libf/grid.f.\n");
+        return false;
+    }
+
+    float extent = 0.0f;
+    for (int k = 0; k < 3; k++)
+        if (region_max[k] - region_min[k] > extent)
+            extent = region_max[k] - region_min[k];
+    float cell_size = extent/resolution;
+    int cells[3];
+    int size = 0;
+    for (int k = 0; k < 3; k++)
+    {
+        cells[k] = (int)ceil((region_max[k] - region_min[k])/cell_size - 1e-3f);
+        if (cells[k] < 1) cells[k] = 1;
+        if (cells[k] > size) size = cells[k];
+    }
+
+    fArray *array = fraktal_create_grid_tiles(size);
+    if (!array)
+    {
+        log_err("Failed to estimate bounds: could not create sample array.\n");
+        return false;
+    }
+    float *texels = (float*)malloc(array->width*array->height*sizeof(float));
+    float *samples = (float*)malloc(size*size*size*sizeof(float));
+    fraktal_assert(texels && samples && "Ran out of memory");
+    float origin[3];
+    for (int k = 0; k < 3; k++)
+        origin[k] = region_min[k] + 0.5f*cell_size;
+    fraktal_sample_grid(array, texels, samples, size, origin, cell_size,
+                        loc_origin, loc_spacing, loc_size, loc_tiles_x);
+
+    float cull_distance = lipschitz*0.5f*sqrtf(3.0f)*cell_size;
+    int lo[3] = { size, size, size };
+    int hi[3] = { -1, -1, -1 };
+    bool on_border = false;
+    for (int z = 0; z < cells[2]; z++)
+    for (int y = 0; y < cells[1]; y++)
+    for (int x = 0; x < cells[0]; x++)
+    {
+        if (samples[(z*size + y)*size + x] > cull_distance)
+            continue;
+        int i[3] = { x, y, z };
+        for (int k = 0; k < 3; k++)
+        {
+            if (i[k] < lo[k]) lo[k] = i[k];
+            if (i[k] > hi[k]) hi[k] = i[k];
+            if (i[k] == 0 || i[k] == cells[k] - 1)
+                on_border = true;
+        }
+    }
+
+    free(texels);
+    free(samples);
+    fraktal_destroy_array(array);
+
+    if (hi[0] < 0 || on_border)
+        return false;
+    for (int k = 0; k < 3; k++)
+    {
+        bounds_min[k] = region_min[k] + cell_size*lo[k];
+        bounds_max[k] = region_min[k] + cell_size*(hi[k] + 1);
+    }
+    return true;
+}
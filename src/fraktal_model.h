@@ -0,0 +1,1091 @@
+#pragma once
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <algorithm>
+
+// A model is a DAG of interpreter operations (see fOpcode). Nodes are
+// hash-consed, so building the same operation on the same operands twice
+// gives the same node, and chains of constant transforms are folded into
+// one node as they are built. Since operands always exist before the nodes
+// that use them, node indices are a topological order.
+enum { FRAKTAL_MODEL_INPUT = -1 }; // op of node 0, the point being evaluated
+
+struct fModelNode
+{
+    int op;
+    int a;
+    int b;
+    float arg[8];
+};
+
+struct fModel
+{
+    fModelNode *nodes;
+    int count;
+    int capacity;
+    int *table; // open addressing hash table of node indices, -1 if empty
+    int table_size;
+};
+
+static bool fraktal_is_point_op(int op)
+{
+    return op == FRAKTAL_MODEL_INPUT || (op > FRAKTAL_OP_END && op < FRAKTAL_OP_SPHERE);
+}
+
+static bool fraktal_is_binary_op(int op)
+{
+    return op >= FRAKTAL_OP_UNION && op <= FRAKTAL_OP_UNION_SOFT;
+}
+
+// Number of arguments used by each operation; the rest are zeroed so that
+// they do not prevent nodes from being shared.
+static int fraktal_op_arg_count(int op)
+{
+    switch (op)
+    {
+        case FRAKTAL_OP_TRANSLATE:    return 3;
+        case FRAKTAL_OP_ROTATE:       return 4;
+        case FRAKTAL_OP_SCALE:        return 1;
+        case FRAKTAL_OP_MIRROR:       return 3;
+        case FRAKTAL_OP_MOD_INTERVAL: return 5;
+        case FRAKTAL_OP_MOD_POLAR:    return 1;
+        case FRAKTAL_OP_SPHERE:       return 1;
+        case FRAKTAL_OP_BOX:          return 3;
+        case FRAKTAL_OP_CYLINDER:     return 2;
+        case FRAKTAL_OP_CAPSULE:      return 2;
+        case FRAKTAL_OP_TORUS:        return 2;
+        case FRAKTAL_OP_PLANE:        return 4;
+        case FRAKTAL_OP_CONE:         return 2;
+        case FRAKTAL_OP_HEXAGON:      return 2;
+        case FRAKTAL_OP_UNION:        return 0;
+        case FRAKTAL_OP_INTERSECTION: return 0;
+        case FRAKTAL_OP_DIFFERENCE:   return 0;
+        default:                      return 1; // remaining distance operations
+    }
+}
+
+static bool fraktal_is_valid_op(int op)
+{
+    return (op >= FRAKTAL_OP_TRANSLATE && op <= FRAKTAL_OP_MOD_POLAR) ||
+           (op >= FRAKTAL_OP_SPHERE && op <= FRAKTAL_OP_HEXAGON) ||
+           (op >= FRAKTAL_OP_UNION && op <= FRAKTAL_OP_DIST_SCALE);
+}
+
+static bool fraktal_is_commutative_op(int op)
+{
+    return op == FRAKTAL_OP_UNION ||
+           op == FRAKTAL_OP_INTERSECTION ||
+           op == FRAKTAL_OP_UNION_ROUND ||
+           op == FRAKTAL_OP_INTERSECTION_ROUND ||
+           op == FRAKTAL_OP_UNION_CHAMFER ||
+           op == FRAKTAL_OP_INTERSECTION_CHAMFER ||
+           op == FRAKTAL_OP_UNION_SOFT;
+}
+
+static unsigned int fraktal_hash_node(const fModelNode *n)
+{
+    // FNV-1a
+    unsigned int h = 2166136261u;
+    const unsigned char *bytes = (const unsigned char*)n;
+    for (size_t i = 0; i < sizeof(fModelNode); i++)
+        h = (h ^ bytes[i])*16777619u;
+    return h;
+}
+
+static bool fraktal_equal_nodes(const fModelNode *x, const fModelNode *y)
+{
+    return memcmp(x, y, sizeof(fModelNode)) == 0;
+}
+
+static void fraktal_model_rehash(fModel *m, int table_size)
+{
+    free(m->table);
+    m->table_size = table_size;
+    m->table = (int*)malloc(table_size*sizeof(int));
+    fraktal_assert(m->table && "Ran out of memory");
+    for (int i = 0; i < table_size; i++)
+        m->table[i] = -1;
+    for (int i = 0; i < m->count; i++)
+    {
+        unsigned int slot = fraktal_hash_node(&m->nodes[i]) & (table_size - 1);
+        while (m->table[slot] >= 0)
+            slot = (slot + 1) & (table_size - 1);
+        m->table[slot] = i;
+    }
+}
+
+// Returns the existing node equal to 'n', or adds it
+static int fraktal_model_intern(fModel *m, const fModelNode *n)
+{
+    unsigned int slot = fraktal_hash_node(n) & (m->table_size - 1);
+    while (m->table[slot] >= 0)
+    {
+        if (fraktal_equal_nodes(&m->nodes[m->table[slot]], n))
+            return m->table[slot];
+        slot = (slot + 1) & (m->table_size - 1);
+    }
+
+    if (m->count == m->capacity)
+    {
+        m->capacity *= 2;
+        m->nodes = (fModelNode*)realloc(m->nodes, m->capacity*sizeof(fModelNode));
+        fraktal_assert(m->nodes && "Ran out of memory");
+    }
+    int index = m->count++;
+    m->nodes[index] = *n;
+    m->table[slot] = index;
+    if (2*m->count > m->table_size)
+        fraktal_model_rehash(m, 2*m->table_size);
+    return index;
+}
+
+fModel *fraktal_create_model()
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fModel *m = (fModel*)calloc(1, sizeof(fModel));
+    fraktal_assert(m && "Ran out of memory");
+    m->capacity = 64;
+    m->nodes = (fModelNode*)malloc(m->capacity*sizeof(fModelNode));
+    fraktal_assert(m->nodes && "Ran out of memory");
+    fraktal_model_rehash(m, 128);
+
+    fModelNode input;
+    memset(&input, 0, sizeof(input));
+    input.op = FRAKTAL_MODEL_INPUT;
+    fraktal_model_intern(m, &input);
+    return m;
+}
+
+void fraktal_destroy_model(fModel *m)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    if (!m)
+        return;
+    free(m->nodes);
+    free(m->table);
+    free(m);
+}
+
+int fraktal_model_input(fModel *m)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(m);
+    return 0;
+}
+
+// Hamilton product; rotating by a and then by b rotates by a*b, since
+// the rotation is applied to the point inversely.
+static void fraktal_quaternion_multiply(float out[4], const float a[4], const float b[4])
+{
+    float x = a[3]*b[0] + a[0]*b[3] + a[1]*b[2] - a[2]*b[1];
+    float y = a[3]*b[1] - a[0]*b[2] + a[1]*b[3] + a[2]*b[0];
+    float z = a[3]*b[2] + a[0]*b[1] - a[1]*b[0] + a[2]*b[3];
+    float w = a[3]*b[3] - a[0]*b[0] - a[1]*b[1] - a[2]*b[2];
+    out[0] = x; out[1] = y; out[2] = z; out[3] = w;
+}
+
+static bool fraktal_is_binary_mask(const float u[3])
+{
+    for (int k = 0; k < 3; k++)
+        if (u[k] != 0.0f && u[k] != 1.0f)
+            return false;
+    return true;
+}
+
+// Folds constant transforms into their operand and removes operations
+// that do nothing. Returns the index of an existing node that 'n' is
+// equivalent to, or -1 if 'n' (possibly rewritten) must be interned.
+static int fraktal_model_fold(fModel *m, fModelNode *n)
+{
+    const fModelNode *a = &m->nodes[n->a];
+    float *u = n->arg;
+    switch (n->op)
+    {
+        case FRAKTAL_OP_TRANSLATE:
+        {
+            if (a->op == FRAKTAL_OP_TRANSLATE)
+            {
+                for (int k = 0; k < 3; k++)
+                    u[k] += a->arg[k];
+                n->a = a->a;
+            }
+            if (u[0] == 0.0f && u[1] == 0.0f && u[2] == 0.0f)
+                return n->a;
+        } break;
+        case FRAKTAL_OP_ROTATE:
+        {
+            if (a->op == FRAKTAL_OP_ROTATE)
+            {
+                fraktal_quaternion_multiply(u, a->arg, u);
+                n->a = a->a;
+            }
+            if (u[0] == 0.0f && u[1] == 0.0f && u[2] == 0.0f)
+                return n->a;
+        } break;
+        case FRAKTAL_OP_SCALE:
+        {
+            if (a->op == FRAKTAL_OP_SCALE)
+            {
+                u[0] *= a->arg[0];
+                n->a = a->a;
+            }
+            if (u[0] == 1.0f)
+                return n->a;
+        } break;
+        case FRAKTAL_OP_MIRROR:
+        {
+            if (a->op == FRAKTAL_OP_MIRROR && fraktal_is_binary_mask(u) && fraktal_is_binary_mask(a->arg))
+            {
+                for (int k = 0; k < 3; k++)
+                    u[k] = (u[k] == 1.0f || a->arg[k] == 1.0f) ? 1.0f : 0.0f;
+                n->a = a->a;
+            }
+            if (u[0] == 0.0f && u[1] == 0.0f && u[2] == 0.0f)
+                return n->a;
+        } break;
+        case FRAKTAL_OP_MOD_INTERVAL:
+        {
+            if (u[0] <= 0.0f && u[1] <= 0.0f && u[2] <= 0.0f)
+                return n->a;
+        } break;
+        case FRAKTAL_OP_OFFSET:
+        {
+            if (a->op == FRAKTAL_OP_OFFSET)
+            {
+                u[0] += a->arg[0];
+                n->a = a->a;
+            }
+            if (u[0] == 0.0f)
+                return n->a;
+        } break;
+        case FRAKTAL_OP_DIST_SCALE:
+        {
+            if (a->op == FRAKTAL_OP_DIST_SCALE)
+            {
+                u[0] *= a->arg[0];
+                n->a = a->a;
+            }
+            if (u[0] == 1.0f)
+                return n->a;
+        } break;
+        case FRAKTAL_OP_UNION:
+        case FRAKTAL_OP_INTERSECTION:
+        {
+            if (n->a == n->b)
+                return n->a;
+        } break;
+    }
+    return -1;
+}
+
+int fraktal_model_node(fModel *m, int op, int a, int b, const float *args)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(m);
+    fraktal_assert(fraktal_is_valid_op(op) && "Invalid opcode.");
+    fraktal_assert(a >= 0 && a < m->count && "Invalid operand.");
+    bool point_operand = op < FRAKTAL_OP_UNION;
+    fraktal_assert(fraktal_is_point_op(m->nodes[a].op) == point_operand && "Operand has the wrong type.");
+    if (fraktal_is_binary_op(op))
+    {
+        fraktal_assert(b >= 0 && b < m->count && "Invalid operand.");
+        fraktal_assert(!fraktal_is_point_op(m->nodes[b].op) && "Operand has the wrong type.");
+    }
+    else
+    {
+        b = 0;
+    }
+
+    fModelNode n;
+    memset(&n, 0, sizeof(n));
+    n.op = op;
+    n.a = a;
+    n.b = b;
+    int num_args = fraktal_op_arg_count(op);
+    fraktal_assert((num_args == 0 || args) && "Operation requires arguments.");
+    for (int i = 0; i < num_args; i++)
+    {
+        fraktal_assert(isfinite(args[i]) && "Arguments must be finite.");
+        n.arg[i] = args[i] == 0.0f ? 0.0f : args[i]; // -0 and +0 hash differently
+    }
+    if (op == FRAKTAL_OP_SCALE)
+        fraktal_assert(n.arg[0] != 0.0f && "Scale must be non-zero.");
+    if (fraktal_is_commutative_op(op) && n.a > n.b)
+    {
+        n.a = b;
+        n.b = a;
+    }
+
+    int folded = fraktal_model_fold(m, &n);
+    if (folded >= 0)
+        return folded;
+    for (int i = 0; i < 8; i++) // folding can also give -0
+        if (n.arg[i] == 0.0f)
+            n.arg[i] = 0.0f;
+    return fraktal_model_intern(m, &n);
+}
+
+// Marks the nodes that 'root' depends on and the index of their last use
+static void fraktal_model_liveness(fModel *m, int root, bool *reachable, int *last_use)
+{
+    for (int i = 0; i < m->count; i++)
+    {
+        reachable[i] = false;
+        last_use[i] = -1;
+    }
+    reachable[root] = true;
+    last_use[root] = m->count;
+    for (int i = root; i > 0; i--)
+    {
+        if (!reachable[i])
+            continue;
+        const fModelNode *n = &m->nodes[i];
+        reachable[n->a] = true;
+        if (last_use[n->a] < i) last_use[n->a] = i;
+        if (fraktal_is_binary_op(n->op))
+        {
+            reachable[n->b] = true;
+            if (last_use[n->b] < i) last_use[n->b] = i;
+        }
+    }
+}
+
+int fraktal_model_program(fModel *m, int root, fInstruction *code, int capacity)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(m);
+    fraktal_assert(root > 0 && root < m->count && !fraktal_is_point_op(m->nodes[root].op) &&
+                   "Root must be a primitive or distance operation.");
+    fraktal_assert(capacity >= 0);
+
+    bool *reachable = (bool*)malloc(m->count*sizeof(bool));
+    int *last_use = (int*)malloc(m->count*sizeof(int));
+    int *reg = (int*)malloc(m->count*sizeof(int));
+    fraktal_assert(reachable && last_use && reg && "Ran out of memory");
+    fraktal_model_liveness(m, root, reachable, last_use);
+
+    // Registers are allocated in evaluation order and released after the
+    // last use of their value. Operands are released before the result is
+    // allocated, since instructions read their operands first. The root is
+    // evaluated last, when every other register is free, so it lands in R0.
+    int point_owner[fraktal_cpu_scalar::NUM_POINT_REGISTERS];
+    int distance_owner[fraktal_cpu_scalar::NUM_DISTANCE_REGISTERS];
+    for (int r = 0; r < fraktal_cpu_scalar::NUM_POINT_REGISTERS; r++) point_owner[r] = -1;
+    for (int r = 0; r < fraktal_cpu_scalar::NUM_DISTANCE_REGISTERS; r++) distance_owner[r] = -1;
+    point_owner[0] = 0;
+    reg[0] = 0;
+
+    int count = 0;
+    bool ok = true;
+    for (int i = 1; i <= root && ok; i++)
+    {
+        if (!reachable[i])
+            continue;
+        const fModelNode *n = &m->nodes[i];
+        bool point = fraktal_is_point_op(n->op);
+        int a = reg[n->a];
+        int b = fraktal_is_binary_op(n->op) ? reg[n->b] : 0;
+
+        int *operand_owner = n->op < FRAKTAL_OP_UNION ? point_owner : distance_owner;
+        if (last_use[n->a] == i) operand_owner[a] = -1;
+        if (fraktal_is_binary_op(n->op) && last_use[n->b] == i) operand_owner[b] = -1;
+
+        int *owner = point ? point_owner : distance_owner;
+        int num_registers = point ? (int)fraktal_cpu_scalar::NUM_POINT_REGISTERS : (int)fraktal_cpu_scalar::NUM_DISTANCE_REGISTERS;
+        int dst = -1;
+        for (int r = 0; r < num_registers && dst < 0; r++)
+            if (owner[r] < 0)
+                dst = r;
+        if (dst < 0)
+        {
+            log_err("Failed to compile model: it needs more than %d %s registers.\n",
+                    num_registers, point ? "point" : "distance");
+            ok = false;
+            break;
+        }
+        owner[dst] = i;
+        reg[i] = dst;
+
+        if (code && count < capacity)
+        {
+            fInstruction *c = &code[count];
+            c->op = (float)n->op;
+            c->dst = (float)dst;
+            c->a = (float)a;
+            c->b = (float)b;
+            for (int k = 0; k < 8; k++)
+                c->arg[k] = n->arg[k];
+        }
+        count++;
+    }
+    fraktal_assert(!ok || reg[root] == 0);
+    if (code && count < capacity)
+    {
+        memset(&code[count], 0, sizeof(fInstruction));
+        code[count].op = (float)FRAKTAL_OP_END;
+    }
+    count++;
+
+    free(reachable);
+    free(last_use);
+    free(reg);
+    if (!ok)
+        return -1;
+    if (code && count > capacity)
+    {
+        log_err("Failed to compile model: %d instructions exceed the capacity of %d.\n", count, capacity);
+        return -1;
+    }
+    return count;
+}
+
+struct fModelText
+{
+    char *data;
+    int length;
+    int capacity;
+    int indent;
+};
+
+static void fraktal_model_printf(fModelText *t, const char *format, ...)
+{
+    for (;;)
+    {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(t->data + t->length, t->capacity - t->length, format, args);
+        va_end(args);
+        fraktal_assert(n >= 0);
+        if (t->length + n < t->capacity)
+        {
+            t->length += n;
+            return;
+        }
+        t->capacity = 2*(t->length + n + 1);
+        t->data = (char*)realloc(t->data, t->capacity);
+        fraktal_assert(t->data && "Ran out of memory");
+    }
+}
+
+// Prints a line of code at the current indentation
+static void fraktal_model_line(fModelText *t, const char *format, ...)
+{
+    char line[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    fraktal_model_printf(t, "%*s%s", 4*t->indent, "", line);
+}
+
+// Formats a float so that GLSL reads it back exactly and as a float
+struct fGlslFloat { char s[32]; };
+static fGlslFloat fraktal_glsl_float(float x)
+{
+    fGlslFloat f;
+    snprintf(f.s, sizeof(f.s), "%.9g", x);
+    if (!strpbrk(f.s, ".e"))
+        strcat(f.s, ".0");
+    return f;
+}
+#define GLSL_FLOAT(x) fraktal_glsl_float(x).s
+
+// Emits the GLSL statement that computes node i, named p<i> or d<i>
+static void fraktal_model_emit_node(fModelText *t, const fModelNode *n, int i)
+{
+    int a = n->a;
+    int b = n->b;
+    const float *u = n->arg;
+    switch (n->op)
+    {
+        case FRAKTAL_OP_TRANSLATE:
+            fraktal_model_line(t, "vec3 p%d = p%d - vec3(%s, %s, %s);\n", i, a, GLSL_FLOAT(u[0]), GLSL_FLOAT(u[1]), GLSL_FLOAT(u[2]));
+            break;
+        case FRAKTAL_OP_ROTATE:
+        {
+            // Rotating by the inverse of q is multiplying by the transpose
+            // of its rotation matrix, whose columns are the rows of R(q).
+            float x = u[0], y = u[1], z = u[2], w = u[3];
+            float r[9] = {
+                1.0f - 2.0f*(y*y + z*z), 2.0f*(x*y - z*w), 2.0f*(x*z + y*w),
+                2.0f*(x*y + z*w), 1.0f - 2.0f*(x*x + z*z), 2.0f*(y*z - x*w),
+                2.0f*(x*z - y*w), 2.0f*(y*z + x*w), 1.0f - 2.0f*(x*x + y*y)
+            };
+            fraktal_model_line(t, "vec3 p%d = mat3(%s, %s, %s, %s, %s, %s, %s, %s, %s)*p%d;\n", i,
+                GLSL_FLOAT(r[0]), GLSL_FLOAT(r[1]), GLSL_FLOAT(r[2]),
+                GLSL_FLOAT(r[3]), GLSL_FLOAT(r[4]), GLSL_FLOAT(r[5]),
+                GLSL_FLOAT(r[6]), GLSL_FLOAT(r[7]), GLSL_FLOAT(r[8]), a);
+        } break;
+        case FRAKTAL_OP_SCALE:
+            fraktal_model_line(t, "vec3 p%d = p%d/%s;\n", i, a, GLSL_FLOAT(u[0]));
+            break;
+        case FRAKTAL_OP_MIRROR:
+        {
+            static const char *axis = "xyz";
+            fraktal_model_line(t, "vec3 p%d = vec3(", i);
+            for (int k = 0; k < 3; k++)
+            {
+                const char *sep = k < 2 ? ", " : ");\n";
+                if (u[k] == 0.0f)      fraktal_model_printf(t, "p%d.%c%s", a, axis[k], sep);
+                else if (u[k] == 1.0f) fraktal_model_printf(t, "abs(p%d.%c)%s", a, axis[k], sep);
+                else fraktal_model_printf(t, "mix(p%d.%c, abs(p%d.%c), %s)%s", a, axis[k], a, axis[k], GLSL_FLOAT(u[k]), sep);
+            }
+        } break;
+        case FRAKTAL_OP_MOD_INTERVAL:
+        {
+            static const char *axis = "xyz";
+            fraktal_model_line(t, "vec3 p%d = p%d;\n", i, a);
+            for (int k = 0; k < 3; k++)
+            {
+                if (u[k] <= 0.0f)
+                    continue;
+                if (u[3] > u[4])
+                    fraktal_model_line(t, "pMod1(p%d.%c, %s);\n", i, axis[k], GLSL_FLOAT(u[k]));
+                else
+                    fraktal_model_line(t, "pModInterval1(p%d.%c, %s, %s, %s);\n", i, axis[k],
+                                         GLSL_FLOAT(u[k]), GLSL_FLOAT(u[3]), GLSL_FLOAT(u[4]));
+            }
+        } break;
+        case FRAKTAL_OP_MOD_POLAR:
+            fraktal_model_line(t, "vec3 p%d = p%d;\n", i, a);
+            fraktal_model_line(t, "{ vec2 xz = p%d.xz; pModPolar(xz, %s); p%d.xz = xz; }\n", i, GLSL_FLOAT(u[0]), i);
+            break;
+        case FRAKTAL_OP_SPHERE:   fraktal_model_line(t, "float d%d = fSphere(p%d, %s);\n", i, a, GLSL_FLOAT(u[0])); break;
+        case FRAKTAL_OP_BOX:      fraktal_model_line(t, "float d%d = fBox(p%d, vec3(%s, %s, %s));\n", i, a, GLSL_FLOAT(u[0]), GLSL_FLOAT(u[1]), GLSL_FLOAT(u[2])); break;
+        case FRAKTAL_OP_CYLINDER: fraktal_model_line(t, "float d%d = fCylinder(p%d, %s, %s);\n", i, a, GLSL_FLOAT(u[0]), GLSL_FLOAT(u[1])); break;
+        case FRAKTAL_OP_CAPSULE:  fraktal_model_line(t, "float d%d = fCapsule(p%d, %s, %s);\n", i, a, GLSL_FLOAT(u[0]), GLSL_FLOAT(u[1])); break;
+        case FRAKTAL_OP_TORUS:    fraktal_model_line(t, "float d%d = fTorus(p%d, %s, %s);\n", i, a, GLSL_FLOAT(u[0]), GLSL_FLOAT(u[1])); break;
+        case FRAKTAL_OP_PLANE:    fraktal_model_line(t, "float d%d = fPlane(p%d, vec3(%s, %s, %s), %s);\n", i, a, GLSL_FLOAT(u[0]), GLSL_FLOAT(u[1]), GLSL_FLOAT(u[2]), GLSL_FLOAT(u[3])); break;
+        case FRAKTAL_OP_CONE:     fraktal_model_line(t, "float d%d = fCone(p%d, %s, %s);\n", i, a, GLSL_FLOAT(u[0]), GLSL_FLOAT(u[1])); break;
+        case FRAKTAL_OP_HEXAGON:  fraktal_model_line(t, "float d%d = fHexagonCircumcircle(p%d, vec2(%s, %s));\n", i, a, GLSL_FLOAT(u[0]), GLSL_FLOAT(u[1])); break;
+        case FRAKTAL_OP_UNION:                fraktal_model_line(t, "float d%d = min(d%d, d%d);\n", i, a, b); break;
+        case FRAKTAL_OP_INTERSECTION:         fraktal_model_line(t, "float d%d = max(d%d, d%d);\n", i, a, b); break;
+        case FRAKTAL_OP_DIFFERENCE:           fraktal_model_line(t, "float d%d = max(d%d, -d%d);\n", i, a, b); break;
+        case FRAKTAL_OP_UNION_ROUND:          fraktal_model_line(t, "float d%d = fOpUnionRound(d%d, d%d, %s);\n", i, a, b, GLSL_FLOAT(u[0])); break;
+        case FRAKTAL_OP_INTERSECTION_ROUND:   fraktal_model_line(t, "float d%d = fOpIntersectionRound(d%d, d%d, %s);\n", i, a, b, GLSL_FLOAT(u[0])); break;
+        case FRAKTAL_OP_DIFFERENCE_ROUND:     fraktal_model_line(t, "float d%d = fOpDifferenceRound(d%d, d%d, %s);\n", i, a, b, GLSL_FLOAT(u[0])); break;
+        case FRAKTAL_OP_UNION_CHAMFER:        fraktal_model_line(t, "float d%d = fOpUnionChamfer(d%d, d%d, %s);\n", i, a, b, GLSL_FLOAT(u[0])); break;
+        case FRAKTAL_OP_INTERSECTION_CHAMFER: fraktal_model_line(t, "float d%d = fOpIntersectionChamfer(d%d, d%d, %s);\n", i, a, b, GLSL_FLOAT(u[0])); break;
+        case FRAKTAL_OP_DIFFERENCE_CHAMFER:   fraktal_model_line(t, "float d%d = fOpDifferenceChamfer(d%d, d%d, %s);\n", i, a, b, GLSL_FLOAT(u[0])); break;
+        case FRAKTAL_OP_UNION_SOFT:           fraktal_model_line(t, "float d%d = fOpUnionSoft(d%d, d%d, %s);\n", i, a, b, GLSL_FLOAT(u[0])); break;
+        case FRAKTAL_OP_OFFSET:               fraktal_model_line(t, "float d%d = d%d - %s;\n", i, a, GLSL_FLOAT(u[0])); break;
+        case FRAKTAL_OP_DIST_SCALE:           fraktal_model_line(t, "float d%d = d%d*%s;\n", i, a, GLSL_FLOAT(u[0])); break;
+        default: fraktal_assert(false && "Invalid opcode.");
+    }
+}
+
+// Conservative axis-aligned bounds, in the frame of the input point, of
+// the region where a distance node is negative. Primitives are treated as
+// exact distances, which SCALE and DIST_SCALE stretch: the region where
+// the node is below some u > 0 lies within factor*u of the bounds.
+struct fModelBox
+{
+    float lo[3];
+    float hi[3];
+    float factor;
+    bool bounded;
+};
+
+static fModelBox fraktal_model_box(float cx, float cy, float cz, float hx, float hy, float hz)
+{
+    fModelBox b;
+    b.lo[0] = cx - fabsf(hx); b.hi[0] = cx + fabsf(hx);
+    b.lo[1] = cy - fabsf(hy); b.hi[1] = cy + fabsf(hy);
+    b.lo[2] = cz - fabsf(hz); b.hi[2] = cz + fabsf(hz);
+    b.factor = 1.0f;
+    b.bounded = true;
+    return b;
+}
+
+static fModelBox fraktal_model_unbounded()
+{
+    fModelBox b;
+    memset(&b, 0, sizeof(b));
+    b.bounded = false;
+    return b;
+}
+
+static fModelBox fraktal_model_box_union(fModelBox a, fModelBox b)
+{
+    if (!a.bounded || !b.bounded)
+        return fraktal_model_unbounded();
+    for (int k = 0; k < 3; k++)
+    {
+        a.lo[k] = fminf(a.lo[k], b.lo[k]);
+        a.hi[k] = fmaxf(a.hi[k], b.hi[k]);
+    }
+    a.factor = fmaxf(a.factor, b.factor);
+    return a;
+}
+
+static fModelBox fraktal_model_box_expand(fModelBox b, float r)
+{
+    for (int k = 0; k < 3; k++)
+    {
+        b.lo[k] -= r;
+        b.hi[k] += r;
+    }
+    return b;
+}
+
+// Maps a box from the frame of point node 'i' out to the input frame, by
+// applying each point operation on the way inversely to the box.
+static fModelBox fraktal_model_box_to_input(fModel *m, int i, fModelBox b)
+{
+    for (; i > 0 && b.bounded; i = m->nodes[i].a)
+    {
+        const fModelNode *n = &m->nodes[i];
+        const float *u = n->arg;
+        switch (n->op)
+        {
+            case FRAKTAL_OP_TRANSLATE:
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    b.lo[k] += u[k];
+                    b.hi[k] += u[k];
+                }
+            } break;
+            case FRAKTAL_OP_ROTATE:
+            {
+                float x = u[0], y = u[1], z = u[2], w = u[3];
+                float r[3][3] = {
+                    { 1.0f - 2.0f*(y*y + z*z), 2.0f*(x*y - z*w), 2.0f*(x*z + y*w) },
+                    { 2.0f*(x*y + z*w), 1.0f - 2.0f*(x*x + z*z), 2.0f*(y*z - x*w) },
+                    { 2.0f*(x*z - y*w), 2.0f*(y*z + x*w), 1.0f - 2.0f*(x*x + y*y) }
+                };
+                float c[3], h[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    c[k] = 0.5f*(b.lo[k] + b.hi[k]);
+                    h[k] = 0.5f*(b.hi[k] - b.lo[k]);
+                }
+                for (int row = 0; row < 3; row++)
+                {
+                    float rc = 0.0f, rh = 0.0f;
+                    for (int k = 0; k < 3; k++)
+                    {
+                        rc += r[row][k]*c[k];
+                        rh += fabsf(r[row][k])*h[k];
+                    }
+                    b.lo[row] = rc - rh;
+                    b.hi[row] = rc + rh;
+                }
+            } break;
+            case FRAKTAL_OP_SCALE:
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    float lo = b.lo[k]*u[0];
+                    float hi = b.hi[k]*u[0];
+                    b.lo[k] = fminf(lo, hi);
+                    b.hi[k] = fmaxf(lo, hi);
+                }
+                b.factor *= fabsf(u[0]);
+            } break;
+            case FRAKTAL_OP_MIRROR:
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    if (u[k] == 0.0f)
+                        continue;
+                    if (u[k] != 1.0f)
+                        return fraktal_model_unbounded();
+                    float r = fmaxf(fabsf(b.lo[k]), fabsf(b.hi[k]));
+                    b.lo[k] = -r;
+                    b.hi[k] = +r;
+                }
+            } break;
+            case FRAKTAL_OP_MOD_INTERVAL:
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    if (u[k] <= 0.0f)
+                        continue;
+                    if (u[3] > u[4])
+                        return fraktal_model_unbounded();
+                    b.lo[k] += u[3]*u[k];
+                    b.hi[k] += u[4]*u[k];
+                }
+            } break;
+            case FRAKTAL_OP_MOD_POLAR:
+            {
+                float rx = fmaxf(fabsf(b.lo[0]), fabsf(b.hi[0]));
+                float rz = fmaxf(fabsf(b.lo[2]), fabsf(b.hi[2]));
+                float r = sqrtf(rx*rx + rz*rz);
+                b.lo[0] = b.lo[2] = -r;
+                b.hi[0] = b.hi[2] = +r;
+            } break;
+        }
+    }
+    return b;
+}
+
+// Computes the bounds of distance nodes 1..last (point nodes are unbounded)
+static void fraktal_model_compute_bounds(fModel *m, int last, fModelBox *boxes)
+{
+    boxes[0] = fraktal_model_unbounded();
+    for (int i = 1; i <= last; i++)
+    {
+        const fModelNode *n = &m->nodes[i];
+        const float *u = n->arg;
+        fModelBox b = fraktal_model_unbounded();
+        if (n->op >= FRAKTAL_OP_SPHERE && n->op < FRAKTAL_OP_UNION)
+        {
+            switch (n->op)
+            {
+                case FRAKTAL_OP_SPHERE:   b = fraktal_model_box(0, 0, 0, u[0], u[0], u[0]); break;
+                case FRAKTAL_OP_BOX:      b = fraktal_model_box(0, 0, 0, u[0], u[1], u[2]); break;
+                case FRAKTAL_OP_CYLINDER: b = fraktal_model_box(0, 0, 0, u[0], u[1], u[0]); break;
+                case FRAKTAL_OP_CAPSULE:  b = fraktal_model_box(0, 0, 0, u[0], fabsf(u[0]) + fabsf(u[1]), u[0]); break;
+                case FRAKTAL_OP_TORUS:    b = fraktal_model_box(0, 0, 0, fabsf(u[0]) + fabsf(u[1]), u[0], fabsf(u[0]) + fabsf(u[1])); break;
+                case FRAKTAL_OP_CONE:     b = fraktal_model_box(0, 0.5f*u[1], 0, u[0], 0.5f*u[1], u[0]); break;
+                case FRAKTAL_OP_HEXAGON:  b = fraktal_model_box(0, 0, 0, 1.1547005f*u[0], u[1], u[0]); break;
+            }
+            b = fraktal_model_box_to_input(m, n->a, b);
+        }
+        else if (n->op >= FRAKTAL_OP_UNION)
+        {
+            fModelBox a = boxes[n->a];
+            switch (n->op)
+            {
+                case FRAKTAL_OP_UNION:
+                    b = fraktal_model_box_union(a, boxes[n->b]);
+                    break;
+                case FRAKTAL_OP_UNION_ROUND:
+                case FRAKTAL_OP_UNION_CHAMFER:
+                case FRAKTAL_OP_UNION_SOFT:
+                    // blending adds material within the radius of both shapes
+                    b = fraktal_model_box_union(a, boxes[n->b]);
+                    if (b.bounded)
+                        b = fraktal_model_box_expand(b, b.factor*fabsf(u[0]));
+                    break;
+                case FRAKTAL_OP_INTERSECTION:
+                case FRAKTAL_OP_INTERSECTION_ROUND:
+                case FRAKTAL_OP_INTERSECTION_CHAMFER:
+                {
+                    fModelBox c = boxes[n->b];
+                    if (!a.bounded) b = c;
+                    else if (!c.bounded) b = a;
+                    else
+                    {
+                        b = a;
+                        for (int k = 0; k < 3; k++)
+                        {
+                            b.lo[k] = fmaxf(a.lo[k], c.lo[k]);
+                            b.hi[k] = fmaxf(b.lo[k], fminf(a.hi[k], c.hi[k]));
+                        }
+                        b.factor = fmaxf(a.factor, c.factor);
+                    }
+                } break;
+                case FRAKTAL_OP_DIFFERENCE:
+                case FRAKTAL_OP_DIFFERENCE_ROUND:
+                case FRAKTAL_OP_DIFFERENCE_CHAMFER:
+                    b = a;
+                    break;
+                case FRAKTAL_OP_OFFSET:
+                    b = a.bounded ? fraktal_model_box_expand(a, a.factor*fmaxf(u[0], 0.0f)) : a;
+                    break;
+                case FRAKTAL_OP_DIST_SCALE:
+                    if (u[0] > 0.0f)
+                    {
+                        b = a;
+                        b.factor /= u[0];
+                    }
+                    break;
+            }
+        }
+        boxes[i] = b;
+    }
+}
+
+bool fraktal_model_bounds(fModel *m, int node, float bounds_min[3], float bounds_max[3])
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(m);
+    fraktal_assert(node > 0 && node < m->count && !fraktal_is_point_op(m->nodes[node].op) &&
+                   "Node must be a primitive or distance operation.");
+    fraktal_assert(bounds_min && bounds_max);
+    fModelBox *boxes = (fModelBox*)malloc((node + 1)*sizeof(fModelBox));
+    fraktal_assert(boxes && "Ran out of memory");
+    fraktal_model_compute_bounds(m, node, boxes);
+    fModelBox b = boxes[node];
+    free(boxes);
+    for (int k = 0; k < 3; k++)
+    {
+        bounds_min[k] = b.lo[k];
+        bounds_max[k] = b.hi[k];
+    }
+    return b.bounded;
+}
+
+// Bounded subtrees of unions that cost at least this many operations are
+// only evaluated when the point is near their bounds.
+enum { FRAKTAL_MODEL_GUARD_COST = 4 };
+
+struct fModelEmitter
+{
+    fModel *m;
+    fModelText t;
+    fModelBox *boxes;
+    int *cost;
+    bool *emitted; // the node has a variable in the current scope
+    int *scope;    // emitted nodes, to forget them when a scope ends
+    int scope_size;
+    fModelBox guard; // bounds tested by the innermost guarded block
+    int num_temps;
+    bool prune;
+};
+
+// GLSL expression for the value of a node or temporary
+struct fModelName { char s[16]; };
+static fModelName fraktal_model_name(char prefix, int i)
+{
+    fModelName name;
+    snprintf(name.s, sizeof(name.s), "%c%d", prefix, i);
+    return name;
+}
+
+struct fModelLeafOrder
+{
+    const fModelBox *boxes;
+    int axis;
+    bool operator()(int a, int b) const
+    {
+        return boxes[a].lo[axis] + boxes[a].hi[axis] < boxes[b].lo[axis] + boxes[b].hi[axis];
+    }
+};
+
+static void fraktal_model_emit(fModelEmitter *e, int i);
+static fModelName fraktal_model_emit_group(fModelEmitter *e, int *leaves, int n);
+
+// Emits a block that evaluates the union of 'leaves' only if the point is
+// within a margin of their bounds, and otherwise uses the distance to the
+// bounds, which is a lower bound on the distance to the union.
+static fModelName fraktal_model_emit_guarded(fModelEmitter *e, int *leaves, int n)
+{
+    fModelBox b = e->boxes[leaves[0]];
+    for (int i = 1; i < n; i++)
+        b = fraktal_model_box_union(b, e->boxes[leaves[i]]);
+    float extent = 0.0f;
+    for (int k = 0; k < 3; k++)
+        extent = fmaxf(extent, b.hi[k] - b.lo[k]);
+
+    fModelName g = fraktal_model_name('g', e->num_temps++);
+    fraktal_model_line(&e->t, "float %s = length(max(max(vec3(%s, %s, %s) - p0, p0 - vec3(%s, %s, %s)), 0.0));\n", g.s,
+                       GLSL_FLOAT(b.lo[0]), GLSL_FLOAT(b.lo[1]), GLSL_FLOAT(b.lo[2]),
+                       GLSL_FLOAT(b.hi[0]), GLSL_FLOAT(b.hi[1]), GLSL_FLOAT(b.hi[2]));
+    fraktal_model_line(&e->t, "if (%s < %s)\n", g.s, GLSL_FLOAT(0.05f*extent));
+    fraktal_model_line(&e->t, "{\n");
+    e->t.indent++;
+    int scope_size = e->scope_size;
+    fModelBox guard = e->guard;
+    e->guard = b;
+    fModelName inner;
+    if (n == 1)
+    {
+        fraktal_model_emit(e, leaves[0]);
+        inner = fraktal_model_name('d', leaves[0]);
+    }
+    else
+    {
+        inner = fraktal_model_emit_group(e, leaves, n);
+    }
+    fraktal_model_line(&e->t, "%s = %s;\n", g.s, inner.s);
+    while (e->scope_size > scope_size)
+        e->emitted[e->scope[--e->scope_size]] = false;
+    e->guard = guard;
+    e->t.indent--;
+    fraktal_model_line(&e->t, "}\n");
+    return g;
+}
+
+// Emits the union of 'leaves' as a hierarchy of guarded blocks, splitting
+// the bounded leaves in half along the longest axis of their bounds.
+static fModelName fraktal_model_emit_group(fModelEmitter *e, int *leaves, int n)
+{
+    if (n == 1)
+    {
+        int i = leaves[0];
+        fModelBox b = e->boxes[i];
+        bool covers_guard = e->guard.bounded;
+        for (int k = 0; k < 3; k++)
+            covers_guard = covers_guard && b.lo[k] <= e->guard.lo[k] && b.hi[k] >= e->guard.hi[k];
+        if (b.bounded && !covers_guard && e->cost[i] >= FRAKTAL_MODEL_GUARD_COST)
+            return fraktal_model_emit_guarded(e, leaves, 1);
+        fraktal_model_emit(e, i);
+        return fraktal_model_name('d', i);
+    }
+
+    fModelName *parts = (fModelName*)malloc(n*sizeof(fModelName));
+    fraktal_assert(parts && "Ran out of memory");
+    int num_parts = 0;
+
+    // Unbounded leaves are always evaluated
+    int num_bounded = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (e->boxes[leaves[i]].bounded)
+            leaves[num_bounded++] = leaves[i];
+        else
+            parts[num_parts++] = fraktal_model_emit_group(e, &leaves[i], 1);
+    }
+
+    if (num_bounded <= 2)
+    {
+        for (int i = 0; i < num_bounded; i++)
+            parts[num_parts++] = fraktal_model_emit_group(e, &leaves[i], 1);
+    }
+    else
+    {
+        fModelBox b = e->boxes[leaves[0]];
+        for (int i = 1; i < num_bounded; i++)
+            b = fraktal_model_box_union(b, e->boxes[leaves[i]]);
+        fModelLeafOrder order;
+        order.boxes = e->boxes;
+        order.axis = 0;
+        for (int k = 1; k < 3; k++)
+            if (b.hi[k] - b.lo[k] > b.hi[order.axis] - b.lo[order.axis])
+                order.axis = k;
+        std::sort(leaves, leaves + num_bounded, order);
+        int half = num_bounded/2;
+        int *halves[2] = { leaves, leaves + half };
+        int counts[2] = { half, num_bounded - half };
+        for (int h = 0; h < 2; h++)
+        {
+            if (counts[h] == 1)
+                parts[num_parts++] = fraktal_model_emit_group(e, halves[h], 1);
+            else
+                parts[num_parts++] = fraktal_model_emit_guarded(e, halves[h], counts[h]);
+        }
+    }
+
+    fModelName result = fraktal_model_name('g', e->num_temps++);
+    fraktal_model_line(&e->t, "float %s = %s;\n", result.s, parts[0].s);
+    for (int i = 1; i < num_parts; i++)
+        fraktal_model_line(&e->t, "%s = min(%s, %s);\n", result.s, result.s, parts[i].s);
+    free(parts);
+    return result;
+}
+
+// Collects the operands of a tree of unions, without duplicates
+static int fraktal_model_union_leaves(fModelEmitter *e, int root, int *leaves)
+{
+    fModel *m = e->m;
+    bool *seen = (bool*)calloc(root + 1, sizeof(bool));
+    int *stack = (int*)malloc((root + 1)*sizeof(int));
+    fraktal_assert(seen && stack && "Ran out of memory");
+    int n = 0;
+    int top = 0;
+    stack[top++] = root;
+    seen[root] = true;
+    while (top > 0)
+    {
+        int i = stack[--top];
+        const fModelNode *node = &m->nodes[i];
+        if (node->op != FRAKTAL_OP_UNION)
+        {
+            leaves[n++] = i;
+            continue;
+        }
+        int operands[2] = { node->b, node->a };
+        for (int k = 0; k < 2; k++)
+        {
+            if (!seen[operands[k]])
+            {
+                seen[operands[k]] = true;
+                stack[top++] = operands[k];
+            }
+        }
+    }
+    free(seen);
+    free(stack);
+    return n;
+}
+
+// Emits the statements that declare the variable of node i, after those
+// of its operands.
+static void fraktal_model_emit(fModelEmitter *e, int i)
+{
+    if (e->emitted[i])
+        return;
+    const fModelNode *n = &e->m->nodes[i];
+    if (e->prune && n->op == FRAKTAL_OP_UNION)
+    {
+        int *leaves = (int*)malloc((i + 1)*sizeof(int));
+        fraktal_assert(leaves && "Ran out of memory");
+        int count = fraktal_model_union_leaves(e, i, leaves);
+        fModelName value = fraktal_model_emit_group(e, leaves, count);
+        fraktal_model_line(&e->t, "float d%d = %s;\n", i, value.s);
+        free(leaves);
+    }
+    else
+    {
+        fraktal_model_emit(e, n->a);
+        if (fraktal_is_binary_op(n->op))
+            fraktal_model_emit(e, n->b);
+        fraktal_model_emit_node(&e->t, n, i);
+    }
+    e->emitted[i] = true;
+    e->scope[e->scope_size++] = i;
+}
+
+int fraktal_model_glsl(fModel *m, int root, bool prune, char *buffer, int size)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(m);
+    fraktal_assert(root > 0 && root < m->count && !fraktal_is_point_op(m->nodes[root].op) &&
+                   "Root must be a primitive or distance operation.");
+    fraktal_assert(size >= 0);
+    fraktal_assert(buffer || size == 0);
+
+    fModelEmitter e;
+    e.m = m;
+    e.prune = prune;
+    e.num_temps = 0;
+    e.scope_size = 0;
+    e.guard = fraktal_model_unbounded();
+    e.boxes = (fModelBox*)malloc((root + 1)*sizeof(fModelBox));
+    e.cost = (int*)malloc((root + 1)*sizeof(int));
+    e.emitted = (bool*)calloc(root + 1, sizeof(bool));
+    e.scope = (int*)malloc((root + 1)*sizeof(int));
+    fraktal_assert(e.boxes && e.cost && e.emitted && e.scope && "Ran out of memory");
+    fraktal_model_compute_bounds(m, root, e.boxes);
+    e.cost[0] = 0;
+    for (int i = 1; i <= root; i++)
+    {
+        const fModelNode *n = &m->nodes[i];
+        int cost = 1 + e.cost[n->a] + (fraktal_is_binary_op(n->op) ? e.cost[n->b] : 0);
+        e.cost[i] = cost < (1 << 20) ? cost : (1 << 20);
+    }
+    e.emitted[0] = true;
+
+    e.t.length = 0;
+    e.t.capacity = 1024;
+    e.t.indent = 0;
+    e.t.data = (char*)malloc(e.t.capacity);
+    fraktal_assert(e.t.data && "Ran out of memory");
+    fraktal_model_printf(&e.t, "float model(vec3 p0)\n{\n");
+    e.t.indent = 1;
+    fraktal_model_emit(&e, root);
+    fraktal_model_line(&e.t, "return d%d;\n", root);
+    fraktal_model_printf(&e.t, "}\n");
+
+    if (size > 0)
+    {
+        int n = e.t.length < size - 1 ? e.t.length : size - 1;
+        memcpy(buffer, e.t.data, n);
+        buffer[n] = '\0';
+    }
+    int length = e.t.length;
+    free(e.t.data);
+    free(e.boxes);
+    free(e.cost);
+    free(e.emitted);
+    free(e.scope);
+    return length;
+}
+#undef GLSL_FLOAT
@@ -0,0 +1,151 @@
+#pragma once
+#include "reuse/log.h"
+
+// Each thread computes one texel of the half-resolution output from a
+// 2x2 (box) or 4x4 (binomial approximation of a Gaussian) neighborhood
+// of the source. Texels outside the source are clamped to the edge.
+static const char *fraktal_downsample_source =
+    "uniform sampler1D iSource1D;\n"
+    "uniform sampler2D iSource2D;\n"
+    "uniform int       iSourceIs1D;\n"
+    "uniform int       iGaussian;\n"
+    "out vec4          fragColor;\n"
+    "void main()\n"
+    "{\n"
+    "    ivec2 q = ivec2(gl_FragCoord.xy);\n"
+    "    bool is_1d = iSourceIs1D == 1;\n"
+    "    ivec2 size = is_1d ? ivec2(textureSize(iSource1D, 0), 1) : textureSize(iSource2D, 0);\n"
+    "    float w[4] = float[4](1.0, 3.0, 3.0, 1.0);\n"
+    "    int taps = iGaussian == 1 ? 4 : 2;\n"
+    "    int first = iGaussian == 1 ? -1 : 0;\n"
+    "    vec4 sum = vec4(0.0);\n"
+    "    float sum_w = 0.0;\n"
+    "    for (int j = 0; j < (is_1d ? 1 : taps); j++)\n"
+    "    for (int i = 0; i < taps; i++)\n"
+    "    {\n"
+    "        ivec2 p = 2*q + ivec2(first + i, is_1d ? 0 : first + j);\n"
+    "        p = clamp(p, ivec2(0), size - 1);\n"
+    "        float w_ij = iGaussian == 1 ? w[i]*(is_1d ? 1.0 : w[j]) : 1.0;\n"
+    "        sum += w_ij*(is_1d ? texelFetch(iSource1D, p.x, 0) : texelFetch(iSource2D, p, 0));\n"
+    "        sum_w += w_ij;\n"
+    "    }\n"
+    "    fragColor = sum/sum_w;\n"
+    "}\n";
+
+// Ensures that levels[i] is an array of the given size, creating it
+// if it is NULL. Returns false if an existing array has the wrong size.
+static bool fraktal_prepare_level(fArray **level, fArray *like, int width, int height)
+{
+    if (!*level)
+    {
+        *level = fraktal_create_array(NULL, like->channels, width, height, 1, like->format, FRAKTAL_READ_WRITE);
+        return *level != NULL;
+    }
+    fArray *a = *level;
+    if (a->width != width || a->height != height || a->depth != 1 || !a->fbo)
+    {
+        log_err("Failed to build pyramid: level has wrong size or is read-only.\n");
+        return false;
+    }
+    return true;
+}
+
+// Runs the current kernel once per level, reading the previous level
+// through the array parameter at 'offset_1d' or 'offset_2d', depending
+// on its dimensions. Note that a 2D pyramid can end in 1D levels.
+static int fraktal_run_pyramid(int offset_1d, int offset_2d, int loc_is_1d, fArray **levels, int num_levels, fArray *a)
+{
+    int loc_iLevel = fraktal_get_param_offset(fraktal_current_kernel, "iLevel");
+    fArray *src = a;
+    int count = 0;
+    for (int i = 0; i < num_levels; i++)
+    {
+        if (src->width == 1 && src->height == 1)
+            break;
+        int width = (src->width + 1)/2;
+        int height = src->height == 1 ? 1 : (src->height + 1)/2;
+        if (!fraktal_prepare_level(&levels[i], a, width, height))
+            break;
+        fraktal_param_array(src->height == 1 ? offset_1d : offset_2d, src);
+        fraktal_param_1i(loc_is_1d, src->height == 1 ? 1 : 0);
+        fraktal_param_1i(loc_iLevel, i);
+        fraktal_zero_array(levels[i]);
+        fraktal_run_kernel(levels[i]);
+        src = levels[i];
+        count++;
+    }
+    return count;
+}
+
+int fraktal_build_pyramid(fArray **levels, int num_levels, fArray *a, fEnum filter)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(levels);
+    fraktal_assert(num_levels >= 0);
+    fraktal_assert(fraktal_is_valid_array(a));
+    fraktal_assert(a->depth == 1 && "Array must be 1D or 2D.");
+    fraktal_assert(filter == FRAKTAL_BOX || filter == FRAKTAL_GAUSSIAN);
+    fraktal_assert(!fraktal_current_kernel && "Call fraktal_use_kernel(NULL) before building a pyramid.");
+
+    static fKernel *downsample = NULL;
+    static int loc_iSource1D, loc_iSource2D, loc_iSourceIs1D, loc_iGaussian;
+    if (!downsample)
+    {
+        downsample = fraktal_link_builtin("built-in downsample kernel", fraktal_downsample_source);
+        loc_iSource1D = fraktal_get_param_offset(downsample, "iSource1D");
+        loc_iSource2D = fraktal_get_param_offset(downsample, "iSource2D");
+        loc_iSourceIs1D = fraktal_get_param_offset(downsample, "iSourceIs1D");
+        loc_iGaussian = fraktal_get_param_offset(downsample, "iGaussian");
+    }
+
+    fraktal_use_kernel(downsample);
+    fraktal_param_1i(loc_iGaussian, filter == FRAKTAL_GAUSSIAN ? 1 : 0);
+    int count = fraktal_run_pyramid(loc_iSource1D, loc_iSource2D, loc_iSourceIs1D, levels, num_levels, a);
+    fraktal_use_kernel(NULL);
+    return count;
+}
+
+int fraktal_build_pyramid_custom(int offset, fArray **levels, int num_levels, fArray *a)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(fraktal_current_kernel && "Call fraktal_use_kernel first.");
+    fraktal_assert(levels);
+    fraktal_assert(num_levels >= 0);
+    fraktal_assert(fraktal_is_valid_array(a));
+    fraktal_assert(a->depth == 1 && "Array must be 1D or 2D.");
+    return fraktal_run_pyramid(offset, offset, -1, levels, num_levels, a);
+}
+
+void fraktal_generate_mipmaps(fArray *a)
+{
+    FRAKTAL_TRACE_FUNCTION();
+    fraktal_assert(fraktal_is_valid_array(a));
+    fraktal_assert(a->depth == 1 && "Array must be 1D or 2D.");
+    fraktal_assert(!fraktal_recording && "Mipmap generation cannot be recorded in a command list.");
+    int levels = 1;
+    for (int size = a->width > a->height ? a->width : a->height; size > 1; size /= 2)
+        levels++;
+    size_t bytes = fraktal_array_bytes(a);
+    size_t new_bytes = fraktal_array_bytes_internal(a->channels, a->width, a->height, 1, a->format, levels);
+    if (new_bytes > bytes && !fraktal_reserve_array_bytes(new_bytes - bytes))
+    {
+        log_err("Failed to generate mipmaps: memory budget exceeded.\n");
+        return;
+    }
+
+    fraktal_ensure_context();
+    fraktal_check_gl_error();
+
+    GLenum target = a->height == 1 ? GL_TEXTURE_1D : GL_TEXTURE_2D;
+    GLenum binding = a->height == 1 ? GL_TEXTURE_BINDING_1D : GL_TEXTURE_BINDING_2D;
+    GLint last_texture; glGetIntegerv(binding, &last_texture);
+    glBindTexture(target, a->color0);
+    glGenerateMipmap(target);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glBindTexture(target, last_texture);
+
+    fraktal_track_array_bytes(a->format, bytes, false);
+    fraktal_track_array_bytes(a->format, new_bytes, true);
+    a->levels = levels;
+    fraktal_check_gl_error();
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+// GL timer queries, which are also used by the GUI to time its passes
+static bool fraktal_has_timer_queries()
+{
+    return glQueryCounter != NULL && glGetQueryObjecti64v != NULL && glGetInteger64v != NULL;
+}
+
+// Tracing is compiled in with -D FRAKTAL_TRACE. Otherwise the scope
+// macros expand to nothing and the public functions do nothing.
+#ifdef FRAKTAL_TRACE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include "reuse/log.h"
+
+enum { FRAKTAL_TRACE_CAPACITY = 65536 };      // events per thread
+enum { FRAKTAL_TRACE_MAX_GPU_PENDING = 256 }; // unresolved timer queries per thread
+
+struct fTraceEvent
+{
+    const char *name;
+    int64_t begin_ns;
+    int64_t end_ns;
+    bool gpu;
+};
+
+struct fTraceQuery
+{
+    const char *name;
+    GLuint begin;
+    GLuint end;
+};
+
+// Each thread writes to its own ring buffer, so recording never takes
+// a lock. Buffers are pushed onto a global list with compare-and-swap
+// and are never freed, as they may be read by fraktal_trace_dump.
+// When a buffer is full the oldest events are overwritten.
+struct fTraceBuffer
+{
+    fTraceEvent events[FRAKTAL_TRACE_CAPACITY];
+    std::atomic<uint64_t> count;
+    int tid;
+    fTraceQuery pending[FRAKTAL_TRACE_MAX_GPU_PENDING];
+    int num_pending;
+    fTraceBuffer *next;
+};
+
+static std::atomic<bool> fraktal_trace_enabled(false);
+static std::atomic<fTraceBuffer*> fraktal_trace_buffers(NULL);
+static std::atomic<int> fraktal_trace_num_threads(0);
+static char *fraktal_trace_exit_path = NULL;
+
+// Offset from GPU timestamps to the CPU clock, measured once per process.
+static bool fraktal_trace_gpu_calibrated = false;
+static int64_t fraktal_trace_gpu_offset_ns = 0;
+
+static int64_t fraktal_trace_now_ns()
+{
+    using namespace std::chrono;
+    return (int64_t)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static fTraceBuffer *fraktal_trace_buffer()
+{
+    static thread_local fTraceBuffer *buffer = NULL;
+    if (!buffer)
+    {
+        buffer = (fTraceBuffer*)calloc(1, sizeof(fTraceBuffer));
+        fraktal_assert(buffer && "Ran out of memory");
+        buffer->tid = fraktal_trace_num_threads++;
+        fTraceBuffer *head = fraktal_trace_buffers.load();
+        do buffer->next = head;
+        while (!fraktal_trace_buffers.compare_exchange_weak(head, buffer));
+    }
+    return buffer;
+}
+
+static void fraktal_trace_push(fTraceBuffer *buffer, const char *name, int64_t begin_ns, int64_t end_ns, bool gpu)
+{
+    uint64_t i = buffer->count.load(std::memory_order_relaxed);
+    fTraceEvent *e = &buffer->events[i % FRAKTAL_TRACE_CAPACITY];
+    e->name = name;
+    e->begin_ns = begin_ns;
+    e->end_ns = end_ns;
+    e->gpu = gpu;
+    buffer->count.store(i + 1, std::memory_order_release);
+}
+
+// Moves finished GPU queries of the calling thread into its ring buffer.
+// If 'wait' is true, blocks until all pending queries have finished.
+static void fraktal_trace_resolve_gpu(fTraceBuffer *buffer, bool wait)
+{
+    int kept = 0;
+    for (int i = 0; i < buffer->num_pending; i++)
+    {
+        fTraceQuery *q = &buffer->pending[i];
+        GLint available = 0;
+        glGetQueryObjectiv(q->end, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available || wait)
+        {
+            GLint64 begin, end;
+            glGetQueryObjecti64v(q->begin, GL_QUERY_RESULT, &begin);
+            glGetQueryObjecti64v(q->end, GL_QUERY_RESULT, &end);
+            glDeleteQueries(1, &q->begin);
+            glDeleteQueries(1, &q->end);
+            fraktal_trace_push(buffer, q->name,
+                (int64_t)begin + fraktal_trace_gpu_offset_ns,
+                (int64_t)end + fraktal_trace_gpu_offset_ns, true);
+        }
+        else
+        {
+            buffer->pending[kept++] = *q;
+        }
+    }
+    buffer->num_pending = kept;
+}
+
+struct fTraceScope
+{
+    const char *name;
+    int64_t begin_ns;
+    fTraceScope(const char *name) : name(name), begin_ns(0)
+    {
+        if (fraktal_trace_enabled.load(std::memory_order_relaxed))
+            begin_ns = fraktal_trace_now_ns();
+    }
+    ~fTraceScope()
+    {
+        if (begin_ns)
+            fraktal_trace_push(fraktal_trace_buffer(), name, begin_ns, fraktal_trace_now_ns(), false);
+    }
+};
+
+// Measures the GPU time of the commands issued in the scope with a pair
+// of timestamp queries. Results are collected later, without stalling,
+// by subsequent GPU scopes or by fraktal_trace_dump.
+struct fTraceGpuScope
+{
+    fTraceQuery query;
+    bool active;
+    fTraceGpuScope(const char *name) : active(false)
+    {
+        if (!fraktal_trace_enabled.load(std::memory_order_relaxed) || !fraktal_has_timer_queries())
+            return;
+        fTraceBuffer *buffer = fraktal_trace_buffer();
+        fraktal_trace_resolve_gpu(buffer, false);
+        if (buffer->num_pending == FRAKTAL_TRACE_MAX_GPU_PENDING)
+            return;
+        if (!fraktal_trace_gpu_calibrated)
+        {
+            GLint64 gpu_now; glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+            fraktal_trace_gpu_offset_ns = fraktal_trace_now_ns() - (int64_t)gpu_now;
+            fraktal_trace_gpu_calibrated = true;
+        }
+        query.name = name;
+        glGenQueries(1, &query.begin);
+        glGenQueries(1, &query.end);
+        glQueryCounter(query.begin, GL_TIMESTAMP);
+        active = true;
+    }
+    ~fTraceGpuScope()
+    {
+        if (!active)
+            return;
+        glQueryCounter(query.end, GL_TIMESTAMP);
+        fTraceBuffer *buffer = fraktal_trace_buffer();
+        buffer->pending[buffer->num_pending++] = query;
+    }
+};
+
+#define FRAKTAL_TRACE_CONCAT_(a, b) a##b
+#define FRAKTAL_TRACE_CONCAT(a, b) FRAKTAL_TRACE_CONCAT_(a, b)
+#define FRAKTAL_TRACE_SCOPE(name) fTraceScope FRAKTAL_TRACE_CONCAT(fraktal_trace_scope_, __LINE__)(name)
+#define FRAKTAL_TRACE_GPU_SCOPE(name) fTraceGpuScope FRAKTAL_TRACE_CONCAT(fraktal_trace_gpu_scope_, __LINE__)(name)
+#define FRAKTAL_TRACE_FUNCTION() FRAKTAL_TRACE_SCOPE(__FUNCTION__)
+
+static void fraktal_trace_write_event(FILE *f, fTraceEvent *e, int tid, bool *first)
+{
+    // Timestamps are in microseconds
+    fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+        *first ? "" : ",",
+        e->name, e->gpu ? "gpu" : "cpu",
+        e->gpu ? -1 : tid,
+        e->begin_ns/1000.0,
+        (e->end_ns - e->begin_ns)/1000.0);
+    *first = false;
+}
+
+static bool fraktal_trace_write(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        log_err("Failed to write trace to '%s'.\n", path);
+        return false;
+    }
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    fprintf(f, "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":-1,\"args\":{\"name\":\"GPU\"}}");
+    bool first = false;
+    for (fTraceBuffer *buffer = fraktal_trace_buffers.load(); buffer; buffer = buffer->next)
+    {
+        uint64_t count = buffer->count.load(std::memory_order_acquire);
+        uint64_t begin = count > FRAKTAL_TRACE_CAPACITY ? count - FRAKTAL_TRACE_CAPACITY : 0;
+        for (uint64_t i = begin; i < count; i++)
+            fraktal_trace_write_event(f, &buffer->events[i % FRAKTAL_TRACE_CAPACITY], buffer->tid, &first);
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return true;
+}
+
+static void fraktal_trace_atexit()
+{
+    // The GPU context may already be gone, so pending queries are lost
+    if (fraktal_trace_exit_path)
+        fraktal_trace_write(fraktal_trace_exit_path);
+}
+
+void fraktal_trace_begin(const char *exit_path)
+{
+    static bool registered = false;
+    free(fraktal_trace_exit_path);
+    fraktal_trace_exit_path = NULL;
+    if (exit_path)
+    {
+        fraktal_trace_exit_path = (char*)malloc(strlen(exit_path) + 1);
+        fraktal_assert(fraktal_trace_exit_path && "Ran out of memory");
+        strcpy(fraktal_trace_exit_path, exit_path);
+    }
+    if (exit_path && !registered)
+    {
+        atexit(fraktal_trace_atexit);
+        registered = true;
+    }
+    fraktal_trace_enabled = true;
+}
+
+void fraktal_trace_end()
+{
+    fraktal_trace_enabled = false;
+}
+
+bool fraktal_trace_dump(const char *path)
+{
+    fraktal_assert(path);
+    fTraceBuffer *buffer = fraktal_trace_buffer();
+    if (buffer->num_pending > 0)
+        fraktal_trace_resolve_gpu(buffer, true);
+    return fraktal_trace_write(path);
+}
+
+#else
+
+#define FRAKTAL_TRACE_SCOPE(name)
+#define FRAKTAL_TRACE_GPU_SCOPE(name)
+#define FRAKTAL_TRACE_FUNCTION()
+
+void fraktal_trace_begin(const char *exit_path) { (void)exit_path; }
+void fraktal_trace_end() { }
+bool fraktal_trace_dump(const char *path) { (void)path; return false; }
+
+#endif
@@ -62,3 +62,24 @@ struct fParams
     int sampler_count;
     int count;
 };
+
+typedef int fCommandType;
+enum fCommandType_
+{
+    FRAKTAL_COMMAND_USE_KERNEL,
+    FRAKTAL_COMMAND_PARAM,
+    FRAKTAL_COMMAND_PARAM_ARRAY,
+    FRAKTAL_COMMAND_ZERO_ARRAY,
+    FRAKTAL_COMMAND_RUN_KERNEL,
+};
+struct fCommand
+{
+    fCommandType type;
+    fKernel *kernel;        // kernel in use when the command was recorded
+    fArray *array;          // bound, cleared or output array
+    fParamType param_type;
+    int offset;
+    int tex_unit;           // resolved when recording array parameters
+    float f[16];
+    int i[4];
+};
@@ -28,11 +28,28 @@
 
 #include <open_sans_semi_bold.h>
 
-#define ENABLE_CONE_TRACING_OPTIMIZATION 0
-
 enum { MAX_WIDGETS = 128 };
 enum { NUM_PRESETS = 10 };
+enum { MAX_CONE_LEVELS = 6 };    // levels in the cone-tracing pre-pass
+enum { CONE_FINEST_BLOCK = 4 };  // pixels per side covered by a cone at the finest level
+enum { CONE_COARSEST_SIZE = 4 }; // texels along the short side of the coarsest level
+enum { MAX_PRIMARY_STRATA = 4 }; // per side of a pixel in the primary-hit cache
+enum { HIT_CACHE_MAX_SIZE = 4096 }; // texels along a side of the primary-hit cache
+enum { HIT_CACHE_REUSE = 4 }; // samples per stratum before the cache is filled again
+enum { MODEL_BOUNDS_RESOLUTION = 64 }; // cells along each side when estimating bounds
+static const float MODEL_BOUNDS_EXTENT = 64.0f; // of the region searched for the model
+enum { ADAPTIVE_CHECK_EVERY = 8 }; // frames between checks of global convergence
+static const float ADAPTIVE_STOP_FRACTION = 0.995f; // of converged pixels
+static const float REPROJECT_MAX_HISTORY = 64.0f; // samples kept per pixel
+static const float REPROJECT_DEPTH_TOLERANCE = 0.02f; // relative
+enum { MAX_PREVIEW_LEVEL = 3 }; // previews are rendered at down to 1/2^3 of the resolution
+static const double PREVIEW_TARGET_TIME = 1.0/30.0; // seconds per preview frame
+static const double PREVIEW_SETTLE_TIME = 0.25; // seconds without changes before refining
+enum { MAX_SAMPLES_PER_FRAME = 64 };
+enum { MAX_PENDING_TIMERS = 4 }; // GPU timer queries in flight
 struct Widget;
+struct Widget_Camera;
+struct Widget_Tracing;
 struct guiKey
 {
     bool pressed;
@@ -60,6 +77,8 @@ struct guiPreset
 {
     Widget *widgets[MAX_WIDGETS];
     int num_widgets;
+    Widget_Camera *camera;   // also in widgets
+    Widget_Tracing *tracing; // also in widgets
 };
 struct guiSettings
 {
@@ -73,7 +92,17 @@ struct guiPaths
     const char *geometry;
     const char *compose;
 };
-struct Widget_Camera;
+
+// Timestamp queries around accumulation passes, which are read back a few
+// frames later, so that the CPU never waits for the GPU.
+struct guiSampleTimer
+{
+    GLuint begin[MAX_PENDING_TIMERS];
+    GLuint end[MAX_PENDING_TIMERS];
+    int samples[MAX_PENDING_TIMERS];
+    int num_pending;
+};
+
 struct guiState
 {
     guiPaths new_paths;
@@ -87,11 +116,77 @@ struct guiState
     fArray *compose_buffer;
     fKernel *render_kernel;
     fKernel *compose_kernel;
+    fKernel *bake_kernel;
+    fBrickMap *brick_map;
+    bool use_brick_map;
+    int brick_map_resolution;
+    float brick_map_extent;
+    bool use_model_bounds;      // clip rays to the bounds (see libf/trace.f)
+    fModelParams *model_bounds_params; // model parameters the bounds were estimated with
+    bool has_model_bounds;      // or else the model may be unbounded
+    float model_bounds_min[3];
+    float model_bounds_max[3];
+    float model_bounds_lipschitz;
+    bool use_cone_tracing;
+    fArray *cone_buffers[MAX_CONE_LEVELS]; // from coarse to fine
+    int num_cone_levels;
+    bool use_hit_cache;
+    fArray *hit_cache;          // first hits of primary rays, see libf/publication.f, or NULL if unused
+    int primary_strata;
+    int sampler;                // SAMPLER_ constant in libf/sampling.f
+    fArray *blue_noise;
+    fKernel *converge_kernel;
+    bool use_adaptive_sampling;
+    float adaptive_tolerance;   // relative standard error of a converged pixel
+    int adaptive_min_samples;   // samples of a pixel before it can converge
+    fArray *batch_buffer;       // samples rendered in the current frame
+    fArray *moment_buffer;      // see libf/converge.f
+    fArray *converged_buffer;   // 1 for converged pixels, and relative error
+    float converged_fraction;
+    bool converged;
+    fKernel *guide_kernel;      // libf/geometry.f, for the denoiser's guide
+    fKernel *denoise_kernel;
+    bool use_denoiser;
+    int denoise_iterations;
+    float denoise_strength;
+    fArray *guide_buffer;       // normal and distance, see libf/denoise.f
+    fArray *denoise_buffers[2];
+    bool guide_is_current;      // guide is of the view of the accumulated samples
+    float guide_inverse_view[4*4];
+    float guide_camera_f;
+    float2 guide_camera_center;
+    fKernel *reproject_kernel;
+    bool use_reprojection;
+    bool has_history;           // accumulated samples were reprojected
+    bool counts_per_pixel;      // samples are counted per pixel in alpha
+    fArray *previous_guide_buffer;
+    fArray *history_buffer;     // reprojected samples, swapped with render_buffer
+    bool use_progressive_resolution;
+    int preview_level;          // resolution is divided by 2^level while interacting
+    fArray *shown_preview;      // or NULL if showing the accumulated samples
+    bool pending_clear;         // changes made while showing previews
+    bool pending_reproject;
+    double last_change_time;
+    fArray *preview_render_buffers[MAX_PREVIEW_LEVEL + 1]; // level 0 is unused
+    fArray *preview_compose_buffers[MAX_PREVIEW_LEVEL + 1];
     bool render_kernel_is_new;
     bool compose_kernel_is_new;
+    bool converge_kernel_is_new;
+    bool guide_kernel_is_new;
+    bool denoise_kernel_is_new;
+    bool reproject_kernel_is_new;
     int samples;
     int max_samples;
+    int samples_per_frame;      // set by hand
+    int budget_samples_per_frame; // fit to the frame budget
+    int batches;                // rendered since the samples were cleared
+    bool use_frame_budget;      // use budget_samples_per_frame
+    float frame_budget_ms;
+    float gpu_ms_per_sample;    // moving average, or 0 if not measured yet
+    guiSampleTimer sample_timer;
     bool should_clear;
+    bool should_reproject;      // only the camera changed
+    bool should_compose;        // only denoise and compose the accumulated samples
     bool should_exit;
     bool initialized;
     bool auto_render;
@@ -114,13 +209,14 @@ struct guiState
 #include "widgets/Ground.h"
 #include "widgets/Material.h"
 #include "widgets/Geometry.h"
+#include "widgets/Tracing.h"
 
 static void save_screenshot(const char *filename, fArray *f)
 {
     assert(filename);
     assert(f);
     assert(fraktal_array_format(f) == FRAKTAL_UINT8);
-    int w,h; fraktal_array_size(f, &w,&h);
+    int w,h; fraktal_array_size(f, &w,&h,NULL);
     int n = fraktal_array_channels(f);
     assert(w > 0 && h > 0 && n > 0);
     unsigned char *pixels = (unsigned char*)malloc(w*h*n);
@@ -129,6 +225,104 @@ static void save_screenshot(const char *filename, fArray *f)
     free(pixels);
 }
 
+static void blue_noise_splat(float *energy, int size, int x, int y, float sign)
+{
+    const int radius = 6;
+    const float sigma = 1.5f;
+    for (int dy = -radius; dy <= radius; dy++)
+    for (int dx = -radius; dx <= radius; dx++)
+    {
+        int xi = (x + dx + size) % size;
+        int yi = (y + dy + size) % size;
+        energy[xi + yi*size] += sign*expf(-(dx*dx + dy*dy)/(2.0f*sigma*sigma));
+    }
+}
+
+// Finds the tightest cluster (the set pixel with the most energy) or the
+// largest void (the unset pixel with the least energy).
+static int blue_noise_find(const float *energy, const bool *on, int n, bool cluster)
+{
+    int best = -1;
+    for (int i = 0; i < n; i++)
+    {
+        if (on[i] != cluster)
+            continue;
+        if (best < 0 || (cluster ? energy[i] > energy[best] : energy[i] < energy[best]))
+            best = i;
+    }
+    return best;
+}
+
+// Generates a tileable size x size blue-noise texture by the void-and-cluster
+// method (Ulichney, 1993), for the blue-noise sampler in libf/sampling.f.
+static fArray *create_blue_noise(int size)
+{
+    int n = size*size;
+    bool *on = (bool*)calloc(n, sizeof(bool));
+    bool *prototype = (bool*)calloc(n, sizeof(bool));
+    float *energy = (float*)calloc(n, sizeof(float));
+    float *prototype_energy = (float*)calloc(n, sizeof(float));
+    float *rank = (float*)calloc(n, sizeof(float));
+    assert(on && prototype && energy && prototype_energy && rank);
+
+    // Random initial pattern, which is made uniform by repeatedly moving the
+    // point in the tightest cluster to the largest void.
+    unsigned int state = 1;
+    int ones = n/10;
+    for (int placed = 0; placed < ones; )
+    {
+        state = state*1664525u + 1013904223u;
+        int i = (state >> 8) % n;
+        if (on[i])
+            continue;
+        on[i] = true;
+        blue_noise_splat(energy, size, i % size, i / size, +1.0f);
+        placed++;
+    }
+    for (int iteration = 0; iteration < n; iteration++)
+    {
+        int cluster = blue_noise_find(energy, on, n, true);
+        on[cluster] = false;
+        blue_noise_splat(energy, size, cluster % size, cluster / size, -1.0f);
+        int void_ = blue_noise_find(energy, on, n, false);
+        on[void_] = true;
+        blue_noise_splat(energy, size, void_ % size, void_ / size, +1.0f);
+        if (void_ == cluster)
+            break;
+    }
+    memcpy(prototype, on, n*sizeof(bool));
+    memcpy(prototype_energy, energy, n*sizeof(float));
+
+    // Rank the initial points by removing tightest clusters, and the rest by
+    // filling the largest voids.
+    for (int r = ones - 1; r >= 0; r--)
+    {
+        int cluster = blue_noise_find(energy, on, n, true);
+        on[cluster] = false;
+        blue_noise_splat(energy, size, cluster % size, cluster / size, -1.0f);
+        rank[cluster] = (float)r;
+    }
+    memcpy(on, prototype, n*sizeof(bool));
+    memcpy(energy, prototype_energy, n*sizeof(float));
+    for (int r = ones; r < n; r++)
+    {
+        int void_ = blue_noise_find(energy, on, n, false);
+        on[void_] = true;
+        blue_noise_splat(energy, size, void_ % size, void_ / size, +1.0f);
+        rank[void_] = (float)r;
+    }
+
+    for (int i = 0; i < n; i++)
+        rank[i] = (rank[i] + 0.5f)/n;
+    fArray *a = fraktal_create_array(rank, 1, size, size, 1, FRAKTAL_FLOAT, FRAKTAL_READ_ONLY);
+    free(on);
+    free(prototype);
+    free(energy);
+    free(prototype_energy);
+    free(rank);
+    return a;
+}
+
 static fKernel *load_render_shader(const char *model_path, const char *render_path)
 {
     fLinkState *link = fraktal_create_link();
@@ -179,6 +373,27 @@ static fKernel *load_render_shader(const char *model_path, const char *render_pa
         return NULL;
     }
 
+    if (!fraktal_add_link_file(link, "libf/brickmap.f"))
+    {
+        log_err("Failed to load render kernel: error compiling libf/brickmap.f.\n");
+        fraktal_destroy_link(link);
+        return NULL;
+    }
+
+    if (!fraktal_add_link_file(link, "libf/trace.f"))
+    {
+        log_err("Failed to load render kernel: error compiling libf/trace.f.\n");
+        fraktal_destroy_link(link);
+        return NULL;
+    }
+
+    if (!fraktal_add_link_file(link, "libf/sampling.f"))
+    {
+        log_err("Failed to load render kernel: error compiling libf/sampling.f.\n");
+        fraktal_destroy_link(link);
+        return NULL;
+    }
+
     fKernel *kernel = fraktal_link_kernel(link);
     fraktal_destroy_link(link);
     return kernel;
@@ -206,6 +421,47 @@ static bool load_gui(guiState &g)
         return false;
     }
 
+    fKernel *bake = load_render_shader(g.new_paths.model, "libf/grid.f");
+    if (!bake)
+    {
+        log_err("Failed to load scene: error compiling brick map kernel.\n");
+        fraktal_destroy_kernel(render);
+        fraktal_destroy_kernel(compose);
+        return false;
+    }
+
+    fKernel *converge = fraktal_load_kernel("libf/converge.f");
+    if (!converge)
+    {
+        log_err("Failed to load scene: error compiling libf/converge.f.\n");
+        fraktal_destroy_kernel(render);
+        fraktal_destroy_kernel(compose);
+        fraktal_destroy_kernel(bake);
+        return false;
+    }
+
+    fKernel *guide = NULL;
+    fKernel *denoise = NULL;
+    fKernel *reproject = NULL;
+    if (g.new_mode == guiPreviewMode_Color)
+    {
+        guide = load_render_shader(g.new_paths.model, g.new_paths.geometry);
+        denoise = fraktal_load_kernel("libf/denoise.f");
+        reproject = fraktal_load_kernel("libf/reproject.f");
+        if (!guide || !denoise || !reproject)
+        {
+            log_err("Failed to load scene: error compiling denoiser or reprojection kernels.\n");
+            fraktal_destroy_kernel(render);
+            fraktal_destroy_kernel(compose);
+            fraktal_destroy_kernel(bake);
+            fraktal_destroy_kernel(converge);
+            fraktal_destroy_kernel(guide);
+            fraktal_destroy_kernel(denoise);
+            fraktal_destroy_kernel(reproject);
+            return false;
+        }
+    }
+
     // Refetch uniform offsets
     for (int preset = 0; preset < NUM_PRESETS; preset++)
     for (int widget = 0; widget < g.presets[preset].num_widgets; widget++)
@@ -217,12 +473,43 @@ static bool load_gui(guiState &g)
     // Destroy old state and update to newly loaded state
     fraktal_destroy_kernel(g.render_kernel);
     fraktal_destroy_kernel(g.compose_kernel);
+    fraktal_destroy_kernel(g.bake_kernel);
+    fraktal_destroy_kernel(g.converge_kernel);
+    fraktal_destroy_kernel(g.guide_kernel);
+    fraktal_destroy_kernel(g.denoise_kernel);
+    fraktal_destroy_kernel(g.reproject_kernel);
     g.paths = g.new_paths;
     g.mode = g.new_mode;
     g.render_kernel = render;
     g.compose_kernel = compose;
+    g.bake_kernel = bake;
+    g.converge_kernel = converge;
+    g.guide_kernel = guide;
+    g.denoise_kernel = denoise;
+    g.reproject_kernel = reproject;
+
+    // Pending timer queries measured the old kernels
+    for (int i = 0; i < g.sample_timer.num_pending; i++)
+    {
+        glDeleteQueries(1, &g.sample_timer.begin[i]);
+        glDeleteQueries(1, &g.sample_timer.end[i]);
+    }
+    g.sample_timer.num_pending = 0;
+    g.gpu_ms_per_sample = 0.0f;
+
+    if (!g.brick_map)
+        g.brick_map = fraktal_create_brick_map();
+    fraktal_invalidate_brick_map(g.brick_map);
     g.render_kernel_is_new = true;
     g.compose_kernel_is_new = true;
+    g.converge_kernel_is_new = true;
+    g.guide_kernel_is_new = true;
+    g.denoise_kernel_is_new = true;
+    g.reproject_kernel_is_new = true;
+    g.shown_preview = NULL;
+    if (!g.model_bounds_params)
+        g.model_bounds_params = fraktal_create_model_params();
+    fraktal_invalidate_model_params(g.model_bounds_params);
     g.should_clear = true;
     g.initialized = true;
 
@@ -231,65 +518,345 @@ static bool load_gui(guiState &g)
 
 #define fetch_uniform(kernel, name) static int loc_##name; if (scene.kernel##_is_new) loc_##name = fraktal_get_param_offset(scene.kernel, #name);
 
-#if ENABLE_CONE_TRACING_OPTIMIZATION
-static void render_color(guiState &scene)
+// Sets the widget parameters of the kernel 'f', which must be in use. The
+// widgets hold the parameter offsets of the render kernel, so they are
+// fetched for 'f' and restored afterwards.
+static void set_widget_params(guiState &scene, fKernel *f)
 {
-    if (!scene.render_kernel || !scene.compose_kernel)
-        return;
-    assert(scene.render_kernel);
-    assert(scene.compose_kernel);
-    assert(fraktal_is_valid_array(scene.render_buffer));
-    assert(fraktal_is_valid_array(scene.compose_buffer));
+    assert(scene.preset);
+    for (int i = 0; i < scene.preset->num_widgets; i++)
+    {
+        Widget *widget = scene.preset->widgets[i];
+        widget->get_param_offsets(f);
+        if (widget->is_active())
+            widget->set_params(scene);
+        widget->get_param_offsets(scene.render_kernel);
+    }
+}
 
-    // todo: handle aspect ratio
-    static int t_buffer_width = 16;
-    static int t_buffer_height = 12;
-    static fArray *t_buffer = fraktal_create_array(NULL, t_buffer_width, t_buffer_height, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
-    assert(t_buffer);
+// Re-bakes the brick map if it is enabled and out of date. Must be called
+// with the render kernel in use, after its parameters have been set.
+static void update_brick_map(guiState &scene)
+{
+    if (!scene.use_brick_map)
+    {
+        fraktal_param_brick_map(NULL);
+        return;
+    }
+    assert(scene.brick_map);
+    if (!fraktal_is_brick_map_current(scene.brick_map))
+    {
+        // The map records the model parameters of the bake kernel, which
+        // must have the same values as in the render kernel.
+        float e = scene.brick_map_extent;
+        float bounds_min[] = { -e, -e, -e };
+        float bounds_max[] = { +e, +e, +e };
+        fraktal_use_kernel(scene.bake_kernel);
+        set_widget_params(scene, scene.bake_kernel);
+        fraktal_bake_brick_map(scene.brick_map, bounds_min, bounds_max, scene.brick_map_resolution);
+        fraktal_use_kernel(scene.render_kernel);
+
+        // Otherwise the map would be baked again every frame
+        if (!fraktal_is_brick_map_current(scene.brick_map))
+        {
+            log_err("The brick map does not match the model parameters of the render kernel, and was disabled.\n");
+            fraktal_invalidate_brick_map(scene.brick_map);
+            scene.use_brick_map = false;
+            fraktal_param_brick_map(NULL);
+            return;
+        }
+    }
+    fraktal_param_brick_map(scene.brick_map);
+}
 
-    fraktal_use_kernel(scene.render_kernel);
+// Estimates the bounds of the model if they are out of date, and sets the
+// libf/trace.f parameters of the kernel 'f', which must be in use, to clip
+// rays to them.
+static void update_model_bounds(guiState &scene, fKernel *f)
+{
+    int loc_iBoundsEnabled = fraktal_get_param_offset(f, "iBoundsEnabled");
+    int loc_iBoundsMin = fraktal_get_param_offset(f, "iBoundsMin");
+    int loc_iBoundsMax = fraktal_get_param_offset(f, "iBoundsMax");
+    if (!scene.use_model_bounds || loc_iBoundsEnabled < 0)
     {
-        fetch_uniform(render_kernel, iLowResolution);
-        fetch_uniform(render_kernel, iResolution);
-        fetch_uniform(render_kernel, iChannel0);
-        fetch_uniform(render_kernel, iMode);
-        fetch_uniform(render_kernel, iSamples);
-        scene.render_kernel_is_new = false;
+        fraktal_param_1i(loc_iBoundsEnabled, 0);
+        return;
+    }
 
-        int width,height;
-        fraktal_array_size(scene.render_buffer, &width, &height);
+    // The bounds are only conservative for the Lipschitz bound of the
+    // Tracing widget
+    assert(scene.preset);
+    fraktal_assert(scene.preset->tracing);
+    float lipschitz = scene.preset->tracing->lipschitz;
+    if (lipschitz < 1.0f)
+        lipschitz = 1.0f;
+    // The parameters of 'f' have the values of the bake kernel's, as for
+    // the brick map
+    assert(scene.model_bounds_params);
+    if (!fraktal_model_params_match(scene.model_bounds_params) || scene.model_bounds_lipschitz != lipschitz)
+    {
+        // A coarse search for the model, which is then refined within a
+        // region one coarse cell larger than the coarse bounds.
+        float e = MODEL_BOUNDS_EXTENT;
+        float region_min[] = { -e, -e, -e };
+        float region_max[] = { +e, +e, +e };
+        float *lo = scene.model_bounds_min;
+        float *hi = scene.model_bounds_max;
+        fraktal_use_kernel(scene.bake_kernel);
+        set_widget_params(scene, scene.bake_kernel);
+        scene.has_model_bounds = fraktal_estimate_bounds(lo, hi, region_min, region_max, MODEL_BOUNDS_RESOLUTION, lipschitz);
+        float cell_size = 2.0f*e/MODEL_BOUNDS_RESOLUTION;
+        if (scene.has_model_bounds)
+        {
+            float extent = 0.0f;
+            for (int k = 0; k < 3; k++)
+            {
+                region_min[k] = lo[k] - cell_size;
+                region_max[k] = hi[k] + cell_size;
+                if (region_max[k] - region_min[k] > extent)
+                    extent = region_max[k] - region_min[k];
+            }
+            float fine_min[3], fine_max[3];
+            if (fraktal_estimate_bounds(fine_min, fine_max, region_min, region_max, MODEL_BOUNDS_RESOLUTION, lipschitz))
+            {
+                memcpy(lo, fine_min, sizeof(fine_min));
+                memcpy(hi, fine_max, sizeof(fine_max));
+                cell_size = extent/MODEL_BOUNDS_RESOLUTION;
+            }
 
-        fraktal_param_2f(loc_iResolution, (float)width, (float)height);
-        fraktal_param_2f(loc_iLowResolution, (float)t_buffer_width, (float)t_buffer_height);
+            // Rays stop within a pixel's footprint of the surface, which
+            // may be slightly outside the model
+            for (int k = 0; k < 3; k++)
+            {
+                lo[k] -= cell_size;
+                hi[k] += cell_size;
+            }
+        }
+        fraktal_record_model_params(scene.model_bounds_params);
+        fraktal_use_kernel(f);
+        scene.model_bounds_lipschitz = lipschitz;
 
-        assert(scene.preset);
-        for (int i = 0; i < scene.preset->num_widgets; i++)
+        // Otherwise the bounds would be estimated again every frame
+        if (!fraktal_model_params_match(scene.model_bounds_params))
         {
-            if (scene.preset->widgets[i]->is_active())
-                scene.preset->widgets[i]->set_params(scene);
+            log_err("The model bounds do not match the model parameters of the kernel, and were disabled.\n");
+            scene.use_model_bounds = false;
+            fraktal_param_1i(loc_iBoundsEnabled, 0);
+            return;
         }
+    }
 
-        // cone tracing pass
-        if (scene.should_clear)
+    if (scene.has_model_bounds)
+    {
+        fraktal_param_1i(loc_iBoundsEnabled, 1);
+        fraktal_param_3f(loc_iBoundsMin, scene.model_bounds_min[0], scene.model_bounds_min[1], scene.model_bounds_min[2]);
+        fraktal_param_3f(loc_iBoundsMax, scene.model_bounds_max[0], scene.model_bounds_max[1], scene.model_bounds_max[2]);
+    }
+    else
+    {
+        fraktal_param_1i(loc_iBoundsEnabled, 0);
+    }
+}
+
+// Updates the GPU time per sample from the timer queries that have finished
+static void resolve_sample_timers(guiState &scene)
+{
+    guiSampleTimer &timer = scene.sample_timer;
+    int kept = 0;
+    for (int i = 0; i < timer.num_pending; i++)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(timer.end[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
         {
-            fraktal_param_1i(loc_iMode, 1);
-            fraktal_zero_array(t_buffer);
-            fraktal_run_kernel(t_buffer);
+            GLint64 begin,end;
+            glGetQueryObjecti64v(timer.begin[i], GL_QUERY_RESULT, &begin);
+            glGetQueryObjecti64v(timer.end[i], GL_QUERY_RESULT, &end);
+            glDeleteQueries(1, &timer.begin[i]);
+            glDeleteQueries(1, &timer.end[i]);
+            float ms = (float)((end - begin)*1e-6)/timer.samples[i];
+            if (scene.gpu_ms_per_sample > 0.0f)
+                scene.gpu_ms_per_sample = 0.75f*scene.gpu_ms_per_sample + 0.25f*ms;
+            else
+                scene.gpu_ms_per_sample = ms;
+        }
+        else
+        {
+            timer.begin[kept] = timer.begin[i];
+            timer.end[kept] = timer.end[i];
+            timer.samples[kept] = timer.samples[i];
+            kept++;
         }
+    }
+    timer.num_pending = kept;
+}
 
-        // accumulation pass
-        if (scene.should_clear)
+// Returns the number of samples to render this frame. With the frame budget
+// enabled, this is as many as the GPU is measured to finish within it.
+static int schedule_samples(guiState &scene)
+{
+    int per_frame = scene.samples_per_frame;
+    if (scene.use_frame_budget && fraktal_has_timer_queries())
+    {
+        resolve_sample_timers(scene);
+        if (scene.gpu_ms_per_sample > 0.0f)
         {
-            fraktal_zero_array(scene.render_buffer);
-            scene.samples = 0;
-            scene.should_clear = false;
+            int n = (int)(scene.frame_budget_ms/scene.gpu_ms_per_sample);
+
+            // The estimate lags behind, so the number is only raised gradually
+            if (n > 2*scene.budget_samples_per_frame) n = 2*scene.budget_samples_per_frame;
+            if (n > MAX_SAMPLES_PER_FRAME) n = MAX_SAMPLES_PER_FRAME;
+            if (n < 1) n = 1;
+            scene.budget_samples_per_frame = n;
         }
+        per_frame = scene.budget_samples_per_frame;
+    }
+    int n = scene.max_samples - scene.samples;
+    if (n > per_frame) n = per_frame;
+    if (n < 1) n = 1;
+    return n;
+}
+
+// Renders the first hit of each pixel in the current view (see DRAW_MODE_GUIDE
+// in libf/geometry.f), which the denoiser and reprojection are guided by.
+static void render_guide(guiState &scene)
+{
+    assert(scene.guide_kernel);
+    fraktal_use_kernel(scene.guide_kernel);
+    fetch_uniform(guide_kernel, iResolution);
+    fetch_uniform(guide_kernel, iDrawMode);
+    scene.guide_kernel_is_new = false;
+
+    int width,height;
+    fraktal_array_size(scene.guide_buffer, &width, &height, NULL);
+    fraktal_param_2f(loc_iResolution, (float)width, (float)height);
+    fraktal_param_1i(loc_iDrawMode, 4);
+    set_widget_params(scene, scene.guide_kernel);
+    if (scene.use_brick_map && fraktal_is_brick_map_current(scene.brick_map))
+        fraktal_param_brick_map(scene.brick_map);
+    else
+        fraktal_param_brick_map(NULL);
+    update_model_bounds(scene, scene.guide_kernel);
+
+    fraktal_zero_array(scene.guide_buffer);
+    fraktal_run_kernel(scene.guide_buffer);
 
-        fraktal_param_1i(loc_iMode, 0);
+    Widget_Camera *camera = scene.preset->camera;
+    float view[4*4];
+    camera->get_camera(scene, view, &scene.guide_camera_f, &scene.guide_camera_center);
+    invert_view_matrix(scene.guide_inverse_view, view);
+    scene.guide_is_current = true;
+}
+
+// Moves the accumulated samples into the view of the camera after it moved,
+// keeping those that still see the same surface (see libf/reproject.f).
+static void reproject_samples(guiState &scene)
+{
+    assert(scene.guide_is_current);
+    assert(scene.reproject_kernel);
+
+    fArray *previous_guide = scene.guide_buffer;
+    scene.guide_buffer = scene.previous_guide_buffer;
+    scene.previous_guide_buffer = previous_guide;
+    float previous_inverse_view[4*4];
+    memcpy(previous_inverse_view, scene.guide_inverse_view, sizeof(previous_inverse_view));
+    float previous_camera_f = scene.guide_camera_f;
+    float2 previous_camera_center = scene.guide_camera_center;
+    render_guide(scene);
+
+    fraktal_use_kernel(scene.reproject_kernel);
+    fetch_uniform(reproject_kernel, iChannel0);
+    fetch_uniform(reproject_kernel, iAccumulated);
+    fetch_uniform(reproject_kernel, iGuide);
+    fetch_uniform(reproject_kernel, iPreviousGuide);
+    fetch_uniform(reproject_kernel, iResolution);
+    fetch_uniform(reproject_kernel, iPreviousCameraCenter);
+    fetch_uniform(reproject_kernel, iPreviousCameraF);
+    fetch_uniform(reproject_kernel, iPreviousInverseView);
+    fetch_uniform(reproject_kernel, iMaxHistory);
+    fetch_uniform(reproject_kernel, iDepthTolerance);
+    scene.reproject_kernel_is_new = false;
+
+    int width,height;
+    fraktal_array_size(scene.guide_buffer, &width, &height, NULL);
+    fraktal_param_2f(loc_iResolution, (float)width, (float)height);
+    Widget *camera = scene.preset->camera;
+    camera->get_param_offsets(scene.reproject_kernel);
+    camera->set_params(scene);
+    camera->get_param_offsets(scene.render_kernel);
+    fraktal_param_2f(loc_iPreviousCameraCenter, previous_camera_center.x, previous_camera_center.y);
+    fraktal_param_1f(loc_iPreviousCameraF, previous_camera_f);
+    fraktal_param_transpose_matrix4f(loc_iPreviousInverseView, previous_inverse_view);
+    fraktal_param_array(loc_iGuide, scene.guide_buffer);
+    fraktal_param_array(loc_iPreviousGuide, scene.previous_guide_buffer);
+    fraktal_param_1f(loc_iMaxHistory, REPROJECT_MAX_HISTORY);
+    fraktal_param_1f(loc_iDepthTolerance, REPROJECT_DEPTH_TOLERANCE);
+
+    // accumulated samples
+    fArray *accumulated = scene.render_buffer;
+    fraktal_param_array(loc_iChannel0, accumulated);
+    fraktal_param_array(loc_iAccumulated, accumulated);
+    fraktal_zero_array(scene.history_buffer);
+    fraktal_run_kernel(scene.history_buffer);
+    scene.render_buffer = scene.history_buffer;
+    scene.history_buffer = accumulated;
+
+    // adaptive sampling moments, with the converged buffer as scratch
+    fArray *moments = scene.moment_buffer;
+    fraktal_param_array(loc_iChannel0, moments);
+    fraktal_zero_array(scene.converged_buffer);
+    fraktal_run_kernel(scene.converged_buffer);
+    scene.moment_buffer = scene.converged_buffer;
+    scene.converged_buffer = moments;
+    fraktal_zero_array(scene.converged_buffer);
+
+    scene.samples = 0;
+    scene.batches = 0;
+    scene.converged_fraction = 0.0f;
+    scene.converged = false;
+    scene.has_history = true;
+}
+
+// Denoises and composes the accumulated samples into the compose buffer.
+// This is also run on its own when only the denoiser settings change.
+static void compose_color(guiState &scene)
+{
+    if (!scene.compose_kernel)
+        return;
+    bool use_denoiser = scene.use_denoiser && scene.guide_kernel && scene.denoise_kernel;
+    bool count_per_pixel = scene.counts_per_pixel;
+    if (use_denoiser && !scene.guide_is_current)
+        render_guide(scene);
+
+    // denoising passes
+    fArray *denoised = NULL;
+    if (use_denoiser)
+    {
+        fraktal_use_kernel(scene.denoise_kernel);
+        fetch_uniform(denoise_kernel, iChannel0);
+        fetch_uniform(denoise_kernel, iGuide);
+        fetch_uniform(denoise_kernel, iPass);
+        fetch_uniform(denoise_kernel, iSamples);
+        fetch_uniform(denoise_kernel, iAdaptive);
+        fetch_uniform(denoise_kernel, iColorPhi);
+        fetch_uniform(denoise_kernel, iNormalPhi);
+        fetch_uniform(denoise_kernel, iDepthPhi);
+        scene.denoise_kernel_is_new = false;
+
+        fraktal_param_array(loc_iChannel0, scene.render_buffer);
+        fraktal_param_array(loc_iGuide, scene.guide_buffer);
+        fraktal_param_1i(loc_iPass, 0);
         fraktal_param_1i(loc_iSamples, scene.samples);
-        fraktal_param_array(loc_iChannel0, t_buffer);
-        fraktal_run_kernel(scene.render_buffer);
-        scene.samples++;
+        fraktal_param_1i(loc_iAdaptive, count_per_pixel ? 1 : 0);
+        fraktal_zero_array(scene.denoise_buffers[0]);
+        fraktal_run_kernel(scene.denoise_buffers[0]);
+
+        // The noise, and thereby the color tolerance, falls as 1/sqrt(samples)
+        fraktal_param_1i(loc_iPass, 1);
+        fraktal_param_1f(loc_iColorPhi, scene.denoise_strength/sqrtf((float)scene.samples));
+        fraktal_param_1f(loc_iNormalPhi, 64.0f);
+        fraktal_param_1f(loc_iDepthPhi, 0.05f);
+        denoised = fraktal_iterate(loc_iChannel0, scene.denoise_buffers[0], scene.denoise_buffers[1], scene.denoise_iterations);
     }
 
     // compose pass
@@ -298,14 +865,23 @@ static void render_color(guiState &scene)
         fetch_uniform(compose_kernel, iResolution);
         fetch_uniform(compose_kernel, iChannel0);
         fetch_uniform(compose_kernel, iSamples);
+        fetch_uniform(compose_kernel, iAdaptive);
         scene.compose_kernel_is_new = false;
 
         fArray *out = scene.compose_buffer;
         fArray *in = scene.render_buffer;
         int width,height;
-        fraktal_array_size(out, &width, &height);
+        fraktal_array_size(out, &width, &height, NULL);
         fraktal_param_2f(loc_iResolution, (float)width, (float)height);
         fraktal_param_1i(loc_iSamples, scene.samples);
+        fraktal_param_1i(loc_iAdaptive, count_per_pixel ? 1 : 0);
+        if (denoised)
+        {
+            // already divided by the number of samples
+            in = denoised;
+            fraktal_param_1i(loc_iSamples, 1);
+            fraktal_param_1i(loc_iAdaptive, 0);
+        }
         fraktal_param_array(loc_iChannel0, in);
 
         fraktal_zero_array(out);
@@ -313,8 +889,9 @@ static void render_color(guiState &scene)
     }
 
     fraktal_use_kernel(NULL);
+    scene.should_compose = false;
 }
-#else
+
 static void render_color(guiState &scene)
 {
     if (!scene.render_kernel || !scene.compose_kernel)
@@ -324,23 +901,78 @@ static void render_color(guiState &scene)
     assert(fraktal_is_valid_array(scene.render_buffer));
     assert(fraktal_is_valid_array(scene.compose_buffer));
 
+    // The guide only depends on the camera and the model, so it is rendered
+    // once for the view of the accumulated samples.
+    bool use_reprojection = scene.use_reprojection && scene.guide_kernel && scene.reproject_kernel;
+    bool use_guide = scene.guide_kernel && (scene.use_denoiser || use_reprojection);
+    if (scene.should_reproject && !scene.should_clear)
+    {
+        if (use_reprojection && scene.guide_is_current && scene.samples > 0)
+            reproject_samples(scene);
+        else
+            scene.should_clear = true;
+    }
+    scene.should_reproject = false;
+    if (scene.should_clear)
+    {
+        fraktal_zero_array(scene.render_buffer);
+        fraktal_zero_array(scene.moment_buffer);
+        fraktal_zero_array(scene.converged_buffer);
+        scene.samples = 0;
+        scene.batches = 0;
+        scene.converged_fraction = 0.0f;
+        scene.converged = false;
+        scene.has_history = false;
+        scene.guide_is_current = false;
+        scene.should_clear = false;
+    }
+    if (use_guide && !scene.guide_is_current)
+        render_guide(scene);
+
     // accumulation pass
+    bool use_adaptive = false;
     fraktal_use_kernel(scene.render_kernel);
     {
         fetch_uniform(render_kernel, iResolution);
         fetch_uniform(render_kernel, iSamples);
+        fetch_uniform(render_kernel, iLowResolution);
+        fetch_uniform(render_kernel, iChannel0);
+        fetch_uniform(render_kernel, iMode);
+        fetch_uniform(render_kernel, iAdaptive);
+        fetch_uniform(render_kernel, iConverged);
+        fetch_uniform(render_kernel, iSampler);
+        fetch_uniform(render_kernel, iBlueNoise);
+        fetch_uniform(render_kernel, iHitPass);
+        fetch_uniform(render_kernel, iPrimaryHits);
+        fetch_uniform(render_kernel, iPrimaryStrata);
+        fetch_uniform(render_kernel, iPrimaryReuse);
         scene.render_kernel_is_new = false;
 
         fArray *out = scene.render_buffer;
-        if (scene.should_clear)
+
+        // Adaptive sampling (if the renderer supports it, see libf/sampling.f)
+        // renders each frame to a separate buffer, so that the variance of
+        // each pixel can be tracked, and skips pixels that have converged.
+        use_adaptive = scene.use_adaptive_sampling && loc_iAdaptive >= 0 && loc_iConverged >= 0;
+        if (use_adaptive)
         {
+            out = scene.batch_buffer;
             fraktal_zero_array(out);
-            scene.samples = 0;
-            scene.should_clear = false;
+            fraktal_param_1i(loc_iAdaptive, 1);
+            fraktal_param_array(loc_iConverged, scene.converged_buffer);
+        }
+        else
+        {
+            fraktal_param_1i(loc_iAdaptive, 0);
         }
 
+        if (!scene.blue_noise)
+            scene.blue_noise = create_blue_noise(64);
+        fraktal_param_1i(loc_iSampler, scene.sampler);
+        fraktal_param_array(loc_iBlueNoise, scene.blue_noise);
+
         int width,height;
-        fraktal_array_size(out, &width, &height);
+        fraktal_array_size(out, &width, &height, NULL);
         fraktal_param_2f(loc_iResolution, (float)width, (float)height);
         fraktal_param_1i(loc_iSamples, scene.samples);
 
@@ -350,34 +982,204 @@ static void render_color(guiState &scene)
             if (scene.preset->widgets[i]->is_active())
                 scene.preset->widgets[i]->set_params(scene);
         }
+        update_brick_map(scene);
+        update_model_bounds(scene, scene.render_kernel);
+
+        // Cone-tracing pre-pass (if the renderer supports it, see libf/basic.f).
+        // The cones only depend on the camera and the model, so they are only
+        // traced for the first sample.
+        bool use_cones = scene.use_cone_tracing && loc_iMode >= 0 && loc_iChannel0 >= 0;
+        if (use_cones && scene.samples == 0)
+        {
+            for (int level = 0; level < scene.num_cone_levels; level++)
+            {
+                fArray *cones = scene.cone_buffers[level];
+                int cones_width,cones_height;
+                fraktal_array_size(cones, &cones_width, &cones_height, NULL);
+                fraktal_param_2f(loc_iLowResolution, (float)cones_width, (float)cones_height);
+                if (level == 0)
+                {
+                    fraktal_param_1i(loc_iMode, 2);
+                }
+                else
+                {
+                    fraktal_param_1i(loc_iMode, 3);
+                    fraktal_param_array(loc_iChannel0, scene.cone_buffers[level - 1]);
+                }
+                fraktal_zero_array(cones);
+                fraktal_run_kernel(cones);
+            }
+        }
+        if (use_cones)
+        {
+            fraktal_param_1i(loc_iMode, 1);
+            fraktal_param_array(loc_iChannel0, scene.cone_buffers[scene.num_cone_levels - 1]);
+        }
+        else
+        {
+            fraktal_param_1i(loc_iMode, 0);
+        }
 
-        fraktal_run_kernel(out);
-        scene.samples++;
+        // Primary-hit cache (if the renderer supports it, see libf/publication.f).
+        // The hits are traced again with new jitter once each stratum has
+        // been used by HIT_CACHE_REUSE samples.
+        bool use_hit_cache = scene.use_hit_cache && loc_iHitPass >= 0 && loc_iPrimaryHits >= 0;
+        int hit_cache_cycle = 0;
+        if (use_hit_cache)
+        {
+            // The cache has primary_strata^2 texels per pixel, as many as fit
+            if (!scene.hit_cache)
+            {
+                int long_side = scene.resolution.x > scene.resolution.y ? scene.resolution.x : scene.resolution.y;
+                scene.primary_strata = MAX_PRIMARY_STRATA;
+                while (scene.primary_strata > 1 && scene.primary_strata*long_side > HIT_CACHE_MAX_SIZE)
+                    scene.primary_strata--;
+                scene.hit_cache = fraktal_create_array(NULL, 4, scene.primary_strata*scene.resolution.x, scene.primary_strata*scene.resolution.y, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+            }
+            hit_cache_cycle = scene.primary_strata*scene.primary_strata*HIT_CACHE_REUSE;
+            fraktal_param_1i(loc_iPrimaryStrata, scene.primary_strata);
+            fraktal_param_1i(loc_iPrimaryReuse, HIT_CACHE_REUSE);
+            if (scene.samples % hit_cache_cycle == 0)
+            {
+                fraktal_param_1i(loc_iHitPass, 1);
+                fraktal_zero_array(scene.hit_cache);
+                fraktal_run_kernel(scene.hit_cache);
+            }
+            fraktal_param_1i(loc_iHitPass, 2);
+            fraktal_param_array(loc_iPrimaryHits, scene.hit_cache);
+        }
+        else
+        {
+            fraktal_param_1i(loc_iHitPass, 0);
+        }
+
+        int n = schedule_samples(scene);
+        if (use_hit_cache && n > hit_cache_cycle - scene.samples % hit_cache_cycle)
+            n = hit_cache_cycle - scene.samples % hit_cache_cycle;
+        guiSampleTimer &timer = scene.sample_timer;
+        bool timed = scene.use_frame_budget && fraktal_has_timer_queries() &&
+                     timer.num_pending < MAX_PENDING_TIMERS;
+        if (timed)
+        {
+            glGenQueries(1, &timer.begin[timer.num_pending]);
+            glGenQueries(1, &timer.end[timer.num_pending]);
+            glQueryCounter(timer.begin[timer.num_pending], GL_TIMESTAMP);
+        }
+        fraktal_run_kernel_n(out, n);
+        if (timed)
+        {
+            glQueryCounter(timer.end[timer.num_pending], GL_TIMESTAMP);
+            timer.samples[timer.num_pending] = n;
+            timer.num_pending++;
+        }
+        scene.samples += n;
+        scene.batches++;
     }
 
-    // compose pass
-    fraktal_use_kernel(scene.compose_kernel);
+    // adaptive sampling passes
+    if (use_adaptive)
     {
-        fetch_uniform(compose_kernel, iResolution);
-        fetch_uniform(compose_kernel, iChannel0);
-        fetch_uniform(compose_kernel, iSamples);
-        scene.compose_kernel_is_new = false;
+        fraktal_use_kernel(scene.converge_kernel);
+        fetch_uniform(converge_kernel, iBatch);
+        fetch_uniform(converge_kernel, iAccumulated);
+        fetch_uniform(converge_kernel, iMoments);
+        fetch_uniform(converge_kernel, iPass);
+        fetch_uniform(converge_kernel, iMinSamples);
+        fetch_uniform(converge_kernel, iTolerance);
+        scene.converge_kernel_is_new = false;
+
+        fraktal_param_array(loc_iBatch, scene.batch_buffer);
+        fraktal_param_1i(loc_iPass, 0);
+        fraktal_run_kernel(scene.render_buffer);
+        fraktal_param_1i(loc_iPass, 1);
+        fraktal_run_kernel(scene.moment_buffer);
+
+        fraktal_param_array(loc_iAccumulated, scene.render_buffer);
+        fraktal_param_array(loc_iMoments, scene.moment_buffer);
+        fraktal_param_1i(loc_iMinSamples, scene.adaptive_min_samples);
+        fraktal_param_1f(loc_iTolerance, scene.adaptive_tolerance);
+        fraktal_param_1i(loc_iPass, 2);
+        fraktal_zero_array(scene.converged_buffer);
+        fraktal_run_kernel(scene.converged_buffer);
+
+        // Stop rendering once nearly all pixels have converged. Reading the
+        // result back waits for the GPU, so this is only checked now and then.
+        if (scene.samples >= scene.adaptive_min_samples &&
+            scene.batches % ADAPTIVE_CHECK_EVERY == 0)
+        {
+            int width,height;
+            fraktal_array_size(scene.converged_buffer, &width, &height, NULL);
+            float sum[4];
+            fraktal_reduce(sum, scene.converged_buffer, FRAKTAL_REDUCE_SUM);
+            scene.converged_fraction = sum[0]/(width*height);
+            scene.converged = scene.converged_fraction >= ADAPTIVE_STOP_FRACTION;
+        }
+    }
 
-        fArray *out = scene.compose_buffer;
-        fArray *in = scene.render_buffer;
-        int width,height;
-        fraktal_array_size(out, &width, &height);
-        fraktal_param_2f(loc_iResolution, (float)width, (float)height);
-        fraktal_param_1i(loc_iSamples, scene.samples);
-        fraktal_param_array(loc_iChannel0, in);
+    // With adaptive sampling or reprojected samples, pixels have different
+    // numbers of samples, which are counted in the alpha channel.
+    scene.counts_per_pixel = use_adaptive || scene.has_history;
 
-        fraktal_zero_array(out);
-        fraktal_run_kernel(out);
+    compose_color(scene);
+}
+
+// Renders a single sample at a fraction of the resolution, for quick feedback
+// while parameters are being changed. The accumulated samples are untouched.
+static void render_preview(guiState &scene)
+{
+    if (!scene.render_kernel || !scene.compose_kernel)
+        return;
+    int level = scene.preview_level;
+    assert(level >= 1 && level <= MAX_PREVIEW_LEVEL);
+    fArray *render = scene.preview_render_buffers[level];
+    fArray *compose = scene.preview_compose_buffers[level];
+    assert(fraktal_is_valid_array(render));
+    assert(fraktal_is_valid_array(compose));
+    int width,height;
+    fraktal_array_size(render, &width, &height, NULL);
+
+    // The offsets are looked up here, since the static offsets in
+    // render_color are only refreshed when the kernels are reloaded.
+    fKernel *f = scene.render_kernel;
+    fraktal_use_kernel(f);
+    fraktal_param_2f(fraktal_get_param_offset(f, "iResolution"), (float)width, (float)height);
+    fraktal_param_1i(fraktal_get_param_offset(f, "iSamples"), 0);
+    fraktal_param_1i(fraktal_get_param_offset(f, "iMode"), 0);
+    fraktal_param_1i(fraktal_get_param_offset(f, "iHitPass"), 0);
+    fraktal_param_1i(fraktal_get_param_offset(f, "iAdaptive"), 0);
+    fraktal_param_1i(fraktal_get_param_offset(f, "iSampler"), scene.sampler);
+    if (!scene.blue_noise)
+        scene.blue_noise = create_blue_noise(64);
+    fraktal_param_array(fraktal_get_param_offset(f, "iBlueNoise"), scene.blue_noise);
+
+    // The widgets derive the camera intrinsics from the resolution
+    int2 resolution = scene.resolution;
+    scene.resolution.x = width;
+    scene.resolution.y = height;
+    assert(scene.preset);
+    for (int i = 0; i < scene.preset->num_widgets; i++)
+    {
+        if (scene.preset->widgets[i]->is_active())
+            scene.preset->widgets[i]->set_params(scene);
     }
+    scene.resolution = resolution;
+    update_brick_map(scene);
+    update_model_bounds(scene, scene.render_kernel);
+
+    fraktal_zero_array(render);
+    fraktal_run_kernel(render);
+
+    f = scene.compose_kernel;
+    fraktal_use_kernel(f);
+    fraktal_param_2f(fraktal_get_param_offset(f, "iResolution"), (float)width, (float)height);
+    fraktal_param_1i(fraktal_get_param_offset(f, "iSamples"), 1);
+    fraktal_param_1i(fraktal_get_param_offset(f, "iAdaptive"), 0);
+    fraktal_param_array(fraktal_get_param_offset(f, "iChannel0"), render);
+    fraktal_zero_array(compose);
+    fraktal_run_kernel(compose);
 
     fraktal_use_kernel(NULL);
 }
-#endif
 
 static void render_geometry(guiState &scene)
 {
@@ -396,7 +1198,7 @@ static void render_geometry(guiState &scene)
         fArray *out = scene.compose_buffer;
 
         int width,height;
-        fraktal_array_size(out, &width, &height);
+        fraktal_array_size(out, &width, &height, NULL);
         fraktal_param_2f(loc_iResolution, (float)width, (float)height);
         if      (scene.mode == guiPreviewMode_Normals) glUniform1i(loc_iDrawMode, 0);
         else if (scene.mode == guiPreviewMode_Depth) glUniform1i(loc_iDrawMode, 1);
@@ -410,6 +1212,8 @@ static void render_geometry(guiState &scene)
             if (scene.preset->widgets[i]->is_active())
                 scene.preset->widgets[i]->set_params(scene);
         }
+        update_brick_map(scene);
+        update_model_bounds(scene, scene.render_kernel);
 
         fraktal_zero_array(out);
         fraktal_run_kernel(out);
@@ -468,8 +1272,65 @@ static void allocate_or_resize_buffers(guiState &g)
 
         g.resolution.x = g.new_resolution.x;
         g.resolution.y = g.new_resolution.y;
-        g.render_buffer =  fraktal_create_array(NULL, g.resolution.x, g.resolution.y, 4, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
-        g.compose_buffer = fraktal_create_array(NULL, g.resolution.x, g.resolution.y, 4, FRAKTAL_UINT8, FRAKTAL_READ_WRITE);
+        g.render_buffer =  fraktal_create_array(NULL, 4, g.resolution.x, g.resolution.y, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+        g.compose_buffer = fraktal_create_array(NULL, 4, g.resolution.x, g.resolution.y, 1, FRAKTAL_UINT8, FRAKTAL_READ_WRITE);
+
+        fraktal_destroy_array(g.batch_buffer);
+        fraktal_destroy_array(g.moment_buffer);
+        fraktal_destroy_array(g.converged_buffer);
+        g.batch_buffer =     fraktal_create_array(NULL, 4, g.resolution.x, g.resolution.y, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+        g.moment_buffer =    fraktal_create_array(NULL, 2, g.resolution.x, g.resolution.y, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+        g.converged_buffer = fraktal_create_array(NULL, 2, g.resolution.x, g.resolution.y, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+
+        fraktal_destroy_array(g.guide_buffer);
+        fraktal_destroy_array(g.denoise_buffers[0]);
+        fraktal_destroy_array(g.denoise_buffers[1]);
+        g.guide_buffer =       fraktal_create_array(NULL, 4, g.resolution.x, g.resolution.y, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+        g.denoise_buffers[0] = fraktal_create_array(NULL, 4, g.resolution.x, g.resolution.y, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+        g.denoise_buffers[1] = fraktal_create_array(NULL, 4, g.resolution.x, g.resolution.y, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+
+        fraktal_destroy_array(g.previous_guide_buffer);
+        fraktal_destroy_array(g.history_buffer);
+        g.previous_guide_buffer = fraktal_create_array(NULL, 4, g.resolution.x, g.resolution.y, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+        g.history_buffer =        fraktal_create_array(NULL, 4, g.resolution.x, g.resolution.y, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+
+        for (int level = 1; level <= MAX_PREVIEW_LEVEL; level++)
+        {
+            fraktal_destroy_array(g.preview_render_buffers[level]);
+            fraktal_destroy_array(g.preview_compose_buffers[level]);
+            int width = (g.resolution.x + (1 << level) - 1) >> level;
+            int height = (g.resolution.y + (1 << level) - 1) >> level;
+            g.preview_render_buffers[level] =  fraktal_create_array(NULL, 4, width, height, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+            g.preview_compose_buffers[level] = fraktal_create_array(NULL, 4, width, height, 1, FRAKTAL_UINT8, FRAKTAL_READ_WRITE);
+        }
+        g.shown_preview = NULL;
+
+        // The hit cache is created when it is first used (see render_color)
+        fraktal_destroy_array(g.hit_cache);
+        g.hit_cache = NULL;
+
+        // The cone-tracing levels cover blocks of CONE_FINEST_BLOCK pixels
+        // at the finest level, and twice as large blocks at each coarser
+        // level, as long as the short side keeps CONE_COARSEST_SIZE texels.
+        for (int level = 0; level < g.num_cone_levels; level++)
+            fraktal_destroy_array(g.cone_buffers[level]);
+        int num_levels = 1;
+        while (num_levels < MAX_CONE_LEVELS)
+        {
+            int block = CONE_FINEST_BLOCK << num_levels;
+            int short_side = g.resolution.x < g.resolution.y ? g.resolution.x : g.resolution.y;
+            if ((short_side + block - 1)/block < CONE_COARSEST_SIZE)
+                break;
+            num_levels++;
+        }
+        g.num_cone_levels = num_levels;
+        for (int level = 0; level < num_levels; level++)
+        {
+            int block = CONE_FINEST_BLOCK << (num_levels - 1 - level);
+            int width = (g.resolution.x + block - 1)/block;
+            int height = (g.resolution.y + block - 1)/block;
+            g.cone_buffers[level] = fraktal_create_array(NULL, 1, width, height, 1, FRAKTAL_FLOAT, FRAKTAL_READ_WRITE);
+        }
         g.should_clear = true;
     }
 }
@@ -513,10 +1374,64 @@ static void update_and_render_gui(guiState &scene)
     {
         if (!scene.keys.Alt.down && scene.keys.Enter.pressed)
             scene.auto_render = !scene.auto_render;
-        if (scene.auto_render && scene.samples < scene.max_samples)
-            render_color(scene);
-        else if (scene.should_clear)
-            render_color(scene);
+
+        // While parameters are being changed, previews are rendered at a
+        // fraction of the resolution, picked from the time spent per frame.
+        // The changes are applied to the accumulated samples once they settle.
+        double t = glfwGetTime();
+        bool changed = scene.should_clear || scene.should_reproject;
+        if (changed && scene.use_progressive_resolution)
+            scene.last_change_time = t;
+        bool interacting = scene.use_progressive_resolution &&
+                           t - scene.last_change_time < PREVIEW_SETTLE_TIME;
+
+        double t_begin = glfwGetTime();
+        bool rendered = false;
+        if (interacting && scene.preview_level > 0)
+        {
+            if (changed)
+            {
+                scene.pending_clear |= scene.should_clear;
+                scene.pending_reproject |= scene.should_reproject;
+                scene.should_clear = false;
+                scene.should_reproject = false;
+                render_preview(scene);
+                scene.shown_preview = scene.preview_compose_buffers[scene.preview_level];
+                rendered = true;
+            }
+        }
+        else
+        {
+            scene.should_clear |= scene.pending_clear;
+            scene.should_reproject |= scene.pending_reproject;
+            scene.pending_clear = false;
+            scene.pending_reproject = false;
+            if (scene.auto_render && scene.samples < scene.max_samples && !scene.converged)
+                rendered = true;
+            else if (scene.should_clear || scene.should_reproject)
+                rendered = true;
+            if (rendered)
+            {
+                render_color(scene);
+                scene.shown_preview = NULL;
+            }
+            else if (scene.should_compose && scene.samples > 0)
+            {
+                compose_color(scene);
+                scene.shown_preview = NULL;
+            }
+        }
+
+        // A level has a quarter of the pixels of the next finer level
+        if (interacting && rendered)
+        {
+            glFinish();
+            double elapsed = glfwGetTime() - t_begin;
+            if (elapsed > PREVIEW_TARGET_TIME && scene.preview_level < MAX_PREVIEW_LEVEL)
+                scene.preview_level++;
+            else if (4.0*elapsed < 0.5*PREVIEW_TARGET_TIME && scene.preview_level > 0)
+                scene.preview_level--;
+        }
     }
     else
     {
@@ -671,8 +1586,15 @@ static void update_and_render_gui(guiState &scene)
         assert(scene.preset);
         for (int i = 0; i < scene.preset->num_widgets; i++)
         {
-            if (scene.preset->widgets[i]->is_active())
-                scene.should_clear |= scene.preset->widgets[i]->update(scene);
+            if (!scene.preset->widgets[i]->is_active())
+                continue;
+            bool changed = scene.preset->widgets[i]->update(scene);
+
+            // If only the camera moved, the samples can be reprojected
+            if (changed && i == 0 && scene.mode == guiPreviewMode_Color && scene.use_reprojection)
+                scene.should_reproject = true;
+            else
+                scene.should_clear |= changed;
         }
 
         ImGui::End();
@@ -772,6 +1694,86 @@ static void update_and_render_gui(guiState &scene)
                     if (ImGui::DragInt("##max_samples", &scene.max_samples, 1.0f, 1, 2048))
                         scene.should_clear = true;
                     ImGui::PopItemWidth();
+                    ImGui::Text("Per frame: ");
+                    if (scene.use_frame_budget && fraktal_has_timer_queries())
+                    {
+                        ImGui::Text("%d (%.2f ms each)", scene.budget_samples_per_frame, scene.gpu_ms_per_sample);
+                    }
+                    else
+                    {
+                        ImGui::PushItemWidth(48.0f);
+                        ImGui::DragInt("##samples_per_frame", &scene.samples_per_frame, 0.25f, 1, MAX_SAMPLES_PER_FRAME);
+                        ImGui::PopItemWidth();
+                    }
+                    if (ImGui::Checkbox("Cones", &scene.use_cone_tracing))
+                        scene.should_clear = true;
+                    if (ImGui::Checkbox("Hit cache", &scene.use_hit_cache))
+                    {
+                        if (!scene.use_hit_cache)
+                        {
+                            fraktal_destroy_array(scene.hit_cache);
+                            scene.hit_cache = NULL;
+                        }
+                        scene.should_clear = true;
+                    }
+                    if (ImGui::Checkbox("Reproject", &scene.use_reprojection))
+                        scene.should_clear = true;
+                    ImGui::Checkbox("Progressive", &scene.use_progressive_resolution);
+                    if (ImGui::BeginMenu("Sampling"))
+                    {
+                        if (ImGui::MenuItem("Sobol", NULL, scene.sampler == 0)) { scene.sampler = 0; scene.should_clear = true; }
+                        if (ImGui::MenuItem("R2", NULL, scene.sampler == 1)) { scene.sampler = 1; scene.should_clear = true; }
+                        if (ImGui::MenuItem("Blue noise", NULL, scene.sampler == 2)) { scene.sampler = 2; scene.should_clear = true; }
+                        ImGui::Separator();
+                        if (ImGui::Checkbox("Adaptive", &scene.use_adaptive_sampling))
+                            scene.should_clear = true;
+                        ImGui::PushItemWidth(96.0f);
+                        if (ImGui::DragFloat("Tolerance", &scene.adaptive_tolerance, 0.001f, 0.001f, 1.0f))
+                            scene.should_clear = true;
+                        if (ImGui::DragInt("Min. samples", &scene.adaptive_min_samples, 0.25f, 2, 1024))
+                            scene.should_clear = true;
+                        ImGui::PopItemWidth();
+                        ImGui::Text("Converged: %.1f%%", 100.0f*scene.converged_fraction);
+                        ImGui::Separator();
+                        ImGui::Checkbox("Fit frame budget", &scene.use_frame_budget);
+                        ImGui::PushItemWidth(96.0f);
+                        ImGui::DragFloat("Budget", &scene.frame_budget_ms, 0.1f, 1.0f, 100.0f, "%.1f ms");
+                        ImGui::PopItemWidth();
+                        ImGui::EndMenu();
+                    }
+                    if (ImGui::BeginMenu("Denoise"))
+                    {
+                        if (ImGui::Checkbox("Enabled", &scene.use_denoiser))
+                            scene.should_compose = true;
+                        ImGui::PushItemWidth(96.0f);
+                        if (ImGui::SliderInt("Iterations", &scene.denoise_iterations, 1, 6))
+                            scene.should_compose = true;
+                        if (ImGui::DragFloat("Strength", &scene.denoise_strength, 0.01f, 0.0f, 10.0f))
+                            scene.should_compose = true;
+                        ImGui::PopItemWidth();
+                        ImGui::EndMenu();
+                    }
+                }
+                ImGui::Separator();
+                if (ImGui::BeginMenu("Cache"))
+                {
+                    if (ImGui::Checkbox("Brick map", &scene.use_brick_map))
+                        scene.should_clear = true;
+                    if (ImGui::Checkbox("Model bounds", &scene.use_model_bounds))
+                        scene.should_clear = true;
+                    ImGui::PushItemWidth(96.0f);
+                    if (ImGui::DragFloat("Extent", &scene.brick_map_extent, 0.01f, 0.1f, 100.0f))
+                    {
+                        fraktal_invalidate_brick_map(scene.brick_map);
+                        scene.should_clear = true;
+                    }
+                    if (ImGui::DragInt("Resolution", &scene.brick_map_resolution, 0.25f, 8, 256))
+                    {
+                        fraktal_invalidate_brick_map(scene.brick_map);
+                        scene.should_clear = true;
+                    }
+                    ImGui::PopItemWidth();
+                    ImGui::EndMenu();
                 }
             }
             ImGui::EndMenuBar();
@@ -779,8 +1781,10 @@ static void update_and_render_gui(guiState &scene)
             ImDrawList *draw = ImGui::GetWindowDrawList();
             {
                 int width,height;
-                fraktal_array_size(scene.compose_buffer, &width, &height);
+                fraktal_array_size(scene.compose_buffer, &width, &height, NULL);
                 unsigned int texture = fraktal_get_gl_handle(scene.compose_buffer);
+                if (scene.shown_preview && scene.mode == guiPreviewMode_Color)
+                    texture = fraktal_get_gl_handle(scene.shown_preview);
 
                 ImVec2 image_size = ImVec2((float)width, (float)height);
                 if (io.DisplayFramebufferScale.x > 0.0f &&
@@ -853,8 +1857,8 @@ static void update_and_render_gui(guiState &scene)
                 ImVec2 box0 = ImGui::GetCursorScreenPos();
                 ImVec2 box1 = ImVec2(box0.x + 128.0f, box0.y + 128.0f);
 
-                fraktal_assert(scene.preset->num_widgets > 0);
-                Widget_Camera *camera = (Widget_Camera*)scene.preset->widgets[0];
+                fraktal_assert(scene.preset->camera);
+                Widget_Camera *camera = scene.preset->camera;
 
                 float3 r =
                 {
@@ -1061,6 +2065,24 @@ static void default_settings(guiState &g)
     g.settings.y = -1;
     g.settings.ui_scale = 1.0f;
     g.max_samples = 128;
+    g.samples_per_frame = 1;
+    g.budget_samples_per_frame = 1;
+    g.use_brick_map = false;
+    g.brick_map_resolution = 64;
+    g.brick_map_extent = 2.0f;
+    g.use_cone_tracing = true;
+    g.use_hit_cache = true;
+    g.use_model_bounds = true;
+    g.use_adaptive_sampling = false;
+    g.adaptive_tolerance = 0.02f;
+    g.adaptive_min_samples = 16;
+    g.use_denoiser = false;
+    g.denoise_iterations = 4;
+    g.denoise_strength = 1.0f;
+    g.use_reprojection = true;
+    g.use_progressive_resolution = true;
+    g.use_frame_budget = true;
+    g.frame_budget_ms = 12.0f;
 }
 
 static void sanitize_settings(guiState &g)
@@ -1071,6 +2093,22 @@ static void sanitize_settings(guiState &g)
         g.settings.height = 600;
     if (g.settings.ui_scale < 0.5f || g.settings.ui_scale > 4.0f)
         g.settings.ui_scale = 1.0f;
+    if (g.samples_per_frame < 1 || g.samples_per_frame > MAX_SAMPLES_PER_FRAME)
+        g.samples_per_frame = 1;
+    if (g.frame_budget_ms < 1.0f)
+        g.frame_budget_ms = 12.0f;
+    if (g.brick_map_resolution < 8 || g.brick_map_resolution > 256)
+        g.brick_map_resolution = 64;
+    if (g.brick_map_extent <= 0.0f)
+        g.brick_map_extent = 2.0f;
+    if (g.adaptive_tolerance <= 0.0f)
+        g.adaptive_tolerance = 0.02f;
+    if (g.adaptive_min_samples < 2)
+        g.adaptive_min_samples = 16;
+    if (g.denoise_iterations < 1 || g.denoise_iterations > 6)
+        g.denoise_iterations = 4;
+    if (g.denoise_strength < 0.0f)
+        g.denoise_strength = 1.0f;
 }
 
 int main(int argc, char **argv)
@@ -1103,11 +2141,14 @@ int main(int argc, char **argv)
     {
         guiPreset &p = g_scene.presets[preset];
         p.num_widgets = 0;
-        p.widgets[p.num_widgets++] = new Widget_Camera;
+        p.camera = new Widget_Camera;
+        p.widgets[p.num_widgets++] = p.camera;
         p.widgets[p.num_widgets++] = new Widget_Sun;
         p.widgets[p.num_widgets++] = new Widget_Material;
         p.widgets[p.num_widgets++] = new Widget_Ground;
         p.widgets[p.num_widgets++] = new Widget_Geometry;
+        p.tracing = new Widget_Tracing;
+        p.widgets[p.num_widgets++] = p.tracing;
         for (int i = 0; i < p.num_widgets; i++)
             p.widgets[i]->default_values();
     }
@@ -1165,7 +2206,7 @@ int main(int argc, char **argv)
     while (!glfwWindowShouldClose(fraktal_context) && !g_scene.should_exit)
     {
         static int settle_frames = 10;
-        if ((g_scene.auto_render && g_scene.samples < g_scene.max_samples) || settle_frames > 0)
+        if ((g_scene.auto_render && g_scene.samples < g_scene.max_samples) || settle_frames > 0 || g_scene.shown_preview)
         {
             glfwPollEvents();
         }
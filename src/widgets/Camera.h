@@ -139,20 +139,26 @@ struct Widget_Camera : Widget
 
         return changed;
     }
-    virtual void set_params(guiState &g)
+    void get_camera(guiState &g, float view[4*4], float *f, float2 *center)
     {
-        float cx = (0.5f + 0.5f*camera_shift.x)*g.resolution.x;
-        float cy = (0.5f + 0.5f*camera_shift.y)*g.resolution.y;
-        float f = yfov2pinhole_f(camera_yfov, (float)g.resolution.y);
-        fraktal_param_2f(loc_iCameraCenter, cx, cy);
-        fraktal_param_1f(loc_iCameraF, f);
-        float iView[4*4];
+        center->x = (0.5f + 0.5f*camera_shift.x)*g.resolution.x;
+        center->y = (0.5f + 0.5f*camera_shift.y)*g.resolution.y;
+        *f = yfov2pinhole_f(camera_yfov, (float)g.resolution.y);
         float3 r = {
             deg2rad(dir.theta),
             deg2rad(dir.phi),
             0.0f
         };
-        compute_view_matrix(iView, pos, r);
+        compute_view_matrix(view, pos, r);
+    }
+    virtual void set_params(guiState &g)
+    {
+        float iView[4*4];
+        float f;
+        float2 c;
+        get_camera(g, iView, &f, &c);
+        fraktal_param_2f(loc_iCameraCenter, c.x, c.y);
+        fraktal_param_1f(loc_iCameraF, f);
         fraktal_param_transpose_matrix4f(loc_iView, iView);
     }
 };
@@ -29,9 +29,10 @@ struct Widget_Geometry : Widget
         {
             f_colormap_inferno = fraktal_create_array(
                 colormap_inferno,
+                4,
                 colormap_inferno_length,
                 1,
-                4,
+                1,
                 FRAKTAL_FLOAT,
                 FRAKTAL_READ_ONLY
             );
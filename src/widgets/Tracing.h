@@ -0,0 +1,66 @@
+#pragma once
+
+struct Widget_Tracing : Widget
+{
+    int steps;
+    float lipschitz;
+    float relaxation;
+    float footprint;
+    int loc_iTraceSteps;
+    int loc_iTraceLipschitz;
+    int loc_iTraceRelaxation;
+    int loc_iTraceFootprint;
+
+    virtual void default_values()
+    {
+        steps = 512;
+        lipschitz = 1.0f;
+        relaxation = 1.2f;
+        footprint = 1.0f;
+    }
+    virtual void deserialize(const char **cc)
+    {
+        while (parse_next_in_list(cc)) {
+            if (parse_argument_int(cc, "steps", &steps)) ;
+            else if (parse_argument_float(cc, "lipschitz", &lipschitz)) ;
+            else if (parse_argument_float(cc, "relaxation", &relaxation)) ;
+            else if (parse_argument_float(cc, "footprint", &footprint)) ;
+            else parse_list_unexpected();
+        }
+    }
+    virtual void serialize(FILE *f)
+    {
+
+    }
+    virtual void get_param_offsets(fKernel *f)
+    {
+        loc_iTraceSteps = fraktal_get_param_offset(f, "iTraceSteps");
+        loc_iTraceLipschitz = fraktal_get_param_offset(f, "iTraceLipschitz");
+        loc_iTraceRelaxation = fraktal_get_param_offset(f, "iTraceRelaxation");
+        loc_iTraceFootprint = fraktal_get_param_offset(f, "iTraceFootprint");
+    }
+    virtual bool is_active()
+    {
+        if (loc_iTraceSteps < 0) return false;
+        return true;
+    }
+    virtual bool update(guiState &g)
+    {
+        bool changed = false;
+        if (ImGui::CollapsingHeader("Tracing"))
+        {
+            changed |= ImGui::DragInt("Steps", &steps, 1.0f, 1, 4096);
+            changed |= ImGui::DragFloat("Lipschitz", &lipschitz, 0.01f, 1.0f, 100.0f);
+            changed |= ImGui::SliderFloat("Relaxation", &relaxation, 1.0f, 1.9f);
+            changed |= ImGui::DragFloat("Footprint", &footprint, 0.01f, 0.01f, 16.0f);
+        }
+        return changed;
+    }
+    virtual void set_params(guiState &g)
+    {
+        fraktal_param_1i(loc_iTraceSteps, steps);
+        fraktal_param_1f(loc_iTraceLipschitz, lipschitz);
+        fraktal_param_1f(loc_iTraceRelaxation, relaxation);
+        fraktal_param_1f(loc_iTraceFootprint, footprint);
+    }
+};